@@ -0,0 +1,62 @@
+#pragma once
+#include "Assembler.h"
+#include "Memory.h"
+#include "Optimizer.h"
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// An assembly source file loaded into memory, remembered line by line so
+// that edits can be applied incrementally.
+//
+// reload() re-reads the file, lays it out again (cheap: no encoding) and
+// re-encodes only lines whose text, address or referenced label addresses
+// changed. Only words whose value actually differs are written to memory;
+// the rest of memory, registers, PC and breakpoints are left alone.
+class AsmSession {
+public:
+  struct Result {
+    std::size_t lines = 0;     // source lines
+    std::size_t words = 0;     // words the program occupies
+    std::size_t reencoded = 0; // lines that went through the assembler
+    std::size_t patched = 0;   // memory words written (incl. cleared leftovers)
+  };
+
+  bool active() const { return !path.empty(); }
+  const std::string& file() const { return path; }
+
+  // Assemble 'fname' at 'base' and write every word into memory.
+  Result load(const std::string& fname, u64 base, Memory& mem);
+  // Re-read the current file and patch only what changed.
+  Result reload(Memory& mem);
+  // Follow code moved by the optimizer: lines, labels and addresses map to
+  // the new layout, and lines whose word was removed map to no address.
+  // The assembled words stay as they were, so reload() brings back the
+  // unoptimized program.
+  void relocate(const Optimizer::Result& moved);
+
+  // Source mapping (line numbers are 1-based).
+  std::optional<std::size_t> lineForAddr(u64 addr) const;
+  std::optional<u64> addrForLine(std::size_t line) const;
+  std::string lineText(std::size_t line) const;
+  const Assembler::SymbolTable& symbolTable() const { return symbols; }
+
+private:
+  struct Slot {
+    std::string instr;             // instruction text that produced the word
+    u32 word = 0;
+    std::vector<std::string> refs; // labels the instruction refers to
+  };
+
+  std::string path;
+  u64 base = 0;
+  std::vector<std::string> lines;
+  std::vector<i64> lineAddr;
+  std::unordered_map<u64, Slot> slots; // by byte address
+  std::unordered_map<u64, std::size_t> addrLine;
+  Assembler::SymbolTable symbols;
+
+  Result apply(std::vector<std::string> newLines, Memory& mem, bool full);
+};
@@ -2,13 +2,58 @@
 #include "Types.h"
 #include <optional>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 // Assembles one line of assembly into a 32-bit word.
 // Returns nullopt if the line is empty/comment-only.
 // Throws runtime_error on parse errors.
+//
+// Source files may also use labels ("loop:" at the start of a line) as
+// branch targets and ".word value" for data. Those go through
+// assembleSource, which lays out the whole file first.
 class Assembler {
 public:
+  using SymbolTable = std::unordered_map<std::string, u64>; // label -> byte address
+
+  // A source line split into its optional label and instruction text
+  // (comments removed, either part may be empty).
+  struct SourceLine {
+    std::string label;
+    std::string instr;
+  };
+
+  // Pass-1 result: where every line goes, without encoding anything.
+  struct Layout {
+    std::vector<i64> lineAddr;       // per source line: byte address of its word, or -1
+    std::vector<std::string> instrs; // per source line: instruction text ("" if none)
+    SymbolTable symbols;
+    u64 end = 0;                     // first byte address after the program
+  };
+
+  // An assembled source file.
+  struct Program {
+    std::vector<u32> words;    // consecutive words starting at the base address
+    std::vector<i64> lineAddr; // per source line: byte address of its word, or -1
+    SymbolTable symbols;
+  };
+
   static std::optional<u32> assembleLine(const std::string& line);
+  // 'pc' is the address the word will live at; labels resolve through 'symbols'.
+  static std::optional<u32> assembleLine(const std::string& line, u64 pc, const SymbolTable* symbols);
   static std::string disasm(u32 word, u64 pc);
+
+  static SourceLine splitSourceLine(const std::string& line);
+  // Label names an instruction's operands refer to.
+  static std::vector<std::string> referencedLabels(const std::string& instr);
+  // Pass 1 over a whole file placed at 'base'. Errors carry the line number.
+  static Layout layoutSource(const std::vector<std::string>& lines, u64 base);
+  // Both passes. Errors carry the line number.
+  static Program assembleSource(const std::vector<std::string>& lines, u64 base);
+  // Same result as assembleSource, but both passes run over contiguous
+  // chunks of lines on 'threads' host threads (0 = all cores). Chunk label
+  // tables are merged between the passes and each chunk encodes straight
+  // into its slice of the output. Reports the same first error as the
+  // sequential version.
+  static Program assembleSourceParallel(const std::vector<std::string>& lines, u64 base, unsigned threads = 0);
 };
@@ -0,0 +1,66 @@
+#pragma once
+#include "Types.h"
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class CPU;
+class Memory;
+
+// Address breakpoints with optional conditions and ignore counts.
+//
+// The run loop only looks the PC up in the table; the condition of a
+// breakpoint is evaluated when execution reaches its own address, so a
+// conditional breakpoint in a hot loop costs nothing anywhere else.
+//
+// Conditions are compiled once, when the breakpoint is set, into a tree of
+// closures. Grammar (comparisons are unsigned 64-bit):
+//
+//   cond    := and ('||' and)*
+//   and     := unary ('&&' unary)*
+//   unary   := '!' unary | '(' cond ')' | operand [cmp operand]
+//   cmp     := '==' | '!=' | '<' | '<=' | '>' | '>='
+//   operand := Xn | PC | M[#addr] | M[Xn] | #value | value
+//
+// A bare operand is true when it is non-zero. M[...] reads RAM only (never
+// a device register); an unaligned or out-of-range address makes the whole
+// condition false instead of faulting.
+class Breakpoints {
+public:
+  using Predicate = std::function<bool(const CPU&, const Memory&)>;
+
+  struct Breakpoint {
+    std::string condText; // as typed, "" = unconditional
+    Predicate cond;       // empty = always true
+    u64 ignore = 0;       // 'after N': the first N hits do not stop
+    u64 hits = 0;         // times the PC got here with the condition true
+  };
+
+  bool empty() const { return table.empty(); }
+  bool contains(u64 addr) const { return table.count(addr) != 0; }
+
+  // Adds or replaces the breakpoint at 'addr'. Throws on a bad condition.
+  void set(u64 addr, const std::string& cond = "", u64 ignore = 0, u64 hits = 0);
+  bool erase(u64 addr) { return table.erase(addr) != 0; }
+  void clear() { table.clear(); }
+
+  // Whether execution should stop before the instruction at 'pc'. One table
+  // lookup; only a breakpoint at 'pc' evaluates its condition and, if it
+  // holds, counts a hit.
+  bool check(u64 pc, const CPU& cpu, const Memory& mem) {
+    auto it = table.find(pc);
+    return it != table.end() && hit(it->second, cpu, mem);
+  }
+
+  // Sorted by address.
+  std::vector<std::pair<u64, const Breakpoint*>> list() const;
+
+  static Predicate compile(const std::string& cond);
+
+private:
+  std::unordered_map<u64, Breakpoint> table;
+
+  static bool hit(Breakpoint& bp, const CPU& cpu, const Memory& mem);
+};
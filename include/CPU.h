@@ -1,20 +1,94 @@
 #pragma once
+#include "CallStack.h"
+#include "Flags.h"
 #include "Types.h"
 #include "Memory.h"
+#include "Vector.h"
 #include <array>
 #include <string>
 
-struct Flags {
-  bool Z = false; // zero
-  bool N = false; // negative
+// Hot-path metrics, kept per CPU. Plain integers only: the interpreter bumps
+// instret, everything else is filled in at run/command granularity.
+struct PerfCounters {
+  u64 instret = 0;      // instructions retired
+  u64 execNs = 0;       // host time spent executing guest code
+  u64 renderNs = 0;     // host time spent producing state frames
+  u64 parseNs = 0;      // host time spent parsing/dispatching REPL commands
+  u64 lastRunInstr = 0; // instructions retired by the most recent run
+  u64 lastRunNs = 0;    // host time of the most recent run
+  u64 bpChecks = 0;     // breakpoint lookups done by run()
+  u64 bpHits = 0;       // lookups that stopped execution
+  u64 fusedPairs = 0;   // instruction pairs run as one fused op (2 instret each)
+};
+
+class Breakpoints;
+class CallProfiler;
+class Coverage;
+class HostCalls;
+
+// Why run() returned. Return: runToDepth() saw the call depth drop.
+enum class StopReason { Halt, Breakpoint, StepLimit, Return };
+
+// Timer interrupt state of one hart, programmed through the timer device
+// (Devices.h). The interrupt is taken before the next instruction once
+// instret reaches 'at': PC goes to ELR, NZCV is saved and PC jumps to
+// 'vector'. ERET returns. A new interrupt waits until the handler returns.
+struct Interrupts {
+  static constexpr u64 kNever = ~0ull;
+  u64 at = kNever;     // instret at which the next interrupt is due
+  u64 period = 0;      // re-arms 'at' by this much when taken; 0 = one-shot
+  u64 interval = 0;    // timer INTERVAL register
+  u64 vector = 0;      // handler address
+  u64 elr = 0;         // PC to return to
+  Flags saved;         // NZCV to restore
+  bool inHandler = false;
+  u64 taken = 0;       // interrupts delivered
 };
 
 class CPU {
   std::array<u64, 32> X{};
+  std::array<Vec128, 32> V{}; // vector extension
   u64 pc = 0; // byte address
-  Flags flags{};
+  LazyFlags flags{};
+  PerfCounters perf{};
+  int hartId = 0; // which hart this is when several share one Memory
+  CallStack calls; // shadow call stack: BL pushes, RET unwinds
+  CallProfiler* callProfiler = nullptr; // follows the shadow stack when set
+  Coverage* coverage = nullptr;         // marks every executed word when set
+  HostCalls* host = nullptr;            // serves HCALL; without one HCALL faults
+  Interrupts irq;
+  // irq.at, or never while the handler runs: step() takes the interrupt
+  // once instret reaches it.
+  u64 irqDeadline = Interrupts::kNever;
+  // run() executes up to instret == sliceEnd, the smaller of the run's end
+  // and irqDeadline, then takes the interrupt or returns.
+  u64 runEnd = 0;
+  u64 sliceEnd = 0;
+  void updateDeadline();
+
+  // Executes 'instr', the word at PC. With 'fuse' set, an instruction pair
+  // starting at PC may run as one op (see run()). Returns the instructions
+  // retired, 0 on HALT.
+  u32 exec(Memory& mem, u32 instr, bool fuse, const Breakpoints* breakpoints);
+  // The word after PC if it may be fused with the one at PC, else OP_HALT.
+  u32 fusionPartner(const Memory& mem, const Breakpoints* breakpoints) const;
+  u32 fusedBranch(u32 branch, bool take);
+  // LDURB/LDURH/LDURSW/LDURD and STURB/STURH/STURD; kept out of exec().
+  void execSized(Memory& mem, u32 instr);
 public:
-  CPU();
+  explicit CPU(int hartId = 0);
+
+  int  getHartId() const { return hartId; }
+  void setHartId(int id) { hartId = id; }
+
+  // Not owned. Only one CPU at a time should feed a given profiler.
+  void setCallProfiler(CallProfiler* p) { callProfiler = p; }
+  CallProfiler* getCallProfiler() const { return callProfiler; }
+  // Not owned; must cover all of the Memory this CPU runs on.
+  void setCoverage(Coverage* c) { coverage = c; }
+  // Not owned; may be shared by harts.
+  void setHostCalls(HostCalls* h) { host = h; }
+  HostCalls* getHostCalls() const { return host; }
 
   void reset();
   void clearRegisters();
@@ -24,14 +98,67 @@ public:
 
   u64  getX(int i) const;
   void setX(int i, u64 v);
+  const Vec128& getV(int i) const;
+  void setV(int i, const Vec128& v);
+
+  // Materializes NZCV from the last flag-setting instruction.
+  Flags getFlags() const { return flags.get(); }
+  void setFlags(const Flags& f) { flags.set(f); }
+  const LazyFlags& getLazyFlags() const { return flags; }
+  void setLazyFlags(const LazyFlags& f) { flags = f; }
+
+  // Execute one instruction at current PC (after taking a due interrupt).
+  // Returns false if HALT encountered. Never fuses: single steps see every
+  // instruction.
+  bool step(Memory& mem) {
+    if (perf.instret >= irqDeadline) takeInterrupt();
+    if (!exec(mem, mem.fetchWord(pc), false, nullptr)) return false;
+    perf.instret++;
+    return true;
+  }
+
+  // One dispatch of a headless run: an instruction, or a fused pair when
+  // 'fuse' is set and no breakpoint sits on its second instruction.
+  // Returns the instructions retired, 0 on HALT.
+  u32 stepFused(Memory& mem, bool fuse, const Breakpoints* breakpoints) {
+    const u32 n = exec(mem, mem.fetchWord(pc), fuse, breakpoints);
+    perf.instret += n;
+    return n;
+  }
+
+  // Headless execution: no rendering, stops on HALT, after maxSteps
+  // instructions, or before executing an instruction at a breakpoint whose
+  // condition holds (the instruction at the starting PC is always executed).
+  //
+  // Common adjacent pairs run as one fused op: CMP + B.cond, ADDI/SUBI +
+  // CBZ/CBNZ, and LDUR + an ADD that reads the loaded register. The pair is
+  // split when a breakpoint sits on its second instruction or only one step
+  // is left, so fusion is never observable. Pairs never straddle a due
+  // interrupt either; interrupts are taken exactly where step() takes them.
+  StopReason run(Memory& mem, u64 maxSteps, Breakpoints* breakpoints = nullptr);
+
+  // Like run(), but also stops right after an instruction that leaves the
+  // call depth at or below 'depth' (used by next/finish).
+  StopReason runToDepth(Memory& mem, u64 maxSteps, i64 depth, Breakpoints* breakpoints = nullptr);
+  i64 getCallDepth() const { return calls.depth(); }
+  const CallStack& getCallStack() const { return calls; }
+  void setCallStack(const CallStack& s) { calls = s; }
 
-  const Flags& getFlags() const { return flags; }
-  void setFlags(bool Z, bool N) { flags.Z = Z; flags.N = N; }
+  const Interrupts& getInterrupts() const { return irq; }
+  void setInterrupts(const Interrupts& i) { irq = i; updateDeadline(); }
+  // Timer CTRL write: enable arms the interrupt 'interval' instructions
+  // from now (counting the current one), periodic re-arms it each time.
+  void armTimer(bool enable, bool periodic);
+  // Jumps to the handler; run() and step() call it once the interrupt is due.
+  void takeInterrupt();
+  // For run(): where the current slice ends, see sliceEnd.
+  void beginRun(u64 end) { runEnd = end; updateDeadline(); }
+  u64 getSliceEnd() const { return sliceEnd; }
 
-  // Execute one instruction at current PC. Returns false if HALT encountered.
-  bool step(Memory& mem);
+  PerfCounters& counters() { return perf; }
+  const PerfCounters& counters() const { return perf; }
 
   // helpers for ALU ops
   static u64 add64(u64 a, u64 b);
-  static u64 sub64(u64 a, u64 b, bool& Z, bool& N);
+  static u64 sub64(u64 a, u64 b);
 };
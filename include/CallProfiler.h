@@ -0,0 +1,71 @@
+#pragma once
+#include "Types.h"
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Call-graph profiler fed by the interpreter on BL and RET only.
+//
+// The frames follow the CPU's shadow call stack (CallStack.h): BL pushes a
+// frame for its target (the function's identity), and a RET pops as many
+// frames as it unwound there (none for a RET that is a jump). Instructions
+// retired between two events are charged to the frame on top, so nothing is
+// done per instruction.
+//
+// Per function: exclusive instructions (its own), inclusive instructions
+// (including callees; recursive activations are counted once) and calls.
+// Per calling context: exclusive instructions, exported as folded stacks
+// ("main;sort;swap 1234") for flame-graph tools.
+class CallProfiler {
+public:
+  struct FunctionStats {
+    u64 addr = 0;      // entry address (BL target)
+    u64 calls = 0;
+    u64 exclusive = 0; // instructions retired in the function itself
+    u64 inclusive = 0; // ... plus everything it called
+  };
+  using Namer = std::function<std::string(u64 addr)>;
+
+  // Discards all data and starts with a root frame for 'entryPc'.
+  void start(u64 entryPc, u64 instret);
+
+  // Hooks called by CPU::exec. 'instret' counts the BL/RET itself;
+  // 'frames' is what the RET unwound on the CPU's shadow stack (at least 1).
+  void onCall(u64 target, u64 instret);
+  void onReturn(std::size_t frames, u64 instret);
+
+  bool started() const { return !stack.empty(); }
+  std::size_t depth() const { return stack.size(); }
+
+  // Charges everything retired up to 'instret' and returns per-function
+  // totals, heaviest inclusive first. Live frames count up to 'instret'.
+  std::vector<FunctionStats> functions(u64 instret);
+  // One "root;caller;callee count" line per calling context with
+  // exclusive instructions.
+  void writeFolded(std::ostream& out, u64 instret, const Namer& name);
+
+private:
+  struct Node {
+    u64 func = 0;
+    std::size_t parent = 0;
+    u64 exclusive = 0;
+    std::unordered_map<u64, std::size_t> children; // by callee address
+  };
+  struct Frame {
+    u64 func = 0;
+    u64 enterInstret = 0;
+    std::size_t node = 0;
+  };
+
+  std::vector<Node> nodes;  // calling-context tree, nodes[0] is the root
+  std::vector<Frame> stack; // shadow call stack, stack[0] is the root
+  std::unordered_map<u64, FunctionStats> funcs;
+  std::unordered_map<u64, u32> active; // live frames per function (recursion)
+  u64 mark = 0;                        // instret already charged
+
+  void charge(u64 instret);
+  void push(u64 func, u64 instret);
+  void pop(u64 instret);
+};
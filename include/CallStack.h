@@ -0,0 +1,74 @@
+#pragma once
+#include "Types.h"
+#include <functional>
+#include <utility>
+#include <vector>
+
+// Shadow call stack kept by every CPU on BL/RET: function entry addresses
+// only, no accounting. It is the one record of calls: the call depth used
+// by next/finish, the sampler's stacks and the frames of the call-graph
+// profiler (CallProfiler) all follow it.
+class CallStack {
+public:
+  struct Frame {
+    u64 func = 0;       // BL target (or the entry PC for the root frame)
+    u64 returnAddr = 0; // what X30 was set to
+  };
+  static constexpr std::size_t kMaxDepth = 1 << 16; // deeper calls are only counted
+
+  explicit CallStack(u64 entryPc = 0) { reset(entryPc); }
+
+  void reset(u64 entryPc) {
+    frames.assign(1, Frame{entryPc, ~0ull});
+    untracked = 0;
+  }
+
+  void push(u64 func, u64 returnAddr) {
+    if (frames.size() < kMaxDepth) frames.push_back({func, returnAddr});
+    else untracked++;
+  }
+
+  // RET to 'target': unwinds to the innermost frame returning there
+  // (frames above it were left without a RET) and returns how many frames
+  // went. 0: the RET matches no frame, so it is a jump. Untracked calls
+  // (past kMaxDepth) have no return address; while there are any, each
+  // RET returns from one of them.
+  std::size_t pop(u64 target) {
+    if (untracked) {
+      untracked--;
+      return 1;
+    }
+    for (std::size_t i = frames.size(); i-- > 1;) {
+      if (frames[i].returnAddr == target) {
+        const std::size_t n = frames.size() - i;
+        frames.resize(i);
+        return n;
+      }
+    }
+    return 0;
+  }
+
+  // After code moved (optimize): 'map' gives each old address its new one.
+  void relocate(const std::function<u64(u64)>& map) {
+    for (auto& f : frames) {
+      f.func = map(f.func);
+      f.returnAddr = map(f.returnAddr);
+    }
+  }
+
+  // Calls in progress, not counting the root frame.
+  i64 depth() const { return (i64)(frames.size() - 1 + untracked); }
+
+  const std::vector<Frame>& get() const { return frames; }
+  u64 untrackedCalls() const { return untracked; }
+  // For checkpoints: 'f' starts with the root frame.
+  void assign(std::vector<Frame> f, u64 untrackedCalls) {
+    if (f.empty()) f.push_back(Frame{0, ~0ull});
+    frames = std::move(f);
+    untracked = untrackedCalls;
+  }
+
+private:
+  std::vector<Frame> frames;
+  u64 untracked = 0; // calls past kMaxDepth, see pop()
+};
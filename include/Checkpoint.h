@@ -0,0 +1,71 @@
+#pragma once
+#include "CPU.h"
+#include "Flags.h"
+#include "Memory.h"
+#include "Types.h"
+#include "Vector.h"
+#include <array>
+#include <string>
+#include <vector>
+
+// Machine state on disk, for 'checkpoint' and 'resume'.
+//
+// File format (version 3, integers little-endian):
+//
+//   "ARMCKPT\0", u32 version, u32 0
+//   u64 memory words, u64 page words, u64 hart count, u64 selected hart
+//   str title                                  (str = u64 length + bytes)
+//   per hart:  32 x u64 X, 32 x 2 x u64 V, u64 PC, u8 NZCV, u64 instret,
+//              timer interrupt state: u64 at, period, interval, vector, ELR,
+//              u8 saved NZCV, u8 in handler, u64 taken
+//              shadow call stack: u64 frame count, per frame u64 function,
+//              u64 return address; u64 untracked calls
+//   u64 breakpoint count, per breakpoint: u64 addr, u64 ignore, u64 hits, str condition
+//   per non-zero page: u64 page index, its words as u32; then u64 ~0
+//   u64 checksum of everything before it
+//
+// Files of any other version are rejected. Only pages that hold a
+// non-zero word are stored. A file is written to a temporary name next to
+// it, synced and renamed over the old one, so a crash leaves either the
+// old or the new checkpoint.
+class Checkpoint {
+public:
+  static constexpr u32 kVersion = 3;
+  static constexpr std::size_t kPageWords = 1024; // 4 KB
+
+  struct Hart {
+    std::array<u64, 32> x{};
+    std::array<Vec128, 32> v{};
+    u64 pc = 0;
+    Flags flags;
+    CallStack calls;
+    u64 instret = 0;
+    Interrupts irq;
+  };
+  struct Break {
+    u64 addr = 0;
+    std::string cond;
+    u64 ignore = 0;
+    u64 hits = 0;
+  };
+
+  std::vector<Hart> harts;
+  u64 curHart = 0;
+  std::string title;
+  std::vector<Break> breakpoints;
+
+  static Hart capture(const CPU& cpu);
+  // Registers, PC, flags, call stack, instret and interrupt state; hooks
+  // are left alone.
+  static void apply(const Hart& h, CPU& cpu);
+
+  struct SaveResult {
+    u64 bytes = 0;
+    u64 pages = 0; // non-zero pages written
+  };
+  SaveResult save(const std::string& path, const Memory& mem) const;
+
+  // Verifies the whole file (magic, version, checksum) before touching
+  // 'mem', then resizes it and fills it from the file.
+  static Checkpoint load(const std::string& path, Memory& mem);
+};
@@ -0,0 +1,52 @@
+#pragma once
+#include "Memory.h"
+#include "Types.h"
+#include <algorithm>
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// Instruction and branch coverage: one byte per memory word, OR-ed into by
+// the interpreter (one byte store per instruction while attached).
+// Maps combine with merge(), so runs, harts and separate processes (via
+// save/load files) add up to one picture.
+class Coverage {
+public:
+  enum : u8 {
+    kExec = 1,        // the word was executed
+    kTaken = 2,       // CBZ/CBNZ/B.cond: branched
+    kFallthrough = 4, // CBZ/CBNZ/B.cond: went on to pc+4
+  };
+
+  explicit Coverage(std::size_t nWords = 0): bits(nWords, 0) {}
+
+  void resize(std::size_t nWords) { bits.resize(nWords, 0); }
+  void reset() { std::fill(bits.begin(), bits.end(), 0); }
+  std::size_t sizeWords() const { return bits.size(); }
+  u8 at(std::size_t i) const { return i < bits.size() ? bits[i] : 0; }
+
+  // Interpreter hooks ('pc' was already bounds-checked by the fetch).
+  void exec(u64 pc) { bits[pc >> 2] |= kExec; }
+  void branch(u64 pc, bool taken) { bits[pc >> 2] |= taken ? kTaken : kFallthrough; }
+
+  void merge(const Coverage& other);
+  // After code moved (optimize): each covered word's flags go to
+  // newAddr(old byte address); ~0 drops them (removed instructions).
+  void relocate(const std::function<u64(u64)>& newAddr);
+
+  // Text format: "0x<word address in bytes> <flags>" per covered word.
+  void save(std::ostream& out) const;
+  // OR a saved file into this map (grows it if needed).
+  void mergeFile(std::istream& in);
+
+  // Annotated listing of the words in [0, endWord) that are executed or
+  // pass 'isCode': executed marks, disassembly, branch directions and a
+  // summary. 'where' may add a source location.
+  void report(std::ostream& out, const Memory& mem, std::size_t endWord,
+              const std::function<bool(u64)>& isCode,
+              const std::function<std::string(u64)>& where) const;
+
+private:
+  std::vector<u8> bits;
+};
@@ -0,0 +1,78 @@
+#pragma once
+#include "Types.h"
+#include <array>
+#include <functional>
+#include <mutex>
+#include <string>
+
+class CPU;
+
+// A memory-mapped device: one 4 KB page of guest address space beyond the
+// end of RAM (Memory::mapDevice). Word loads and stores to the page reach
+// the device through the slow path of Memory::loadWord/storeWord, so RAM
+// accesses never look at devices. The accessing hart comes along (nullptr
+// for accesses from outside guest code, such as the C API). Only 32-bit word accesses (LDUR, STUR,
+// LDURSW) are supported; other sizes, vector and atomic accesses and
+// instruction fetches fault as out of range.
+class Device {
+public:
+  virtual ~Device() = default;
+  virtual const char* name() const = 0;
+  // 'offset' is the byte offset of the word in the page.
+  virtual u32 read(CPU* hart, u64 offset) = 0;
+  virtual void write(CPU* hart, u64 offset, u32 value) = 0;
+  // One line of state for the 'devices' command.
+  virtual std::string status() const = 0;
+};
+
+// Console UART, transmit only.
+//
+//   +0x0 DATA    write: queue the low byte for output; read: 0
+//   +0x4 STATUS  read: bit 0 TX ready (always 1), bits 15..8 bytes in the TX FIFO
+//
+// The TX FIFO goes to the sink when it is full, after a newline and on
+// flush(), which the runner calls together with the host output flush.
+// Several harts may write; bytes are serialized.
+class Uart : public Device {
+public:
+  static constexpr std::size_t kFifoBytes = 64;
+  using Sink = std::function<void(const char* data, std::size_t n)>;
+
+  explicit Uart(Sink sink);
+  const char* name() const override { return "uart"; }
+  u32 read(CPU* hart, u64 offset) override;
+  void write(CPU* hart, u64 offset, u32 value) override;
+  std::string status() const override;
+  void flush();
+
+private:
+  Sink sink;
+  mutable std::mutex lock;
+  std::array<char, kFifoBytes> fifo{};
+  std::size_t fill = 0;
+  u64 sent = 0; // bytes handed to the sink
+  void drain(); // with 'lock' held
+};
+
+// Timer and cycle counter. Every register acts on the accessing hart, so
+// each hart has its own timer; see Interrupts in CPU.h for how the
+// interrupt is taken and ERET for the return.
+//
+//   +0x00 CYCLES_LO  read: instructions the hart retired before this load, low 32 bits
+//   +0x04 CYCLES_HI  read: the high 32 bits (read HI, LO, HI again if it changed)
+//   +0x08 CTRL       bit 0 enable, bit 1 periodic; a write arms or stops the timer
+//   +0x0C INTERVAL   instructions until the interrupt, counting the CTRL write (min 1)
+//   +0x10 VECTOR     handler byte address
+//   +0x14 COUNT      read: interrupts taken by the hart
+//
+// From the REPL (M[#]=#) the registers are the selected hart's.
+class Timer : public Device {
+public:
+  const char* name() const override { return "timer"; }
+  u32 read(CPU* hart, u64 offset) override;
+  void write(CPU* hart, u64 offset, u32 value) override;
+  std::string status() const override { return "per-hart registers"; }
+
+private:
+  static CPU& accessing(CPU* hart);
+};
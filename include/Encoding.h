@@ -1,4 +1,5 @@
 #pragma once
+#include "Flags.h"
 #include "Types.h"
 
 // The course sheet gives bitfield layouts for R/I/D/B/CB formats.
@@ -21,7 +22,9 @@ inline u32 set(u32 w, int hi, int lo, u32 v) {
 inline i64 sext(u32 x, int bits) {
   const u32 m = 1u << (bits - 1);
   u32 y = x & mask(bits);
-  return (y ^ m) - m;
+  // Subtract in 32 bits, then reinterpret as signed before widening so
+  // negative offsets don't come out as large positive numbers.
+  return static_cast<i64>(static_cast<std::int32_t>((y ^ m) - m));
 }
 
 // ===== Base sheet opcodes (from CS251 summary) =====
@@ -36,16 +39,40 @@ constexpr u32 OP_B   = 0b000101;
 constexpr u32 OP_ADD = 0b10001011000;
 constexpr u32 OP_SUB = 0b11001011000;
 
+// Flag-setting variants (LEGv8 ADDS/SUBS): opcode[31:21]
+constexpr u32 OP_ADDS = 0b10101011000;
+constexpr u32 OP_SUBS = 0b11101011000;
+
 // I-format: opcode[31:22] = 0b1001000100 (ADDI)
 // I-format: opcode[31:22] = 0b1101000100 (SUBI)
 constexpr u32 OP_ADDI = 0b1001000100;
 constexpr u32 OP_SUBI = 0b1101000100;
 
+// Flag-setting variants (LEGv8 ADDIS/SUBIS): opcode[31:22]
+constexpr u32 OP_ADDIS = 0b1011000100;
+constexpr u32 OP_SUBIS = 0b1111000100;
+
 // D-format: opcode[31:21] = 0b11111000010 (LDUR)
 // D-format: opcode[31:21] = 0b11111000000 (STUR)
 constexpr u32 OP_LDUR = 0b11111000010;
 constexpr u32 OP_STUR = 0b11111000000;
 
+// Byte-addressed loads/stores, D-format like LDUR/STUR (which move a
+// 32-bit word here). B/H/SW use the LEGv8 opcodes; LDURB/LDURH zero-extend,
+// LDURSW sign-extends a word. LDURD/STURD move 64 bits (custom opcodes).
+constexpr u32 OP_LDURB  = 0b00111000010;
+constexpr u32 OP_STURB  = 0b00111000000;
+constexpr u32 OP_LDURH  = 0b01111000010;
+constexpr u32 OP_STURH  = 0b01111000000;
+constexpr u32 OP_LDURSW = 0b10111000100;
+constexpr u32 OP_LDURD  = 0b11111000110; // custom
+constexpr u32 OP_STURD  = 0b11111000100; // custom
+
+inline bool isSizedLoad(u32 op11) {
+  return op11 == OP_LDURB || op11 == OP_LDURH || op11 == OP_LDURSW || op11 == OP_LDURD;
+}
+inline bool isSizedStore(u32 op11) { return op11 == OP_STURB || op11 == OP_STURH || op11 == OP_STURD; }
+
 // CB-format: opcode[31:24] = 0b10110100 (CBZ)
 // CB-format: opcode[31:24] = 0b10110101 (CBNZ)
 constexpr u32 OP_CBZ  = 0b10110100;
@@ -54,11 +81,11 @@ constexpr u32 OP_CBNZ = 0b10110101;
 // ===== Custom extensions =====
 //
 // We reserve opcode[31:24] in the 0b1011011x range that doesn't collide
-// with CBZ/CBNZ. Then encode a 4-bit condition in [23:20] and an imm19
-// in [23:5] (like CB). For B.cond we use:
+// with CBZ/CBNZ. Like AArch64 B.cond, imm19 lives in [23:5] and the 4-bit
+// condition (Cond, see Flags.h) in [3:0]; bit 4 is zero.
 constexpr u32 OP_BCOND = 0b10110110; // custom
 
-enum class Cond : u8 { EQ=0, NE=1, LT=2, GE=3 };
+using ::Cond;
 
 // For CMP, EOR, LSL, LSR, MUL, RET we use a custom "X-format":
 // opcode[31:21] = 0b10101010101 (not used in sheet), remaining fields
@@ -74,6 +101,30 @@ enum class XFunct : u8 {
   LSR = 5,
   MUL = 6,
   RET = 7, // RET uses Rn as target register; other fields ignored
+
+  // Multi-hart synchronisation. Memory operand is the 32-bit word at [Xn];
+  // both are single host atomic operations.
+  CAS    = 8,  // CAS Xs, Xt, [Xn]:   old=M[Xn]; if old==Xs then M[Xn]=Xt; Xs=old  (Rm=Xs, Rd=Xt)
+  LDADD  = 9,  // LDADD Xs, Xt, [Xn]: old=M[Xn]; M[Xn]=old+Xs; Xt=old           (Rm=Xs, Rd=Xt)
+  HARTID = 10, // HARTID Xd: Xd = index of the executing hart
+
+  HCALL  = 11, // HCALL #svc: host service svc (0..31, in the Rm field); see HostCalls.h
+  ERET   = 12, // ERET: return from the timer interrupt handler (see Devices.h); no operands
+};
+
+// Vector extension, "V-format": opcode[31:21] = 0b10101010100 (next to
+// OP_XEXT). Fields like R-format: Vm/Xm[20:16], funct[15:10], Vn/Xn[9:5],
+// Vd/Xd[4:0]. funct[5] set = 2 x 64-bit lanes, clear = 4 x 32; funct[4:0]
+// is the VFunct.
+constexpr u32 OP_VEXT = 0b10101010100;
+constexpr u32 VLANES64 = 0x20;
+
+enum class VFunct : u8 {
+  ADD = 0, SUB = 1, MUL = 2, AND = 3, ORR = 4, EOR = 5, // Vd = Vn op Vm, lane-wise
+  LDR  = 6, // VLDR Vt, [Xn]{, #16}: 16 bytes at Xn (4-byte aligned); Rm=1 adds 16 to Xn afterwards
+  STR  = 7, // VSTR Vt, [Xn]{, #16}
+  UMOV = 8, // UMOV Xd, Vn.S[i] / Vn.D[i]: zero-extended lane i (i in Rm)
+  DUP  = 9, // DUP Vd.4S, Xn / Vd.2D, Xn: Xn (low 32 bits for 4S) into every lane
 };
 
 // BL uses B-format opcode[31:26] = 0b100101 (real ARM64 BL, but not in sheet)
@@ -0,0 +1,93 @@
+#pragma once
+#include "Types.h"
+
+// NZCV condition flags, as in AArch64.
+struct Flags {
+  bool N = false; // negative
+  bool Z = false; // zero
+  bool C = false; // carry (unsigned no-borrow for subtraction)
+  bool V = false; // signed overflow
+};
+
+// Condition codes used by B.cond (AArch64 numbering).
+enum class Cond : u8 {
+  EQ = 0, NE = 1, CS = 2, CC = 3, MI = 4, PL = 5, VS = 6, VC = 7,
+  HI = 8, LS = 9, GE = 10, LT = 11, GT = 12, LE = 13, AL = 14, NV = 15,
+};
+
+// Evaluate a condition against materialized flags.
+inline bool condHolds(u32 cond, const Flags& f) {
+  switch ((Cond)(cond & 0xF)) {
+    case Cond::EQ: return f.Z;
+    case Cond::NE: return !f.Z;
+    case Cond::CS: return f.C;
+    case Cond::CC: return !f.C;
+    case Cond::MI: return f.N;
+    case Cond::PL: return !f.N;
+    case Cond::VS: return f.V;
+    case Cond::VC: return !f.V;
+    case Cond::HI: return f.C && !f.Z;
+    case Cond::LS: return !f.C || f.Z;
+    case Cond::GE: return f.N == f.V;
+    case Cond::LT: return f.N != f.V;
+    case Cond::GT: return !f.Z && f.N == f.V;
+    case Cond::LE: return f.Z || f.N != f.V;
+    default:       return true; // AL, NV
+  }
+}
+
+// Flag-setting instructions don't compute NZCV. They record the operands
+// and the operation, and flags are derived only when something reads them
+// (a B.cond, the state view, a checkpoint). A CMP whose result is never
+// branched on therefore costs two register moves.
+struct LazyFlags {
+  enum class Op : u8 { None, Add, Sub };
+
+  Op op = Op::None; // None: flags are held explicitly in 'value'
+  u64 a = 0, b = 0; // operands of the last flag-setting op
+  Flags value{};
+
+  void setAdd(u64 x, u64 y) { op = Op::Add; a = x; b = y; }
+  void setSub(u64 x, u64 y) { op = Op::Sub; a = x; b = y; }
+  void set(const Flags& f) { op = Op::None; value = f; }
+
+  Flags get() const {
+    if (op == Op::None) return value;
+    Flags f;
+    if (op == Op::Add) {
+      const u64 r = a + b;
+      f.N = (i64)r < 0;
+      f.Z = r == 0;
+      f.C = r < a;
+      f.V = ((~(a ^ b) & (a ^ r)) >> 63) != 0;
+    } else {
+      const u64 r = a - b;
+      f.N = (i64)r < 0;
+      f.Z = r == 0;
+      f.C = a >= b;
+      f.V = (((a ^ b) & (a ^ r)) >> 63) != 0;
+    }
+    return f;
+  }
+
+  // Evaluate a B.cond condition. After a compare (the common case) every
+  // condition is a single integer comparison of the recorded operands.
+  bool cond(u32 c) const {
+    if (op == Op::Sub) {
+      switch ((Cond)(c & 0xF)) {
+        case Cond::EQ: return a == b;
+        case Cond::NE: return a != b;
+        case Cond::CS: return a >= b;
+        case Cond::CC: return a < b;
+        case Cond::HI: return a > b;
+        case Cond::LS: return a <= b;
+        case Cond::GE: return (i64)a >= (i64)b;
+        case Cond::LT: return (i64)a < (i64)b;
+        case Cond::GT: return (i64)a > (i64)b;
+        case Cond::LE: return (i64)a <= (i64)b;
+        default: break;
+      }
+    }
+    return condHolds(c, get());
+  }
+};
@@ -0,0 +1,26 @@
+#pragma once
+#include "Breakpoints.h"
+#include "CPU.h"
+#include "Memory.h"
+#include <cstddef>
+#include <vector>
+
+// Runs several CPUs ("harts") against one shared Memory. Guests tell harts
+// apart with HARTID and synchronise with CAS/LDADD.
+class Harts {
+public:
+  // Every hart on its own host thread until it HALTs or has executed
+  // maxStepsPerHart instructions. Breakpoints are not checked. If a hart
+  // faults, the others still run to completion and the first fault is
+  // rethrown afterwards.
+  static std::vector<StopReason> runParallel(std::vector<CPU>& cpus, Memory& mem, u64 maxStepsPerHart);
+
+  // Deterministic interleaving on the calling thread: each live hart runs up
+  // to 'quantum' instructions in index order, round after round. All harts
+  // stop as soon as one reaches a breakpoint; its index is stored in
+  // stoppedHart. The same inputs always produce the same interleaving.
+  static std::vector<StopReason> runRoundRobin(std::vector<CPU>& cpus, Memory& mem, u64 quantum,
+                                               u64 maxStepsPerHart,
+                                               Breakpoints* breakpoints,
+                                               std::size_t& stoppedHart);
+};
@@ -0,0 +1,59 @@
+#pragma once
+#include "Types.h"
+#include <functional>
+#include <mutex>
+#include <vector>
+
+class CPU;
+class Memory;
+
+// Semihosting: 'HCALL #service' asks the host for a service. Arguments are
+// in X0..X2 and the result goes to X0. Buffers are byte addresses in guest
+// memory; bytes are little-endian within each word.
+//
+//   0 WRITE     X0=fd (1 stdout, 2 stderr), X1=buf, X2=len -> X0=len
+//   1 READ      X0=fd (0 stdin), X1=buf, X2=len  -> X0=bytes read (0 at end)
+//   2 EXIT      X0=exit code; stops the hart like HALT
+//   3 INSTRET   X0=instructions retired by this hart so far
+//   4 TIME      X0=host monotonic time in nanoseconds
+//
+// Output to stdout collects in one large buffer. It is handed to the sink
+// when the buffer is full or on flush(), which the runner calls at HALT
+// and after each run. Writes to stderr flush stdout and then go straight
+// through. Several harts may call in; the services are serialized.
+class HostCalls {
+public:
+  enum Service : u32 { Write = 0, Read = 1, Exit = 2, InstrCount = 3, Time = 4 };
+  static constexpr std::size_t kBufferBytes = 1 << 20;
+
+  using Sink = std::function<void(int fd, const char* data, std::size_t n)>;
+  // Fills up to n bytes; returns the count, 0 at end of input.
+  using Source = std::function<std::size_t(char* data, std::size_t n)>;
+
+  HostCalls(Sink sink, Source source);
+  // Replaces the TIME source (host steady clock), e.g. to make runs repeatable.
+  void setClock(std::function<u64()> c) { clock = std::move(c); }
+
+  // Runs 'service' for 'cpu'. Returns false when the guest exits.
+  bool call(u32 service, CPU& cpu, Memory& mem);
+  // Appends to the stdout stream like HCALL WRITE (used by the UART).
+  void output(const char* data, std::size_t n);
+  void flush();
+
+  bool exited() const { return hasExited; }
+  i64 exitCode() const { return code; }
+  // Forget an earlier EXIT (a new run starts).
+  void clearExit() { hasExited = false; code = 0; }
+
+private:
+  Sink sink;
+  Source source;
+  std::function<u64()> clock; // empty = steady clock
+  std::mutex lock;
+  std::vector<char> out; // pending stdout bytes, capacity kBufferBytes
+  std::vector<char> scratch;
+  bool hasExited = false;
+  i64 code = 0;
+
+  void write(int fd, const char* data, std::size_t n);
+};
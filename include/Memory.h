@@ -1,19 +1,77 @@
 #pragma once
 #include "Types.h"
+#include <iosfwd>
+#include <memory>
 #include <stdexcept>
 #include <string>
+#include <utility>
 #include <vector>
 
+class CPU;
+class Device;
+
+// Guest memory. The words live in one zero-initialised, page-aligned
+// mapping; mappings of 2 MB and more are 2 MB aligned and ask the host for
+// transparent huge pages, so large working sets need few TLB entries.
+// Memory is byte-addressed and little-endian: the byte at address a is
+// bits 8*(a%4).. of the word at a & ~3, and a doubleword is the word at a
+// followed by the word at a+4 (high half).
 class Memory {
-  std::vector<u32> words; // 4-byte words
+  u32* words = nullptr;         // 4-byte words
+  std::size_t nWords = 0;
+  std::size_t mappedBytes = 0;  // size of the mapping behind 'words'
+  // Device pages by base address; few, so a linear search on the slow path.
+  std::vector<std::pair<u64, std::shared_ptr<Device>>> devices;
+  Device* deviceAt(u64 byteAddr) const;
 public:
   explicit Memory(std::size_t nWords = 256/4); // default 256 bytes
+  ~Memory();
+  Memory(const Memory&) = delete;
+  Memory& operator=(const Memory&) = delete;
+
+  // Zeroes memory. Large memories hand their pages back to the host, which
+  // supplies zero pages again on first touch.
   void clear();
-  std::size_t sizeWords() const { return words.size(); }
+  // Changes the size; the words that fit in the new size are kept. RAM
+  // may not grow over a device page.
+  void resize(std::size_t newWords);
+  std::size_t sizeWords() const { return nWords; }
 
   // Byte address must be multiple of 4 for word access.
-  u32  loadWord(u64 byteAddr) const;
-  void storeWord(u64 byteAddr, u32 value);
+  // Accesses are relaxed atomics so harts on different host threads can
+  // share one Memory; on common hosts they compile to plain loads/stores.
+  // 'hart' is the accessing CPU, passed on to a device (see mapDevice).
+  u32  loadWord(u64 byteAddr, CPU* hart = nullptr) const;
+  void storeWord(u64 byteAddr, u32 value, CPU* hart = nullptr);
+  // Bytes, halfwords and doublewords at any byte address. Naturally aligned
+  // accesses are single relaxed atomics like the word accesses; unaligned
+  // halfwords and doublewords go byte by byte.
+  u8   loadByte(u64 byteAddr) const;
+  u16  loadHalf(u64 byteAddr) const;
+  u64  loadDouble(u64 byteAddr) const;
+  void storeByte(u64 byteAddr, u8 value);
+  void storeHalf(u64 byteAddr, u16 value);
+  void storeDouble(u64 byteAddr, u64 value);
+  // n consecutive words from byteAddr, with one range check (vector load/store).
+  void loadWords(u64 byteAddr, u32* out, std::size_t n) const;
+  void storeWords(u64 byteAddr, const u32* in, std::size_t n);
+
+  // Sequentially consistent read-modify-write operations used by the guest
+  // CAS/LDADD instructions. Both return the previous word.
+  u32 compareExchangeWord(u64 byteAddr, u32 expected, u32 desired);
+  u32 fetchAddWord(u64 byteAddr, u32 delta);
+
+  // Instruction fetch: like loadWord, but device pages are not executable.
+  u32  fetchWord(u64 byteAddr) const;
+
+  // Device pages (Devices.h): kDevicePageBytes pages above the end of RAM.
+  // Word loads and stores there go to the device; only the out-of-range
+  // path of loadWord/storeWord looks for them, so RAM accesses cost nothing.
+  static constexpr u64 kDevicePageBytes = 4096;
+  void mapDevice(u64 byteAddr, std::shared_ptr<Device> device);
+  void unmapDevice(const Device& device);
+  // Base address of the page 'device' is mapped at, if it is.
+  bool deviceBase(const Device& device, u64& byteAddr) const;
 
   // For printing, get raw word at word index.
   u32 getWordIndex(std::size_t i) const;
@@ -22,6 +80,15 @@ public:
   static void requireAligned4(u64 byteAddr);
   static std::size_t addrToIndex(u64 byteAddr);
 
-  void loadProgramHexLines(const std::vector<std::string>& lines);
-  std::vector<std::string> dumpProgramHexLines(std::size_t maxWords = 0) const;
+  // Hex image files (.arm): one word per line ("0x8B010000"), placed at
+  // consecutive addresses from 0 or from the last "@0x00001000" marker
+  // (a byte address). ';' and '#' start comments. Loading clears memory.
+  void loadHex(std::istream& in);
+  // Streams words [firstWord, endWord) through a fixed-size buffer.
+  // Returns the number of words written.
+  std::size_t saveHex(std::ostream& out, std::size_t firstWord, std::size_t endWord, bool sparse) const;
+  // Writes n words that live at baseAddr. With 'sparse', runs of zero words
+  // are left out and the next word gets an address marker instead.
+  // Returns the number of words written.
+  static std::size_t writeHexWords(std::ostream& out, const u32* w, std::size_t n, u64 baseAddr, bool sparse);
 };
@@ -0,0 +1,59 @@
+#pragma once
+#include "Memory.h"
+#include "Types.h"
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Peephole optimizer for the program image in memory.
+//
+// Code is whatever control flow reaches from the entry addresses (B, BL,
+// CBZ/CBNZ, B.cond targets and fall-throughs). Each maximal run of
+// consecutive code words is optimized on its own, and the rewrites repeat
+// until nothing changes:
+//
+//   - NOP, ADDI/SUBI Xd, Xd, #0 and branches to the next instruction are removed
+//   - a branch to an unconditional B goes straight to the final target
+//   - B.cond/CBZ/CBNZ over a B: the condition is inverted and the B removed
+//   - CMP Xn, Xm + B.EQ/B.NE with one operand known to be zero and the
+//     flags dead afterwards: CBZ/CBNZ
+//   - code no longer reached after the rewrites is removed
+//
+// Removing words compacts the run and relocates every branch. The freed
+// words at the end of the run are filled with HALT and are never reached,
+// so data and code outside the runs keep their addresses. Code is only
+// moved if every return address comes from BL. That means no RET Xn with
+// n != 30, no other write to X30 and no ERET (the timer VECTOR is not
+// relocated). Otherwise only the retargeting runs.
+// A program that reads or writes its own code is not supported.
+class Optimizer {
+public:
+  struct Change {
+    u64 addr = 0;       // byte address before optimization
+    std::string before; // disassembly
+    std::string after;  // disassembly, "" when removed
+    std::string rule;
+  };
+
+  struct Result {
+    std::vector<Change> changes;
+    std::size_t codeWords = 0;  // reachable instructions before
+    std::size_t removed = 0;
+    std::size_t retargeted = 0; // branches given a new target
+    std::string notMoved;       // why code was left in place, "" if it could move
+    std::unordered_map<u64, u64> relocation; // old -> new address of each code word
+    std::unordered_set<u64> removedAddrs;
+
+    // New address of a code word or label (a removed word maps to the
+    // instruction that followed it); other addresses do not move.
+    u64 map(u64 addr) const {
+      auto it = relocation.find(addr);
+      return it == relocation.end() ? addr : it->second;
+    }
+    bool wasRemoved(u64 addr) const { return removedAddrs.count(addr) != 0; }
+  };
+
+  // 'entries' are byte addresses where execution may start.
+  static Result optimize(Memory& mem, const std::vector<u64>& entries);
+};
@@ -0,0 +1,54 @@
+#pragma once
+#include "UI.h"
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Moves state rendering off the execution thread.
+//
+// The simulator (single producer) pushes StateRecords into a lock-free ring;
+// a writer thread (single consumer) formats them with UI::render and writes
+// the text to stdout in large batches. When the ring is full the producer
+// either waits for the writer (Block) or drops the frame and counts it (Drop).
+class OutputPipeline {
+public:
+  enum class Policy { Block, Drop };
+
+  explicit OutputPipeline(const UI& ui, std::size_t capacity = 1024);
+  ~OutputPipeline();
+
+  OutputPipeline(const OutputPipeline&) = delete;
+  OutputPipeline& operator=(const OutputPipeline&) = delete;
+
+  void setPolicy(Policy p) { policy = p; }
+  Policy getPolicy() const { return policy; }
+
+  // Producer side. Returns false if the record was dropped.
+  bool push(const StateRecord& rec);
+
+  // Blocks until every pushed record has been written and stdout flushed.
+  // Call before writing anything else to stdout so output stays ordered.
+  void flush();
+
+  u64 dropped() const { return droppedCount.load(std::memory_order_relaxed); }
+  u64 written() const { return writtenCount.load(std::memory_order_acquire); }
+
+private:
+  const UI& ui;
+  std::vector<StateRecord> ring;
+  std::size_t mask;
+  Policy policy = Policy::Block;
+
+  alignas(64) std::atomic<u64> head{0};         // next slot to read (consumer)
+  alignas(64) std::atomic<u64> tail{0};         // next slot to write (producer)
+  alignas(64) std::atomic<u64> writtenCount{0}; // records fully written out
+  std::atomic<u64> droppedCount{0};
+  std::atomic<bool> stopping{false};
+  std::atomic<u32> wake{0};                     // bumped on push/stop to wake the writer
+
+  std::thread writer;
+
+  void start();
+  void writerLoop();
+};
@@ -0,0 +1,56 @@
+#pragma once
+#include "CPU.h"
+#include "Types.h"
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+class Breakpoints;
+
+// Sampling profiler for long headless runs.
+//
+// Instead of counting every instruction, run() executes the hart in slices
+// of about 'period' instructions (jittered, so loops cannot alias with the
+// period) and records the PC and the hart's shadow call stack (CallStack.h)
+// between slices. The interpreter loop itself is unchanged: the cost is one
+// slice call per period.
+//
+// Samples go into a buffer allocated when sampling starts; once it is full
+// further samples are counted as dropped.
+class Sampler {
+public:
+  static constexpr u64 kDefaultPeriod = 10000;
+  static constexpr std::size_t kBufferWords = 4u << 20;  // u64s, 32 MB
+  static constexpr std::size_t kMaxSampleDepth = 64;    // innermost frames kept
+  using Namer = std::function<std::string(u64 addr)>;
+
+  // Discards old samples.
+  void start(u64 period);
+  bool started() const { return period != 0; }
+
+  // CPU::run (or runToDepth when 'depth' is set) with a sample every period.
+  StopReason run(CPU& cpu, Memory& mem, u64 maxSteps, Breakpoints* breakpoints, const i64* depth);
+
+  // After code moved (optimize): maps every recorded PC and function.
+  void relocate(const std::function<u64(u64)>& map);
+
+  u64 samples() const { return taken; }
+  u64 dropped() const { return lost; }
+  u64 samplePeriod() const { return period; }
+
+  // Top 'top' PCs (with disassembly and 'where' text) and functions
+  // (self = innermost frame, total = anywhere on the stack).
+  void report(std::ostream& out, const Memory& mem, std::size_t top, const Namer& name,
+              const std::function<std::string(u64)>& where) const;
+
+private:
+  u64 period = 0;
+  u64 rng = 0x9E3779B97F4A7C15ull; // xorshift state for the jitter
+  u64 taken = 0;
+  u64 lost = 0;
+  std::vector<u64> buffer; // per sample: pc, frame count, innermost..outer function addresses
+
+  u64 nextSlice();
+  void record(const CPU& cpu);
+};
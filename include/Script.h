@@ -0,0 +1,59 @@
+#pragma once
+#include "Types.h"
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Variables for command scripts and the prompt.
+//
+// Before a command runs, $NAME and ${NAME} are replaced by the variable's
+// value and $(EXPR) by the value of EXPR, in decimal; $$ is a '$'. EXPR is
+// 64-bit integer arithmetic on numbers (12, 0x1F, #12), variable names and
+// + - * / % << >> & ^ | ~ with C precedence and parentheses.
+class ScriptVars {
+public:
+  void set(const std::string& name, i64 value);
+  // False if 'name' is not set.
+  bool get(const std::string& name, i64& value) const;
+  // Throws on unknown variables and malformed expressions.
+  i64 eval(const std::string& expr) const;
+  std::string expand(const std::string& line) const;
+  // Letters, digits and '_', not starting with a digit.
+  static bool validName(const std::string& name);
+
+private:
+  std::unordered_map<std::string, i64> vars;
+};
+
+// A command script ('source fname', 'arm -s fname'): REPL commands, one per
+// line. Blank lines and lines starting with '#' are skipped.
+//
+//   for NAME FIRST LAST [STEP]   runs the lines up to the matching 'end'
+//   ...                          with NAME = FIRST, FIRST+STEP, ... while it
+//   end                          is <= LAST (>= LAST when STEP is negative)
+//
+// FIRST, LAST and STEP are expressions (see ScriptVars). Loops nest.
+class Script {
+public:
+  // Reads the file and matches every 'for' with its 'end'; nothing runs yet.
+  static Script load(const std::string& path);
+
+  // Gets each command line (trimmed, not yet expanded); returns false to stop.
+  using Exec = std::function<bool(const std::string& line)>;
+  // Runs the script. An exception from a line comes back as
+  // "path:line: message". Returns the commands run.
+  u64 run(ScriptVars& vars, const Exec& exec) const;
+
+private:
+  struct Line {
+    std::string text;
+    int number = 0;       // in the file, from 1
+    std::size_t end = 0;  // for a 'for': index of its 'end'
+  };
+  std::string path;
+  std::vector<Line> lines;
+
+  // Runs lines [first, last); false once exec asked to stop.
+  bool runRange(std::size_t first, std::size_t last, ScriptVars& vars, const Exec& exec, u64& count) const;
+};
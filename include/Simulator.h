@@ -1,35 +1,156 @@
 #pragma once
+#include "AsmSession.h"
+#include "Breakpoints.h"
 #include "CPU.h"
+#include "CallProfiler.h"
+#include "Coverage.h"
+#include "Devices.h"
+#include "Harts.h"
+#include "HostCalls.h"
 #include "Memory.h"
+#include "OutputPipeline.h"
+#include "Sampler.h"
+#include "Script.h"
 #include "UI.h"
+#include <memory>
 #include <string>
-#include <unordered_set>
+#include <vector>
 
 class Simulator {
-  CPU cpu;
+  // All harts share 'mem'. REPL commands and the state view act on the
+  // selected hart; single-hart commands (step/run/continue) only run it.
+  std::vector<CPU> harts;
+  std::size_t curHart = 0;
   Memory mem;
   UI ui;
+  AsmSession source; // assembly file behind the program, if loaded with 'asm'
+  OutputPipeline out{ui};
+  bool asyncOutput = true; // per-step frames go through the output pipeline
+  u64 droppedReported = 0;
+  // Semihosting for every hart: guest output is buffered and written out
+  // by syncOutput(); guest input comes from stdin.
+  HostCalls host;
+  int exitStatus = 0; // from the guest's HCALL EXIT, returned by repl()
+  // Memory-mapped devices, by default at kDeviceBase (UART) and the page
+  // after it (timer). The UART writes into the host's stdout buffer.
+  std::shared_ptr<Uart> uart;
+  std::shared_ptr<Timer> timer;
 
   // Debugger features
-  std::unordered_set<u64> breakpoints; // byte addresses (must be 4-byte aligned)
+  Breakpoints breakpoints; // byte addresses (must be 4-byte aligned), optionally conditional
+
+  // Call-graph profiler, fed by one hart between 'profile start' and 'profile stop'.
+  CallProfiler profiler;
+  std::size_t profiledHart = 0;
+  u64 profileEnd = 0; // hart's instret when profiling stopped
+
+  // Sampling profiler, attached to one hart; used by headless runs of it.
+  Sampler sampler;
+  std::size_t sampledHart = 0;
+  bool sampleOn = false; // between 'sample start' and 'sample stop'
+
+  // Coverage: one map per hart (no sharing between host threads) plus
+  // what was merged in from files or removed harts.
+  bool coverageOn = false;
+  std::vector<std::unique_ptr<Coverage>> hartCoverage;
+  Coverage mergedCoverage;
+
+  // Auto-checkpoint: headless runs of the selected hart save the machine
+  // to 'checkpointFile' whenever its instret reaches a multiple of this.
+  u64 checkpointEvery = 0;
+  std::string checkpointFile;
+
+  // Command scripts ('source', -s): variables for $ substitution and the
+  // nesting depth. While a script runs, redraws are deferred to its end or
+  // to an explicit 'show'.
+  ScriptVars vars;
+  int scriptDepth = 0;
+  bool redrawPending = false;
+  static constexpr int kMaxScriptDepth = 16;
 
   bool running = true;
+  // "HALT" (with the exit code after HCALL EXIT); ends the REPL.
+  void reportHalt();
 
   void cmdMemory(const std::string& arg);
   void cmdPC(const std::string& expr);
   void cmdSetMem(const std::string& expr);
   void cmdSetReg(const std::string& expr);
-  void cmdSave(const std::string& fname);
+  void cmdSave(const std::string& rest);
   void cmdLoad(const std::string& fname);
   void cmdTitle(const std::string& rest);
+  void cmdTranslate(const std::string& fname);
+  void cmdAsm(const std::string& rest);
+  void cmdReload();
+  void cmdOptimize(const std::string& rest);
+  void cmdCheckpoint(const std::string& rest);
+  void cmdResume(const std::string& rest);
+  void writeCheckpoint(const std::string& fname, bool quiet);
+  void cmdWhere(const std::string& rest);
+  // " (file:line)" for an address produced by the loaded source, else "".
+  std::string sourceLocation(u64 addr) const;
   void cmdClear(const std::string& what);
+  void cmdMemSize(const std::string& rest);
   void cmdRun(const std::string& rest);
   void cmdStep(const std::string& rest);
   void cmdContinue(const std::string& rest);
   void cmdBreak(const std::string& rest);
   void cmdAssembleToMemory(const std::string& line);
+  void cmdOutput(const std::string& rest);
+  void cmdStats(const std::string& rest);
+  void cmdVRegs();
+  void cmdDevices(const std::string& rest);
+  void cmdSet(const std::string& rest);
+  void cmdSource(const std::string& fname);
+  void cmdHarts(const std::string& rest);
+  void cmdHart(const std::string& rest);
+  // New harts start as copies of hart 0 with hooks and counters cleared.
+  void resizeHarts(std::size_t n);
+  void runAllHarts(bool parallel, u64 quantum, u64 maxStepsPerHart);
+  void cmdProfile(const std::string& rest);
+  void cmdCoverage(const std::string& rest);
+  void cmdSample(const std::string& rest);
+  bool sampling() const;
+  // (Re)attach one coverage map per hart, sized to memory; detach when off.
+  void attachCoverage();
+  Coverage totalCoverage() const;
+  bool profiling() const;
+  void stopProfile();
+  // Function name for an address: its label in the loaded source, else hex.
+  std::string symbolName(u64 addr) const;
+
+  CPU& cpu() { return harts[curHart]; }
+
+  // Upper bound for headless runs (run quiet / continue) without a step count.
+  static constexpr u64 kMaxQuietSteps = 1'000'000'000;
+  static constexpr u64 kDefaultQuantum = 1000; // run rr
+  static constexpr int kMaxHarts = 256;
+  static constexpr u64 kMaxMemBytes = 16ull << 30;
+  static constexpr u64 kDeviceBase = kMaxMemBytes; // above any memory size
+  // Headless run of the selected hart; with 'stopDepth', also stops once
+  // its shadow call depth is at or below *stopDepth (next/finish).
+  void runHeadless(u64 maxSteps, const i64* stopDepth = nullptr);
+  void cmdNext();
+  void cmdFinish();
+
+  // Expands $ variables, then dispatches.
+  void execLine(const std::string& line);
+  void dispatch(const std::string& line);
+  // Full-state redraw after a command (timed as render); deferred in scripts.
+  void showState();
+  void redraw();
+
+  // Per-step frame from run/step: queued to the writer thread when async.
+  void emitState();
+  // Wait for queued frames before writing anything else to stdout.
+  void syncOutput();
 
 public:
-  Simulator();
-  void repl();
+  explicit Simulator(std::size_t memWords = 256/4);
+  // "4096", "64K", "64M", "1G" -> bytes (a multiple of 4, at most kMaxMemBytes).
+  static u64 parseMemSize(const std::string& text);
+  // Runs 'scripts' first (as 'source'), then reads commands from stdin
+  // unless a script ended the session. Returns the guest's exit code (0
+  // unless it used HCALL EXIT).
+  int repl(const std::vector<std::string>& scripts = {});
 };
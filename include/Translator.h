@@ -0,0 +1,43 @@
+#pragma once
+#include "CPU.h"
+#include "Memory.h"
+#include <cstddef>
+#include <string>
+
+// Offline translation of a loaded program image into C++.
+//
+// translate() walks the code reachable from the entry PC, splits it into
+// basic blocks and emits one label per block with the guest registers held
+// in local variables. Control flow that can't be resolved statically (RET
+// to an address that isn't a block start, an unknown instruction, a store
+// into the translated code) spills the locals back into a CPU and continues
+// in the interpreter. Blocks run without per-instruction limit checks; when
+// fewer steps are left than a block holds, the interpreter finishes the run,
+// so it stops after exactly maxSteps. The generated file is compiled with
+// tools/xlat_main.cpp and the simulator objects (see 'make xlat'). Translated
+// programs have no devices (Devices.h), so they take no timer interrupts.
+class Translator {
+public:
+  // Returns the C++ source for the memory image and CPU state (registers,
+  // PC, flags) as they are now. 'label' is only used in the file comment.
+  static std::string translate(const CPU& cpu, const Memory& mem, const std::string& label);
+
+  // ----- runtime used by generated code -----
+
+  enum class Resume { Translated, Halt, StepLimit };
+
+  // Interpret until the PC reaches one of the sorted 'entries' (return
+  // Translated), HALT, or 'limit' total retired instructions. With
+  // untilHalt set the entries are ignored (used after self-modification).
+  static Resume interpret(CPU& cpu, Memory& mem, u64 limit,
+                          const u64* entries, std::size_t nEntries, bool untilHalt);
+};
+
+// Defined by the generated file.
+extern const u32 xlatImage[];
+extern const std::size_t xlatImageWords;
+extern const std::size_t xlatMemWords;
+extern const u64 xlatInitRegs[32];
+extern const u64 xlatInitPc;
+extern const Flags xlatInitFlags;
+StopReason xlatRun(CPU& cpu, Memory& mem, u64 maxSteps);
@@ -1,22 +1,42 @@
 #pragma once
 #include "CPU.h"
 #include "Memory.h"
+#include <array>
+#include <ostream>
 #include <string>
 
 enum class MemMode { HEX, DEC, CODE };
 
+// Compact snapshot of everything printState shows. Capturing this is cheap
+// (a few hundred bytes, no formatting), so the execution thread can hand it
+// off and let another thread do the slow text rendering.
+struct StateRecord {
+  static constexpr std::size_t kWindowWords = 64; // M[0..252]
+
+  u64 pc = 0;
+  u32 instr = 0;
+  Flags flags{};
+  std::array<u64, 32> X{};
+  std::array<u32, kWindowWords> window{};
+  std::size_t windowValid = 0; // words past this index are out of range
+};
+
 class UI {
   std::string title = "ARM Simulator";
   MemMode memMode = MemMode::DEC;
   u64 memCursor = 0; // byte addr, aligned to 8 for printing convenience
 public:
   void setTitle(const std::string& t) { title = t; }
+  const std::string& getTitle() const { return title; }
   void setMemMode(MemMode m) { memMode = m; }
   MemMode getMemMode() const { return memMode; }
 
   void setCursor(u64 byteAddr) { memCursor = byteAddr; }
   u64  getCursor() const { return memCursor; }
 
+  static StateRecord snapshot(const CPU& cpu, const Memory& mem);
+  void render(const StateRecord& rec, std::ostream& out) const;
+
   void printState(const CPU& cpu, const Memory& mem) const;
   void printHelp() const;
 };
@@ -0,0 +1,115 @@
+#pragma once
+#include "Types.h"
+#include <cstring>
+
+// 128-bit guest vector registers and their lane-wise operations, for the
+// V-format instructions (see Encoding.h). Lanes are 4 x 32 or 2 x 64 bits,
+// lane 0 in the low bits. The operations use SSE2 on x86-64 and NEON on
+// AArch64 hosts, and plain loops elsewhere. Define VECTOR_NO_SIMD to force
+// the loops.
+#if !defined(VECTOR_NO_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#define VECTOR_USE_SSE2 1
+#if defined(__SSE4_1__)
+#include <smmintrin.h>
+#endif
+#elif !defined(VECTOR_NO_SIMD) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define VECTOR_USE_NEON 1
+#endif
+
+struct alignas(16) Vec128 {
+  u64 d[2] = {0, 0};
+
+  u32 lane32(int i) const {
+    u32 v;
+    std::memcpy(&v, reinterpret_cast<const char*>(d) + 4 * i, 4);
+    return v;
+  }
+  void setLane32(int i, u32 v) { std::memcpy(reinterpret_cast<char*>(d) + 4 * i, &v, 4); }
+  bool isZero() const { return (d[0] | d[1]) == 0; }
+};
+
+namespace vec {
+
+// Operation ids match enc::VFunct ADD..EOR.
+enum Op : u32 { Add = 0, Sub = 1, Mul = 2, And = 3, Orr = 4, Eor = 5 };
+
+namespace detail {
+
+inline Vec128 scalar(u32 op, bool lanes64, const Vec128& a, const Vec128& b) {
+  Vec128 r;
+  if (lanes64) {
+    for (int i = 0; i < 2; i++) {
+      const u64 x = a.d[i], y = b.d[i];
+      r.d[i] = op == Add ? x + y : op == Sub ? x - y : op == Mul ? x * y
+             : op == And ? (x & y) : op == Orr ? (x | y) : (x ^ y);
+    }
+    return r;
+  }
+  for (int i = 0; i < 4; i++) {
+    const u32 x = a.lane32(i), y = b.lane32(i);
+    r.setLane32(i, op == Add ? x + y : op == Sub ? x - y : op == Mul ? x * y
+                 : op == And ? (x & y) : op == Orr ? (x | y) : (x ^ y));
+  }
+  return r;
+}
+
+#if defined(VECTOR_USE_SSE2)
+inline __m128i mul32(__m128i a, __m128i b) {
+#if defined(__SSE4_1__)
+  return _mm_mullo_epi32(a, b);
+#else
+  // Even and odd lanes as 32x32->64 products, then the low halves re-interleaved.
+  __m128i even = _mm_mul_epu32(a, b);
+  __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+  return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                            _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+#endif
+}
+#endif
+
+} // namespace detail
+
+// r = a <op> b, lane-wise. 'op' must be one of Op.
+inline Vec128 apply(u32 op, bool lanes64, const Vec128& a, const Vec128& b) {
+#if defined(VECTOR_USE_SSE2)
+  if (op == Mul && lanes64) return detail::scalar(op, lanes64, a, b); // no 64-bit lane multiply in SSE2
+  const __m128i x = _mm_load_si128(reinterpret_cast<const __m128i*>(a.d));
+  const __m128i y = _mm_load_si128(reinterpret_cast<const __m128i*>(b.d));
+  __m128i z;
+  switch (op) {
+    case Add: z = lanes64 ? _mm_add_epi64(x, y) : _mm_add_epi32(x, y); break;
+    case Sub: z = lanes64 ? _mm_sub_epi64(x, y) : _mm_sub_epi32(x, y); break;
+    case Mul: z = detail::mul32(x, y); break;
+    case And: z = _mm_and_si128(x, y); break;
+    case Orr: z = _mm_or_si128(x, y); break;
+    default:  z = _mm_xor_si128(x, y); break;
+  }
+  Vec128 r;
+  _mm_store_si128(reinterpret_cast<__m128i*>(r.d), z);
+  return r;
+#elif defined(VECTOR_USE_NEON)
+  if (op == Mul && lanes64) return detail::scalar(op, lanes64, a, b); // no 64-bit lane multiply in NEON
+  const uint32x4_t x = vld1q_u32(reinterpret_cast<const u32*>(a.d));
+  const uint32x4_t y = vld1q_u32(reinterpret_cast<const u32*>(b.d));
+  uint32x4_t z;
+  switch (op) {
+    case Add: z = lanes64 ? vreinterpretq_u32_u64(vaddq_u64(vreinterpretq_u64_u32(x), vreinterpretq_u64_u32(y)))
+                          : vaddq_u32(x, y); break;
+    case Sub: z = lanes64 ? vreinterpretq_u32_u64(vsubq_u64(vreinterpretq_u64_u32(x), vreinterpretq_u64_u32(y)))
+                          : vsubq_u32(x, y); break;
+    case Mul: z = vmulq_u32(x, y); break;
+    case And: z = vandq_u32(x, y); break;
+    case Orr: z = vorrq_u32(x, y); break;
+    default:  z = veorq_u32(x, y); break;
+  }
+  Vec128 r;
+  vst1q_u32(reinterpret_cast<u32*>(r.d), z);
+  return r;
+#else
+  return detail::scalar(op, lanes64, a, b);
+#endif
+}
+
+} // namespace vec
@@ -0,0 +1,93 @@
+#ifndef ARMSIM_H
+#define ARMSIM_H
+
+/* Embeddable simulator API (libarmsim).
+ *
+ * A machine is one hart with its own memory and breakpoints. Machines share
+ * nothing, so separate threads may each drive their own. Nothing here reads
+ * stdin or prints: failures return ARMSIM_ERROR (or ARMSIM_STOP_ERROR) and
+ * armsim_error() describes the last one.
+ *
+ * Typical use for many short runs: create once, then per run
+ * armsim_reset + armsim_clear_memory + armsim_load_* + armsim_run. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct armsim_machine armsim_machine;
+
+enum { ARMSIM_OK = 0, ARMSIM_ERROR = -1 };
+
+typedef enum {
+  ARMSIM_STOP_NONE = 0,   /* not run since create/reset */
+  ARMSIM_STOP_HALT,       /* executed HALT (PC stays on it) */
+  ARMSIM_STOP_BREAKPOINT, /* before an instruction at a breakpoint */
+  ARMSIM_STOP_STEP_LIMIT, /* max_steps instructions retired */
+  ARMSIM_STOP_ERROR,      /* guest fault, e.g. out-of-range access */
+  ARMSIM_STOP_EXIT        /* HCALL EXIT, see armsim_exit_code */
+} armsim_stop;
+
+/* NZCV bits returned by armsim_get_nzcv. */
+enum { ARMSIM_V = 1, ARMSIM_C = 2, ARMSIM_Z = 4, ARMSIM_N = 8 };
+
+/* mem_bytes: a multiple of 4; 0 selects the REPL's default of 256 bytes.
+ * Returns NULL if the size is invalid or cannot be allocated. */
+armsim_machine* armsim_create(size_t mem_bytes);
+void armsim_destroy(armsim_machine* m);
+
+/* Registers, PC, flags, call depth and counters to zero; drops guest
+ * output, input and exit code. Memory and breakpoints are kept. */
+void armsim_reset(armsim_machine* m);
+void armsim_clear_memory(armsim_machine* m);
+size_t armsim_memory_bytes(const armsim_machine* m);
+
+/* Copies n words to consecutive addresses from 'addr' (4-byte aligned). */
+int armsim_load_words(armsim_machine* m, uint64_t addr, const uint32_t* words, size_t n);
+/* Loads a hex image in the .arm format from a buffer; clears memory first. */
+int armsim_load_hex(armsim_machine* m, const char* text, size_t len);
+int armsim_read_word(const armsim_machine* m, uint64_t addr, uint32_t* out);
+int armsim_write_word(armsim_machine* m, uint64_t addr, uint32_t value);
+
+/* r in 0..31. */
+int armsim_get_x(const armsim_machine* m, int r, uint64_t* out);
+int armsim_set_x(armsim_machine* m, int r, uint64_t value);
+/* Vector register r (0..31) as 4 x 32-bit lanes, lane 0 first. */
+int armsim_get_v(const armsim_machine* m, int r, uint32_t lanes[4]);
+int armsim_set_v(armsim_machine* m, int r, const uint32_t lanes[4]);
+uint64_t armsim_get_pc(const armsim_machine* m);
+void armsim_set_pc(armsim_machine* m, uint64_t pc);
+unsigned armsim_get_nzcv(const armsim_machine* m);
+
+/* Stop conditions. 'cond' is NULL or a breakpoint condition in the syntax
+ * of the REPL's 'break #addr if ...' (e.g. "X0 == 3 && M[X1] != 0"). */
+int armsim_break(armsim_machine* m, uint64_t addr, const char* cond);
+int armsim_unbreak(armsim_machine* m, uint64_t addr);
+void armsim_clear_breaks(armsim_machine* m);
+
+/* Runs until HALT, a breakpoint (the instruction at the starting PC always
+ * executes) or max_steps instructions. */
+armsim_stop armsim_run(armsim_machine* m, uint64_t max_steps);
+armsim_stop armsim_stop_reason(const armsim_machine* m);
+/* Instructions retired since create/reset. */
+uint64_t armsim_instret(const armsim_machine* m);
+
+/* Semihosting (HCALL). Output the guest wrote to fd 1 or 2 since the last
+ * reset; the pointer is valid until the next run or reset. */
+const char* armsim_output(const armsim_machine* m, int fd, size_t* len);
+/* What HCALL READ returns (copied); after it the guest sees end of input. */
+void armsim_set_input(armsim_machine* m, const char* data, size_t len);
+int64_t armsim_exit_code(const armsim_machine* m);
+
+/* Message for the last failed call on this machine, "" if none. Valid
+ * until the next call on the machine. */
+const char* armsim_error(const armsim_machine* m);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,12 @@
+; Tight ALU loop: the common add/logic/shift/branch mix, no memory traffic.
+; @expect X0=0 X1=12582912 X2=0 X3=25165824 PC=28
+; @instret 20971522
+; @budget-ms 2000
+        ADDI X0, X0, #1
+        LSL  X0, X0, #22        ; 4194304 iterations
+loop:   ADDI X1, X1, #3
+        EOR  X2, X2, X1
+        LSL  X3, X1, #1
+        SUBI X0, X0, #1
+        CBNZ X0, loop
+        HALT
@@ -0,0 +1,14 @@
+; BL/RET heavy: a leaf call per iteration.
+; @expect X0=0 X1=4194304 X2=17592186044416 X3=6148923487330238464 X30=12 PC=20
+; @instret 29360130
+; @budget-ms 2000
+        ADDI X0, X0, #1
+        LSL  X0, X0, #22        ; 4194304 calls
+loop:   BL   leaf
+        SUBI X0, X0, #1
+        CBNZ X0, loop
+        HALT
+leaf:   ADDI X1, X1, #1
+        MUL  X2, X1, X1
+        ADD  X3, X3, X2         ; sum of squares
+        RET
@@ -0,0 +1,30 @@
+; Compare/B.cond heavy: Collatz step counts for n = 32768 down to 1.
+; X6 = total steps, X7 = longest chain, X8 = its start value.
+; @expect X0=0 X6=3156206 X7=307 X8=26623 PC=96
+; @instret 23434710
+; @budget-ms 2000
+        ADDI X20, X20, #1       ; constant 1
+        ADDI X21, X21, #3       ; constant 3
+        ADDI X0, X0, #1
+        LSL  X0, X0, #15
+outer:  ADDI X1, X0, #0
+        SUB  X2, X2, X2
+inner:  CMP  X1, X20
+        B.LS done               ; x <= 1
+        AND  X3, X1, X20
+        CBZ  X3, even
+        MUL  X1, X1, X21        ; x = 3x + 1
+        ADDI X1, X1, #1
+        ADDI X2, X2, #1
+        B    inner
+even:   LSR  X1, X1, #1         ; x = x / 2
+        ADDI X2, X2, #1
+        B    inner
+done:   ADD  X6, X6, X2
+        CMP  X2, X7
+        B.LE next
+        ADDI X7, X2, #0
+        ADDI X8, X0, #0
+next:   SUBIS X0, X0, #1
+        B.NE outer
+        HALT
@@ -0,0 +1,29 @@
+; LDUR/STUR streaming: fill a 1024-word array, then 4096 read-modify-write passes.
+; @mem 2048
+; @expect X1=8192 X2=0 X3=7168 X4=11257 X5=23605542912 X8=0 X9=4096 X10=1024 PC=92
+; @instret 29381639
+; @budget-ms 2000
+        ADDI X9, X9, #1
+        LSL  X9, X9, #12        ; array at byte 4096 (word 1024)
+        ADDI X10, X10, #1024    ; length in words
+        ADDI X1, X9, #0
+        ADDI X2, X10, #0
+fill:   STUR X3, [X1, #0]       ; a[i] = 7*i
+        ADDI X3, X3, #7
+        ADDI X1, X1, #4
+        SUBI X2, X2, #1
+        CBNZ X2, fill
+        ADDI X8, X8, #1
+        LSL  X8, X8, #12        ; 4096 passes
+pass:   ADDI X1, X9, #0
+        ADDI X2, X10, #0
+sum:    LDUR X4, [X1, #0]
+        ADD  X5, X5, X4
+        ADDI X4, X4, #1
+        STUR X4, [X1, #0]       ; a[i]++
+        ADDI X1, X1, #4
+        SUBI X2, X2, #1
+        CBNZ X2, sum
+        SUBI X8, X8, #1
+        CBNZ X8, pass
+        HALT
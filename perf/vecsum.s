@@ -0,0 +1,40 @@
+; Vector extension: the memsum workload (sum a[i], then a[i]++) over the same
+; 1024-word array, four lanes per instruction. The four 32-bit lane sums
+; wrap; X5 adds them up at the end. 16384 passes.
+; @mem 2048
+; @expect X1=8192 X2=0 X3=7168 X4=2174746624 X5=8522825728 X8=0 X9=4096 X10=1024 PC=128
+; @instret 25236497
+; @budget-ms 2000
+        ADDI X9, X9, #1
+        LSL  X9, X9, #12        ; array at byte 4096 (word 1024)
+        ADDI X10, X10, #1024    ; length in words
+        ADDI X1, X9, #0
+        ADDI X2, X10, #0
+fill:   STUR X3, [X1, #0]       ; a[i] = 7*i
+        ADDI X3, X3, #7
+        ADDI X1, X1, #4
+        SUBI X2, X2, #1
+        CBNZ X2, fill
+        ADDI X6, X6, #1
+        DUP  V2.4S, X6          ; 1 in every lane
+        ADDI X8, X8, #1
+        LSL  X8, X8, #14        ; 16384 passes
+pass:   ADDI X1, X9, #0
+        ADDI X2, X2, #256       ; 4 words per iteration
+vsum:   VLDR V0, [X1]
+        ADD  V1.4S, V1.4S, V0.4S
+        ADD  V0.4S, V0.4S, V2.4S
+        VSTR V0, [X1], #16      ; a[i..i+3]++, X1 += 16
+        SUBI X2, X2, #1
+        CBNZ X2, vsum
+        SUBI X8, X8, #1
+        CBNZ X8, pass
+        UMOV X4, V1.S[0]
+        ADD  X5, X5, X4
+        UMOV X4, V1.S[1]
+        ADD  X5, X5, X4
+        UMOV X4, V1.S[2]
+        ADD  X5, X5, X4
+        UMOV X4, V1.S[3]
+        ADD  X5, X5, X4
+        HALT
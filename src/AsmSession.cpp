@@ -0,0 +1,142 @@
+#include "AsmSession.h"
+#include <fstream>
+#include <stdexcept>
+
+static std::vector<std::string> readLines(const std::string& fname) {
+  std::ifstream in(fname);
+  if (!in) throw std::runtime_error("Cannot open file: " + fname);
+  std::vector<std::string> lines;
+  std::string line;
+  while (std::getline(in, line)) lines.push_back(line);
+  return lines;
+}
+
+AsmSession::Result AsmSession::load(const std::string& fname, u64 baseAddr, Memory& mem) {
+  auto newLines = readLines(fname);
+  // Start from scratch so every word is encoded and written.
+  AsmSession fresh;
+  fresh.path = fname;
+  fresh.base = baseAddr;
+  Result r = fresh.apply(std::move(newLines), mem, true);
+  *this = std::move(fresh);
+  return r;
+}
+
+AsmSession::Result AsmSession::reload(Memory& mem) {
+  if (!active()) throw std::runtime_error("No assembly source loaded (use asm fname).");
+  return apply(readLines(path), mem, false);
+}
+
+AsmSession::Result AsmSession::apply(std::vector<std::string> newLines, Memory& mem, bool full) {
+  Result r;
+  r.lines = newLines.size();
+
+  // Pass 1: layout only.
+  Assembler::Layout lay = Assembler::layoutSource(newLines, base);
+  auto& newSymbols = lay.symbols;
+  auto& newAddr = lay.lineAddr;
+  auto& instrs = lay.instrs;
+  if (lay.end > base && (lay.end - 4) / 4 >= mem.sizeWords()) throw std::runtime_error("Program too large for memory.");
+
+  auto sameLabels = [&](const std::vector<std::string>& refs) {
+    for (const auto& l : refs) {
+      auto a = symbols.find(l), b = newSymbols.find(l);
+      if (a == symbols.end() || b == newSymbols.end() || a->second != b->second) return false;
+    }
+    return true;
+  };
+
+  // Pass 2: reuse or re-encode each word. Nothing is written until the
+  // whole file has assembled, so a typo leaves memory untouched.
+  std::unordered_map<u64, Slot> newSlots;
+  std::unordered_map<u64, std::size_t> newAddrLine;
+  std::unordered_map<std::string, const Slot*> byText;
+  bool byTextBuilt = false;
+  newSlots.reserve(slots.size());
+  for (std::size_t i = 0; i < newLines.size(); i++) {
+    if (newAddr[i] < 0) continue;
+    const u64 a = (u64)newAddr[i];
+    newAddrLine[a] = i;
+    auto old = slots.find(a);
+    if (!full && old != slots.end() && old->second.instr == instrs[i] && sameLabels(old->second.refs)) {
+      newSlots[a] = old->second;
+      continue;
+    }
+    // Lines shifted by an insert/delete: label-free instructions encode the
+    // same at any address, so reuse them by text.
+    if (!full && !slots.empty()) {
+      if (!byTextBuilt) {
+        for (const auto& [oa, os] : slots) {
+          if (os.refs.empty()) byText.emplace(os.instr, &os);
+        }
+        byTextBuilt = true;
+      }
+      auto hit = byText.find(instrs[i]);
+      if (hit != byText.end()) {
+        newSlots[a] = *hit->second;
+        continue;
+      }
+    }
+    Slot s;
+    try {
+      s.word = *Assembler::assembleLine(instrs[i], a, &newSymbols);
+    } catch (const std::exception& e) {
+      throw std::runtime_error("line " + std::to_string(i + 1) + ": " + e.what());
+    }
+    s.refs = Assembler::referencedLabels(instrs[i]);
+    s.instr = std::move(instrs[i]);
+    newSlots[a] = std::move(s);
+    r.reencoded++;
+  }
+
+  // Patch memory: changed words, and words the old program used but the new one doesn't.
+  for (const auto& [a, s] : newSlots) {
+    if (full || mem.loadWord(a) != s.word) {
+      mem.storeWord(a, s.word);
+      r.patched++;
+    }
+  }
+  for (const auto& [a, s] : slots) {
+    if (!newSlots.count(a) && a < (u64)mem.sizeWords() * 4) {
+      mem.storeWord(a, 0);
+      r.patched++;
+    }
+  }
+
+  lines = std::move(newLines);
+  lineAddr = std::move(newAddr);
+  slots = std::move(newSlots);
+  addrLine = std::move(newAddrLine);
+  symbols = std::move(newSymbols);
+  r.words = slots.size();
+  return r;
+}
+
+void AsmSession::relocate(const Optimizer::Result& moved) {
+  std::unordered_map<u64, std::size_t> newAddrLine;
+  for (const auto& [a, line] : addrLine) {
+    if (!moved.wasRemoved(a)) newAddrLine[moved.map(a)] = line;
+  }
+  addrLine = std::move(newAddrLine);
+  for (auto& a : lineAddr) {
+    if (a < 0) continue;
+    a = moved.wasRemoved((u64)a) ? -1 : (i64)moved.map((u64)a);
+  }
+  for (auto& [name, a] : symbols) a = moved.map(a);
+}
+
+std::optional<std::size_t> AsmSession::lineForAddr(u64 addr) const {
+  auto it = addrLine.find(addr);
+  if (it == addrLine.end()) return std::nullopt;
+  return it->second + 1;
+}
+
+std::optional<u64> AsmSession::addrForLine(std::size_t line) const {
+  if (line == 0 || line > lineAddr.size() || lineAddr[line - 1] < 0) return std::nullopt;
+  return (u64)lineAddr[line - 1];
+}
+
+std::string AsmSession::lineText(std::size_t line) const {
+  if (line == 0 || line > lines.size()) return "";
+  return lines[line - 1];
+}
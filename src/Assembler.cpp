@@ -5,6 +5,8 @@
 #include <sstream>
 #include <stdexcept>
 #include <iomanip>
+#include <limits>
+#include <thread>
 
 static std::string up(std::string s) {
   for (auto& c : s) c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
@@ -47,6 +49,22 @@ static int parseReg(const std::string& tok) {
   if (v < 0 || v > 31) throw std::runtime_error("Register out of range X0..X31.");
   return v;
 }
+static bool isVReg(const std::string& tok) {
+  return tok.size() >= 2 && std::toupper(static_cast<unsigned char>(tok[0])) == 'V' &&
+         std::isdigit(static_cast<unsigned char>(tok[1]));
+}
+// "V3.4S" -> 3, arrangement "4S"; "V3" -> 3, "".
+static int parseVReg(const std::string& tok, std::string* arrangement = nullptr) {
+  std::string t = up(tok);
+  if (!isVReg(t)) throw std::runtime_error("Expected vector register like V3.");
+  auto dot = t.find('.');
+  std::size_t used = 0;
+  int v = std::stoi(t.substr(1, dot == std::string::npos ? std::string::npos : dot - 1), &used);
+  if (used + 1 != std::min(dot, t.size())) throw std::runtime_error("Expected vector register like V3.");
+  if (v < 0 || v > 31) throw std::runtime_error("Register out of range V0..V31.");
+  if (arrangement) *arrangement = dot == std::string::npos ? "" : t.substr(dot + 1);
+  return v;
+}
 static i64 parseImm(const std::string& tok) {
   std::string t = tok;
   if (!t.empty() && t[0] == '#') t = t.substr(1);
@@ -56,6 +74,23 @@ static i64 parseImm(const std::string& tok) {
   return std::stoll(t, nullptr, base);
 }
 
+static bool isLabelStart(char c) { return std::isalpha(static_cast<unsigned char>(c)) || c == '_' || c == '.'; }
+static bool isLabelChar(char c) { return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.'; }
+
+static bool isLabelName(const std::string& t) {
+  if (t.empty() || !isLabelStart(t[0])) return false;
+  return std::all_of(t.begin(), t.end(), isLabelChar);
+}
+
+// Branch operand: '#imm' (word offset) or a label resolved relative to pc.
+static i64 parseTarget(const std::string& tok, u64 pc, const Assembler::SymbolTable* symbols) {
+  if (!isLabelName(tok)) return parseImm(tok);
+  if (!symbols) throw std::runtime_error("Labels need a source file (asm): " + tok);
+  auto it = symbols->find(tok);
+  if (it == symbols->end()) throw std::runtime_error("Unknown label: " + tok);
+  return ((i64)it->second - (i64)pc) / 4;
+}
+
 // Assemble base formats (matching the CS251 sheet fields)
 static u32 encR(u32 op11, int rm, int shamt, int rn, int rd) {
   u32 w = 0;
@@ -83,6 +118,17 @@ static u32 encD(u32 op11, int addr9, int rn, int rt) {
   w = enc::set(w, 4, 0, (u32)rt);
   return w;
 }
+// D-format opcode of a load/store mnemonic.
+static std::optional<u32> memOpcode(const std::string& op) {
+  static const std::pair<const char*, u32> kOps[] = {
+    {"LDUR", enc::OP_LDUR},   {"STUR", enc::OP_STUR},   {"LDURB", enc::OP_LDURB}, {"STURB", enc::OP_STURB},
+    {"LDURH", enc::OP_LDURH}, {"STURH", enc::OP_STURH}, {"LDURSW", enc::OP_LDURSW},
+    {"LDURD", enc::OP_LDURD}, {"STURD", enc::OP_STURD},
+  };
+  for (const auto& [name, code] : kOps) if (op == name) return code;
+  return std::nullopt;
+}
+
 static u32 encB(u32 op6, i64 imm26) {
   u32 w = 0;
   w = enc::set(w, 31, 26, op6);
@@ -97,23 +143,101 @@ static u32 encCB(u32 op8, i64 imm19, int rt) {
   return w;
 }
 
-// Custom B.cond: opcode[31:24]=OP_BCOND, cond[23:20], imm19[23:5], rt unused (set 31)
+// Custom B.cond: opcode[31:24]=OP_BCOND, imm19[23:5], cond[3:0]
 static u32 encBCOND(enc::Cond cond, i64 imm19) {
   u32 w = 0;
   w = enc::set(w, 31, 24, enc::OP_BCOND);
-  w = enc::set(w, 23, 20, (u32)cond);
   w = enc::set(w, 23, 5, (u32)(imm19 & 0x7FFFF));
-  w = enc::set(w, 4, 0, 31);
+  w = enc::set(w, 4, 0, (u32)cond);
   return w;
 }
 
+// B.cond suffixes, indexed by Cond value. HS/LO are accepted as CS/CC aliases.
+static const char* const kCondNames[16] = {
+  "EQ", "NE", "CS", "CC", "MI", "PL", "VS", "VC",
+  "HI", "LS", "GE", "LT", "GT", "LE", "AL", "NV",
+};
+
+static bool parseCond(const std::string& suffix, enc::Cond& out) {
+  if (suffix == "HS") { out = enc::Cond::CS; return true; }
+  if (suffix == "LO") { out = enc::Cond::CC; return true; }
+  for (u32 i = 0; i < 15; i++) {
+    if (suffix == kCondNames[i]) { out = (enc::Cond)i; return true; }
+  }
+  return false;
+}
+
 // Custom XEXT: opcode[31:21]=OP_XEXT, funct[15:10] uses shamt field to store function id,
 // other fields like R.
 static u32 encXEXT(enc::XFunct f, int rm, int rn, int rd, int shamt=0) {
   return encR(enc::OP_XEXT, rm, ((int)f & 0x3F), rn, rd) | ((u32)shamt << 10); // shamt normal ignored for now
 }
 
+// Vector extension: opcode[31:21]=OP_VEXT, funct[15:10] = VFunct | VLANES64 for 2D.
+static u32 encVEXT(enc::VFunct f, bool lanes64, int rm, int rn, int rd) {
+  return encR(enc::OP_VEXT, rm, (int)f | (lanes64 ? (int)enc::VLANES64 : 0), rn, rd);
+}
+
+// "4S" -> false, "2D" -> true.
+static bool parseLanes(const std::string& arrangement, const std::string& op) {
+  if (arrangement == "4S") return false;
+  if (arrangement == "2D") return true;
+  throw std::runtime_error(op + ": lanes must be .4S or .2D.");
+}
+
+static std::optional<u32> assembleVector(const std::string& op, const std::vector<std::string>& toks) {
+  static const std::pair<const char*, enc::VFunct> kAlu[] = {
+    {"ADD", enc::VFunct::ADD}, {"SUB", enc::VFunct::SUB}, {"MUL", enc::VFunct::MUL},
+    {"AND", enc::VFunct::AND}, {"ORR", enc::VFunct::ORR}, {"EOR", enc::VFunct::EOR},
+  };
+  for (auto& [name, f] : kAlu) {
+    if (op != name || toks.size() < 2 || !isVReg(toks[1])) continue;
+    if (toks.size() != 4) throw std::runtime_error(op + " expects: " + op + " Vd.4S, Vn.4S, Vm.4S (or .2D)");
+    std::string a, b, c;
+    int vd = parseVReg(toks[1], &a), vn = parseVReg(toks[2], &b), vm = parseVReg(toks[3], &c);
+    if (a != b || a != c) throw std::runtime_error(op + ": all operands need the same lanes.");
+    return encVEXT(f, parseLanes(a, op), vm, vn, vd);
+  }
+  if (op == "VLDR" || op == "VSTR") {
+    // VLDR Vt, [Xn]   /   VLDR Vt, [Xn], #16 (post-index)
+    if (toks.size() != 3 && toks.size() != 4) throw std::runtime_error(op + " expects: " + op + " Vt, [Xn]{, #16}");
+    int vt = parseVReg(toks[1]);
+    const std::string& t2 = toks[2];
+    if (t2.size() < 4 || t2.front() != '[' || t2.back() != ']') throw std::runtime_error("Expected [Xn] in " + op + ".");
+    int rn = parseReg(t2.substr(1, t2.size() - 2));
+    bool post = toks.size() == 4;
+    if (post && parseImm(toks[3]) != 16) throw std::runtime_error(op + ": post-index must be #16.");
+    return encVEXT(op == "VLDR" ? enc::VFunct::LDR : enc::VFunct::STR, false, post ? 1 : 0, rn, vt);
+  }
+  if (op == "UMOV") {
+    // UMOV Xd, Vn.S[i]  /  UMOV Xd, Vn.D[i]
+    if (toks.size() != 3) throw std::runtime_error("UMOV expects: UMOV Xd, Vn.S[i] (or Vn.D[i])");
+    int rd = parseReg(toks[1]);
+    std::string t = up(toks[2]);
+    auto open = t.find('[');
+    if (open == std::string::npos || t.back() != ']') throw std::runtime_error("UMOV expects a lane like V1.S[2].");
+    std::string lane;
+    int vn = parseVReg(t.substr(0, open), &lane);
+    if (lane != "S" && lane != "D") throw std::runtime_error("UMOV: lane must be .S[i] or .D[i].");
+    i64 idx = parseImm(t.substr(open + 1, t.size() - open - 2));
+    if (idx < 0 || idx > (lane == "S" ? 3 : 1)) throw std::runtime_error("UMOV: lane index out of range.");
+    return encVEXT(enc::VFunct::UMOV, lane == "D", (int)idx, vn, rd);
+  }
+  if (op == "DUP") {
+    // DUP Vd.4S, Xn  /  DUP Vd.2D, Xn
+    if (toks.size() != 3) throw std::runtime_error("DUP expects: DUP Vd.4S, Xn (or .2D)");
+    std::string a;
+    int vd = parseVReg(toks[1], &a);
+    return encVEXT(enc::VFunct::DUP, parseLanes(a, op), 0, parseReg(toks[2]), vd);
+  }
+  return std::nullopt;
+}
+
 std::optional<u32> Assembler::assembleLine(const std::string& lineIn) {
+  return assembleLine(lineIn, 0, nullptr);
+}
+
+std::optional<u32> Assembler::assembleLine(const std::string& lineIn, u64 pc, const SymbolTable* symbols) {
   std::string line = lineIn;
   stripComment(line);
   line = trim(line);
@@ -124,26 +248,30 @@ std::optional<u32> Assembler::assembleLine(const std::string& lineIn) {
 
   std::string op = up(toks[0]);
 
+  // ----- data -----
+  if (op == ".WORD") {
+    if (toks.size() != 2) throw std::runtime_error(".word expects one value like 0x1234.");
+    return (u32)(parseImm(toks[1]) & 0xFFFFFFFF);
+  }
+
   // ----- pseudo / fixed -----
   if (op == "NOP") return enc::OP_NOP;
   if (op == "HALT") return enc::OP_HALT;
 
   // ----- conditional branches -----
-  if (op == "B.EQ" || op == "B.NE" || op == "B.LT" || op == "B.GE") {
+  if (op.size() > 2 && op.compare(0, 2, "B.") == 0) {
+    enc::Cond c = enc::Cond::AL;
+    if (!parseCond(op.substr(2), c)) throw std::runtime_error("Unknown branch condition: " + op);
     if (toks.size() != 2) throw std::runtime_error("B.<cond> expects one immediate like #25.");
-    i64 imm = parseImm(toks[1]);
-    enc::Cond c = enc::Cond::EQ;
-    if (op == "B.EQ") c = enc::Cond::EQ;
-    else if (op == "B.NE") c = enc::Cond::NE;
-    else if (op == "B.LT") c = enc::Cond::LT;
-    else if (op == "B.GE") c = enc::Cond::GE;
+    i64 imm = parseTarget(toks[1], pc, symbols);
+    if (imm < -(1ll<<18) || imm > ((1ll<<18)-1)) throw std::runtime_error("B.cond immediate out of 19-bit range.");
     return encBCOND(c, imm);
   }
 
   // ----- base B / BL -----
   if (op == "B" || op == "BL") {
     if (toks.size() != 2) throw std::runtime_error("B/BL expects one immediate like #25.");
-    i64 imm = parseImm(toks[1]);
+    i64 imm = parseTarget(toks[1], pc, symbols);
     if (imm < -(1ll<<25) || imm > ((1ll<<25)-1)) throw std::runtime_error("B immediate out of 26-bit range.");
     return encB(op=="B" ? enc::OP_B : enc::OP_BL, imm);
   }
@@ -152,18 +280,19 @@ std::optional<u32> Assembler::assembleLine(const std::string& lineIn) {
   if (op == "CBZ" || op == "CBNZ") {
     if (toks.size() != 3) throw std::runtime_error("CBZ/CBNZ expects: CBZ Xn, #imm19");
     int rt = parseReg(toks[1]);
-    i64 imm = parseImm(toks[2]);
+    i64 imm = parseTarget(toks[2], pc, symbols);
+    if (imm < -(1ll<<18) || imm > ((1ll<<18)-1)) throw std::runtime_error("CBZ/CBNZ immediate out of 19-bit range.");
     return encCB(op=="CBZ" ? enc::OP_CBZ : enc::OP_CBNZ, imm, rt);
   }
 
   // ----- loads/stores -----
-  if (op == "LDUR" || op == "STUR") {
-    // LDUR Xt, [Xn, #imm]
-    if (toks.size() != 4) throw std::runtime_error("LDUR/STUR expects: LDUR Xt, [Xn, #imm]");
+  if (auto dop = memOpcode(op)) {
+    // LDUR Xt, [Xn, #imm] (and the sized variants)
+    if (toks.size() != 4) throw std::runtime_error(op + " expects: " + op + " Xt, [Xn, #imm]");
     int rt = parseReg(toks[1]);
     // toks[2] should be like [Xn
     std::string t2 = toks[2];
-    if (t2.size() < 3 || t2[0] != '[') throw std::runtime_error("Expected [Xn, in LDUR/STUR.");
+    if (t2.size() < 3 || t2[0] != '[') throw std::runtime_error("Expected [Xn, in " + op + ".");
     t2 = t2.substr(1);
     int rn = parseReg(t2);
     std::string t3 = toks[3];
@@ -172,11 +301,15 @@ std::optional<u32> Assembler::assembleLine(const std::string& lineIn) {
     if (imm < -(1<<8) || imm > ((1<<8)-1)) throw std::runtime_error("D-format address out of 9-bit signed range.");
     // store in 9-bit field as two's complement
     u32 addr9 = (u32)(imm & 0x1FF);
-    return encD(op=="LDUR" ? enc::OP_LDUR : enc::OP_STUR, (int)addr9, rn, rt);
+    return encD(*dop, (int)addr9, rn, rt);
   }
 
+  // ----- vector extension -----
+  if (auto w = assembleVector(op, toks)) return w;
+
   // ----- ALU R-format -----
-  if (op == "ADD" || op == "SUB" || op == "AND" || op == "ORR" || op == "EOR" || op == "MUL") {
+  if (op == "ADD" || op == "SUB" || op == "ADDS" || op == "SUBS" ||
+      op == "AND" || op == "ORR" || op == "EOR" || op == "MUL") {
     if (toks.size() != 4) throw std::runtime_error(op + " expects: " + op + " Xd, Xn, Xm");
     int rd = parseReg(toks[1]);
     int rn = parseReg(toks[2]);
@@ -184,6 +317,8 @@ std::optional<u32> Assembler::assembleLine(const std::string& lineIn) {
 
     if (op == "ADD") return encR(enc::OP_ADD, rm, 0, rn, rd);
     if (op == "SUB") return encR(enc::OP_SUB, rm, 0, rn, rd);
+    if (op == "ADDS") return encR(enc::OP_ADDS, rm, 0, rn, rd);
+    if (op == "SUBS") return encR(enc::OP_SUBS, rm, 0, rn, rd);
     if (op == "AND") return encXEXT(enc::XFunct::AND, rm, rn, rd);
     if (op == "ORR") return encXEXT(enc::XFunct::ORR, rm, rn, rd);
     if (op == "EOR") return encXEXT(enc::XFunct::EOR, rm, rn, rd);
@@ -210,13 +345,15 @@ std::optional<u32> Assembler::assembleLine(const std::string& lineIn) {
   }
 
   // ----- immediate ALU -----
-  if (op == "ADDI" || op == "SUBI") {
+  if (op == "ADDI" || op == "SUBI" || op == "ADDIS" || op == "SUBIS") {
     if (toks.size() != 4) throw std::runtime_error(op + " expects: " + op + " Xd, Xn, #imm12");
     int rd = parseReg(toks[1]);
     int rn = parseReg(toks[2]);
     i64 imm = parseImm(toks[3]);
     if (imm < 0 || imm > 4095) throw std::runtime_error("I-format imm12 must be 0..4095 in this project.");
-    return encI(op=="ADDI" ? enc::OP_ADDI : enc::OP_SUBI, (int)imm, rn, rd);
+    u32 op10 = op == "ADDI" ? enc::OP_ADDI : op == "SUBI" ? enc::OP_SUBI
+             : op == "ADDIS" ? enc::OP_ADDIS : enc::OP_SUBIS;
+    return encI(op10, (int)imm, rn, rd);
   }
 
   // ----- CMP -----
@@ -228,6 +365,36 @@ std::optional<u32> Assembler::assembleLine(const std::string& lineIn) {
     return encXEXT(enc::XFunct::CMP, rm, rn, 31);
   }
 
+  // ----- atomics / hart id -----
+  if (op == "CAS" || op == "LDADD") {
+    // CAS Xs, Xt, [Xn]   /   LDADD Xs, Xt, [Xn]
+    if (toks.size() != 4) throw std::runtime_error(op + " expects: " + op + " Xs, Xt, [Xn]");
+    int rs = parseReg(toks[1]);
+    int rt = parseReg(toks[2]);
+    std::string t3 = toks[3];
+    if (t3.size() < 4 || t3.front() != '[' || t3.back() != ']') throw std::runtime_error("Expected [Xn] in " + op + ".");
+    int rn = parseReg(t3.substr(1, t3.size() - 2));
+    return encXEXT(op == "CAS" ? enc::XFunct::CAS : enc::XFunct::LDADD, rs, rn, rt);
+  }
+  if (op == "HARTID") {
+    if (toks.size() != 2) throw std::runtime_error("HARTID expects: HARTID Xd");
+    return encXEXT(enc::XFunct::HARTID, 0, 0, parseReg(toks[1]));
+  }
+
+  // ----- semihosting -----
+  if (op == "HCALL") {
+    if (toks.size() != 2) throw std::runtime_error("HCALL expects: HCALL #service");
+    i64 svc = parseImm(toks[1]);
+    if (svc < 0 || svc > 31) throw std::runtime_error("HCALL service must be 0..31.");
+    return encXEXT(enc::XFunct::HCALL, (int)svc, 0, 0);
+  }
+
+  // ----- interrupts -----
+  if (op == "ERET") {
+    if (toks.size() != 1) throw std::runtime_error("ERET takes no operands.");
+    return encXEXT(enc::XFunct::ERET, 0, 0, 0);
+  }
+
   // ----- RET -----
   if (op == "RET") {
     // RET Xn   (default X30 if omitted)
@@ -240,6 +407,184 @@ std::optional<u32> Assembler::assembleLine(const std::string& lineIn) {
   throw std::runtime_error("Unknown/unsupported instruction: " + op);
 }
 
+Assembler::SourceLine Assembler::splitSourceLine(const std::string& lineIn) {
+  SourceLine out;
+  std::string line = lineIn;
+  stripComment(line);
+  line = trim(line);
+  auto colon = line.find(':');
+  if (colon != std::string::npos) {
+    std::string name = trim(line.substr(0, colon));
+    if (!isLabelName(name)) throw std::runtime_error("Bad label: " + name);
+    out.label = name;
+    line = trim(line.substr(colon + 1));
+  }
+  out.instr = line;
+  return out;
+}
+
+std::vector<std::string> Assembler::referencedLabels(const std::string& instr) {
+  std::vector<std::string> out;
+  auto toks = splitTokens(instr);
+  for (std::size_t i = 1; i < toks.size(); i++) {
+    const auto& t = toks[i];
+    if (!isLabelName(t)) continue;
+    if ((t[0] == 'X' || t[0] == 'x') && t.size() > 1 &&
+        std::all_of(t.begin() + 1, t.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)); })) {
+      continue; // register
+    }
+    out.push_back(t);
+  }
+  return out;
+}
+
+Assembler::Layout Assembler::layoutSource(const std::vector<std::string>& lines, u64 base) {
+  Layout lay;
+  lay.lineAddr.assign(lines.size(), -1);
+  lay.instrs.resize(lines.size());
+  u64 addr = base;
+  for (std::size_t i = 0; i < lines.size(); i++) {
+    SourceLine sl;
+    try {
+      sl = splitSourceLine(lines[i]);
+    } catch (const std::exception& e) {
+      throw std::runtime_error("line " + std::to_string(i + 1) + ": " + e.what());
+    }
+    if (!sl.label.empty() && !lay.symbols.emplace(sl.label, addr).second) {
+      throw std::runtime_error("line " + std::to_string(i + 1) + ": duplicate label " + sl.label);
+    }
+    if (sl.instr.empty()) continue;
+    lay.lineAddr[i] = (i64)addr;
+    lay.instrs[i] = std::move(sl.instr);
+    addr += 4;
+  }
+  lay.end = addr;
+  return lay;
+}
+
+Assembler::Program Assembler::assembleSource(const std::vector<std::string>& lines, u64 base) {
+  Layout lay = layoutSource(lines, base);
+  Program prog;
+  prog.words.reserve((std::size_t)((lay.end - base) / 4));
+  for (std::size_t i = 0; i < lines.size(); i++) {
+    if (lay.lineAddr[i] < 0) continue;
+    try {
+      prog.words.push_back(*assembleLine(lay.instrs[i], (u64)lay.lineAddr[i], &lay.symbols));
+    } catch (const std::exception& e) {
+      throw std::runtime_error("line " + std::to_string(i + 1) + ": " + e.what());
+    }
+  }
+  prog.lineAddr = std::move(lay.lineAddr);
+  prog.symbols = std::move(lay.symbols);
+  return prog;
+}
+
+namespace {
+
+// First error seen by a chunk, kept with its line so the earliest one wins.
+struct ChunkError {
+  std::size_t line = std::numeric_limits<std::size_t>::max();
+  std::string msg;
+  void note(std::size_t l, const std::string& m) {
+    if (l < line) { line = l; msg = m; }
+  }
+};
+
+template <typename F>
+void forEachChunk(std::size_t nChunks, F&& f) {
+  std::vector<std::thread> pool;
+  pool.reserve(nChunks);
+  for (std::size_t c = 1; c < nChunks; c++) pool.emplace_back(f, c);
+  f(0);
+  for (auto& t : pool) t.join();
+}
+
+} // namespace
+
+Assembler::Program Assembler::assembleSourceParallel(const std::vector<std::string>& lines, u64 base,
+                                                     unsigned threads) {
+  constexpr std::size_t kMinLinesPerChunk = 4096;
+  if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+  const std::size_t nChunks = std::max<std::size_t>(1, std::min<std::size_t>(threads, lines.size() / kMinLinesPerChunk));
+  if (nChunks == 1) return assembleSource(lines, base);
+
+  const std::size_t per = (lines.size() + nChunks - 1) / nChunks;
+  auto chunkBegin = [&](std::size_t c) { return std::min(lines.size(), c * per); };
+
+  struct LocalLabel { std::string name; std::size_t word; std::size_t line; };
+  struct Chunk {
+    std::size_t words = 0;          // instructions in this chunk
+    std::vector<LocalLabel> labels; // chunk-relative word index
+    ChunkError err;
+  };
+  std::vector<Chunk> chunks(nChunks);
+  std::vector<std::string> instrs(lines.size());
+  std::vector<i64> rel(lines.size(), -1); // chunk-relative word index per line
+
+  // Pass 1: split lines, count words, collect labels per chunk.
+  forEachChunk(nChunks, [&](std::size_t c) {
+    auto& ch = chunks[c];
+    for (std::size_t i = chunkBegin(c); i < chunkBegin(c + 1); i++) {
+      SourceLine sl;
+      try {
+        sl = splitSourceLine(lines[i]);
+      } catch (const std::exception& e) {
+        ch.err.note(i, e.what());
+        continue;
+      }
+      if (!sl.label.empty()) ch.labels.push_back({std::move(sl.label), ch.words, i});
+      if (sl.instr.empty()) continue;
+      rel[i] = (i64)ch.words++;
+      instrs[i] = std::move(sl.instr);
+    }
+  });
+
+  // Merge: chunk base addresses and one symbol table, in line order.
+  Program prog;
+  std::vector<u64> chunkAddr(nChunks);
+  std::vector<std::size_t> chunkWord(nChunks);
+  ChunkError err;
+  u64 addr = base;
+  std::size_t word = 0;
+  for (std::size_t c = 0; c < nChunks; c++) {
+    chunkAddr[c] = addr;
+    chunkWord[c] = word;
+    if (chunks[c].err.line < err.line) err = chunks[c].err;
+    for (auto& l : chunks[c].labels) {
+      if (!prog.symbols.emplace(l.name, addr + 4ull * l.word).second) err.note(l.line, "duplicate label " + l.name);
+    }
+    addr += 4ull * chunks[c].words;
+    word += chunks[c].words;
+  }
+  if (err.line != std::numeric_limits<std::size_t>::max()) {
+    throw std::runtime_error("line " + std::to_string(err.line + 1) + ": " + err.msg);
+  }
+
+  // Pass 2: encode each chunk into its preallocated slice.
+  prog.words.assign(word, 0);
+  prog.lineAddr.assign(lines.size(), -1);
+  forEachChunk(nChunks, [&](std::size_t c) {
+    auto& ch = chunks[c];
+    for (std::size_t i = chunkBegin(c); i < chunkBegin(c + 1); i++) {
+      if (rel[i] < 0) continue;
+      const u64 a = chunkAddr[c] + 4ull * (u64)rel[i];
+      prog.lineAddr[i] = (i64)a;
+      try {
+        prog.words[chunkWord[c] + (std::size_t)rel[i]] = *assembleLine(instrs[i], a, &prog.symbols);
+      } catch (const std::exception& e) {
+        ch.err.note(i, e.what());
+      }
+    }
+  });
+  for (auto& ch : chunks) {
+    if (ch.err.line < err.line) err = ch.err;
+  }
+  if (err.line != std::numeric_limits<std::size_t>::max()) {
+    throw std::runtime_error("line " + std::to_string(err.line + 1) + ": " + err.msg);
+  }
+  return prog;
+}
+
 std::string Assembler::disasm(u32 w, u64 pc) {
   using namespace enc;
   std::ostringstream oss;
@@ -266,18 +611,14 @@ std::string Assembler::disasm(u32 w, u64 pc) {
   }
 
   if (op8 == OP_BCOND) {
-    u32 cond = get(w,23,20);
+    u32 cond = get(w,3,0);
     i64 imm = sext(get(w,23,5), 19);
-    const char* c = "EQ";
-    if (cond == (u32)Cond::EQ) c = "EQ";
-    else if (cond == (u32)Cond::NE) c = "NE";
-    else if (cond == (u32)Cond::LT) c = "LT";
-    else if (cond == (u32)Cond::GE) c = "GE";
-    oss << "B." << c << " #" << imm;
+    oss << "B." << kCondNames[cond] << " #" << imm;
     return oss.str();
   }
 
-  if (op11 == OP_ADD || op11 == OP_SUB || op11 == OP_LDUR || op11 == OP_STUR || op11 == OP_XEXT) {
+  if (op11 == OP_ADD || op11 == OP_SUB || op11 == OP_ADDS || op11 == OP_SUBS ||
+      op11 == OP_LDUR || op11 == OP_STUR || op11 == OP_XEXT) {
     int rm = (int)get(w,20,16);
     int shamt = (int)get(w,15,10);
     int rn = (int)get(w,9,5);
@@ -285,6 +626,8 @@ std::string Assembler::disasm(u32 w, u64 pc) {
 
     if (op11 == OP_ADD) { oss << "ADD X" << rd << ", X" << rn << ", X" << rm; return oss.str(); }
     if (op11 == OP_SUB) { oss << "SUB X" << rd << ", X" << rn << ", X" << rm; return oss.str(); }
+    if (op11 == OP_ADDS) { oss << "ADDS X" << rd << ", X" << rn << ", X" << rm; return oss.str(); }
+    if (op11 == OP_SUBS) { oss << "SUBS X" << rd << ", X" << rn << ", X" << rm; return oss.str(); }
 
     if (op11 == OP_LDUR || op11 == OP_STUR) {
       i64 addr = sext(get(w,20,12), 9);
@@ -303,14 +646,56 @@ std::string Assembler::disasm(u32 w, u64 pc) {
       if (f == XFunct::LSL) { oss << "LSL X" << rd << ", X" << rn << ", #" << rm; return oss.str(); }
       if (f == XFunct::LSR) { oss << "LSR X" << rd << ", X" << rn << ", #" << rm; return oss.str(); }
       if (f == XFunct::RET) { oss << "RET X" << rn; return oss.str(); }
+      if (f == XFunct::CAS) { oss << "CAS X" << rm << ", X" << rd << ", [X" << rn << "]"; return oss.str(); }
+      if (f == XFunct::LDADD) { oss << "LDADD X" << rm << ", X" << rd << ", [X" << rn << "]"; return oss.str(); }
+      if (f == XFunct::HARTID) { oss << "HARTID X" << rd; return oss.str(); }
+      if (f == XFunct::HCALL) { oss << "HCALL #" << rm; return oss.str(); }
+      if (f == XFunct::ERET) return "ERET";
+    }
+  }
+
+  if (isSizedLoad(op11) || isSizedStore(op11)) {
+    static const std::pair<u32, const char*> kNames[] = {
+      {OP_LDURB, "LDURB"}, {OP_STURB, "STURB"}, {OP_LDURH, "LDURH"}, {OP_STURH, "STURH"},
+      {OP_LDURSW, "LDURSW"}, {OP_LDURD, "LDURD"}, {OP_STURD, "STURD"},
+    };
+    for (const auto& [code, name] : kNames) {
+      if (code == op11) oss << name;
+    }
+    oss << " X" << get(w,4,0) << ", [X" << get(w,9,5) << ", #" << sext(get(w,20,12), 9) << "]";
+    return oss.str();
+  }
+
+  if (op11 == OP_VEXT) {
+    int rm = (int)get(w,20,16);
+    u32 funct = get(w,15,10);
+    int rn = (int)get(w,9,5);
+    int rd = (int)get(w,4,0);
+    const bool lanes64 = (funct & VLANES64) != 0;
+    const char* arr = lanes64 ? ".2D" : ".4S";
+    static const char* const kAlu[] = {"ADD", "SUB", "MUL", "AND", "ORR", "EOR"};
+    auto f = (VFunct)(funct & 0x1F);
+    if (f <= VFunct::EOR) {
+      oss << kAlu[(int)f] << " V" << rd << arr << ", V" << rn << arr << ", V" << rm << arr;
+      return oss.str();
+    }
+    if (f == VFunct::LDR || f == VFunct::STR) {
+      oss << (f == VFunct::LDR ? "VLDR" : "VSTR") << " V" << rd << ", [X" << rn << "]" << (rm & 1 ? ", #16" : "");
+      return oss.str();
+    }
+    if (f == VFunct::UMOV) {
+      oss << "UMOV X" << rd << ", V" << rn << (lanes64 ? ".D[" : ".S[") << (rm & (lanes64 ? 1 : 3)) << "]";
+      return oss.str();
     }
+    if (f == VFunct::DUP) { oss << "DUP V" << rd << arr << ", X" << rn; return oss.str(); }
   }
 
-  if (op10 == OP_ADDI || op10 == OP_SUBI) {
+  if (op10 == OP_ADDI || op10 == OP_SUBI || op10 == OP_ADDIS || op10 == OP_SUBIS) {
     int imm = (int)get(w,21,10);
     int rn = (int)get(w,9,5);
     int rd = (int)get(w,4,0);
-    oss << (op10==OP_ADDI ? "ADDI" : "SUBI") << " X" << rd << ", X" << rn << ", #" << imm;
+    const char* name = op10 == OP_ADDI ? "ADDI" : op10 == OP_SUBI ? "SUBI" : op10 == OP_ADDIS ? "ADDIS" : "SUBIS";
+    oss << name << " X" << rd << ", X" << rn << ", #" << imm;
     return oss.str();
   }
 
@@ -0,0 +1,196 @@
+#include "Breakpoints.h"
+#include "CPU.h"
+#include "Memory.h"
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+
+namespace {
+
+using Value = std::function<u64(const CPU&, const Memory&)>;
+using Predicate = Breakpoints::Predicate;
+
+// Thrown by an M[...] operand that is unaligned or outside RAM; hit() turns
+// it into "condition false".
+struct BadRead {};
+
+// Conditions read RAM only, so they never touch device registers.
+u64 ramWord(const Memory& m, u64 addr) {
+  if (addr % 4 != 0 || addr / 4 >= m.sizeWords()) throw BadRead{};
+  return m.getWordIndex(addr / 4);
+}
+
+// Recursive-descent parser producing closures; runs once per 'break ... if'.
+class CondParser {
+public:
+  explicit CondParser(const std::string& text) { tokenize(text); }
+
+  Predicate parse() {
+    auto p = parseOr();
+    if (pos != toks.size()) fail("unexpected '" + toks[pos] + "'");
+    return p;
+  }
+
+private:
+  std::vector<std::string> toks;
+  std::size_t pos = 0;
+
+  [[noreturn]] static void fail(const std::string& msg) {
+    throw std::runtime_error("Breakpoint condition: " + msg);
+  }
+
+  void tokenize(const std::string& s) {
+    static const char* kOps[] = {"==", "!=", "<=", ">=", "&&", "||", "<", ">", "!", "(", ")", "[", "]"};
+    std::size_t i = 0;
+    while (i < s.size()) {
+      if (std::isspace((unsigned char)s[i])) { i++; continue; }
+      bool op = false;
+      for (const char* o : kOps) {
+        std::size_t n = std::char_traits<char>::length(o);
+        if (s.compare(i, n, o) == 0) {
+          toks.emplace_back(o);
+          i += n;
+          op = true;
+          break;
+        }
+      }
+      if (op) continue;
+      std::size_t j = i;
+      while (j < s.size() && (std::isalnum((unsigned char)s[j]) || s[j] == '#' || s[j] == '_')) j++;
+      if (j == i) fail(std::string("unexpected character '") + s[i] + "'");
+      toks.push_back(s.substr(i, j - i));
+      i = j;
+    }
+  }
+
+  bool accept(const char* t) {
+    if (pos < toks.size() && toks[pos] == t) { pos++; return true; }
+    return false;
+  }
+
+  void expect(const char* t) {
+    if (!accept(t)) fail(std::string("expected '") + t + "'");
+  }
+
+  Predicate parseOr() {
+    auto lhs = parseAnd();
+    while (accept("||")) {
+      auto rhs = parseAnd();
+      lhs = [lhs, rhs](const CPU& c, const Memory& m) { return lhs(c, m) || rhs(c, m); };
+    }
+    return lhs;
+  }
+
+  Predicate parseAnd() {
+    auto lhs = parseUnary();
+    while (accept("&&")) {
+      auto rhs = parseUnary();
+      lhs = [lhs, rhs](const CPU& c, const Memory& m) { return lhs(c, m) && rhs(c, m); };
+    }
+    return lhs;
+  }
+
+  Predicate parseUnary() {
+    if (accept("!")) {
+      auto p = parseUnary();
+      return [p](const CPU& c, const Memory& m) { return !p(c, m); };
+    }
+    if (accept("(")) {
+      auto p = parseOr();
+      expect(")");
+      return p;
+    }
+    auto lhs = parseOperand();
+    static const char* kCmps[] = {"==", "!=", "<=", ">=", "<", ">"};
+    for (const char* op : kCmps) {
+      if (!accept(op)) continue;
+      auto rhs = parseOperand();
+      std::string o = op;
+      if (o == "==") return [lhs, rhs](const CPU& c, const Memory& m) { return lhs(c, m) == rhs(c, m); };
+      if (o == "!=") return [lhs, rhs](const CPU& c, const Memory& m) { return lhs(c, m) != rhs(c, m); };
+      if (o == "<=") return [lhs, rhs](const CPU& c, const Memory& m) { return lhs(c, m) <= rhs(c, m); };
+      if (o == ">=") return [lhs, rhs](const CPU& c, const Memory& m) { return lhs(c, m) >= rhs(c, m); };
+      if (o == "<") return [lhs, rhs](const CPU& c, const Memory& m) { return lhs(c, m) < rhs(c, m); };
+      return [lhs, rhs](const CPU& c, const Memory& m) { return lhs(c, m) > rhs(c, m); };
+    }
+    return [lhs](const CPU& c, const Memory& m) { return lhs(c, m) != 0; };
+  }
+
+  static std::string upper(std::string s) {
+    for (auto& ch : s) ch = (char)std::toupper((unsigned char)ch);
+    return s;
+  }
+
+  static int regIndex(const std::string& t) {
+    auto u = upper(t);
+    auto digit = [](char ch) { return std::isdigit((unsigned char)ch) != 0; };
+    if (u.size() < 2 || u[0] != 'X' || !std::all_of(u.begin() + 1, u.end(), digit)) return -1;
+    int r = std::stoi(u.substr(1));
+    if (r > 31) fail("no register " + t);
+    return r;
+  }
+
+  static u64 number(const std::string& t) {
+    std::string v = t[0] == '#' ? t.substr(1) : t;
+    try {
+      std::size_t used = 0;
+      u64 n = std::stoull(v, &used, 0);
+      if (used == v.size()) return n;
+    } catch (const std::exception&) {
+    }
+    fail("bad operand '" + t + "'");
+  }
+
+  Value parseOperand() {
+    if (pos >= toks.size()) fail("missing operand");
+    std::string t = toks[pos++];
+    if (int r = regIndex(t); r >= 0) return [r](const CPU& c, const Memory&) { return c.getX(r); };
+    if (upper(t) == "PC") return [](const CPU& c, const Memory&) { return c.getPC(); };
+    if (upper(t) == "M") {
+      expect("[");
+      if (pos >= toks.size()) fail("missing address");
+      std::string a = toks[pos++];
+      expect("]");
+      if (int r = regIndex(a); r >= 0) {
+        return [r](const CPU& c, const Memory& m) { return ramWord(m, c.getX(r)); };
+      }
+      u64 addr = number(a);
+      Memory::requireAligned4(addr);
+      return [addr](const CPU&, const Memory& m) { return ramWord(m, addr); };
+    }
+    u64 n = number(t);
+    return [n](const CPU&, const Memory&) { return n; };
+  }
+};
+
+} // namespace
+
+Breakpoints::Predicate Breakpoints::compile(const std::string& cond) {
+  return CondParser(cond).parse();
+}
+
+void Breakpoints::set(u64 addr, const std::string& cond, u64 ignore, u64 hits) {
+  Memory::requireAligned4(addr);
+  Breakpoint bp;
+  bp.condText = cond;
+  if (!cond.empty()) bp.cond = compile(cond);
+  bp.ignore = ignore;
+  bp.hits = hits;
+  table[addr] = std::move(bp);
+}
+
+bool Breakpoints::hit(Breakpoint& bp, const CPU& cpu, const Memory& mem) {
+  try {
+    if (bp.cond && !bp.cond(cpu, mem)) return false;
+  } catch (const BadRead&) {
+    return false;
+  }
+  return ++bp.hits > bp.ignore;
+}
+
+std::vector<std::pair<u64, const Breakpoints::Breakpoint*>> Breakpoints::list() const {
+  std::vector<std::pair<u64, const Breakpoint*>> out;
+  for (auto& [a, bp] : table) out.push_back({a, &bp});
+  std::sort(out.begin(), out.end(), [](const auto& x, const auto& y) { return x.first < y.first; });
+  return out;
+}
@@ -1,18 +1,27 @@
 #include "CPU.h"
+#include "Breakpoints.h"
+#include "CallProfiler.h"
+#include "Coverage.h"
 #include "Encoding.h"
-#include "Assembler.h"
+#include "HostCalls.h"
+#include <algorithm>
+#include <cstring>
 #include <stdexcept>
 
-CPU::CPU() { reset(); }
+CPU::CPU(int hartId_): hartId(hartId_) { reset(); }
 
 void CPU::reset() {
   clearRegisters();
   pc = 0;
   flags = {};
+  calls.reset(0);
+  irq = {};
+  updateDeadline();
 }
 
 void CPU::clearRegisters() {
   X.fill(0);
+  V.fill(Vec128{});
 }
 
 u64 CPU::getX(int i) const {
@@ -25,21 +34,118 @@ void CPU::setX(int i, u64 v) {
   X[static_cast<std::size_t>(i)] = v;
 }
 
+const Vec128& CPU::getV(int i) const {
+  if (i < 0 || i > 31) throw std::runtime_error("Register index out of range.");
+  return V[static_cast<std::size_t>(i)];
+}
+
+void CPU::setV(int i, const Vec128& v) {
+  if (i < 0 || i > 31) throw std::runtime_error("Register index out of range.");
+  V[static_cast<std::size_t>(i)] = v;
+}
+
 u64 CPU::add64(u64 a, u64 b) { return a + b; }
 
-u64 CPU::sub64(u64 a, u64 b, bool& Z, bool& N) {
-  u64 r = a - b;
-  Z = (r == 0);
-  N = (static_cast<i64>(r) < 0);
-  return r;
+u64 CPU::sub64(u64 a, u64 b) { return a - b; }
+
+void CPU::updateDeadline() {
+  irqDeadline = irq.inHandler ? Interrupts::kNever : irq.at;
+  sliceEnd = std::min(runEnd, irqDeadline);
+}
+
+void CPU::armTimer(bool enable, bool periodic) {
+  const u64 interval = std::max<u64>(irq.interval, 1);
+  irq.at = enable ? perf.instret + interval : Interrupts::kNever;
+  irq.period = enable && periodic ? interval : 0;
+  updateDeadline();
+}
+
+void CPU::takeInterrupt() {
+  irq.elr = pc;
+  irq.saved = flags.get();
+  irq.inHandler = true;
+  irq.taken++;
+  // A periodic timer that fell behind (long handler) skips the missed ticks.
+  irq.at = irq.period ? std::max(irq.at + irq.period, perf.instret + 1) : Interrupts::kNever;
+  pc = irq.vector;
+  updateDeadline();
+}
+
+// Shared headless loop; the depth test is compiled in only for runToDepth.
+// The inner loop runs to the slice end, which a timer write or ERET may
+// move; there the due interrupt is taken, as step() would before the next
+// instruction.
+template <bool kToDepth>
+static StopReason runLoop(CPU& cpu, Memory& mem, u64 maxSteps, i64 depth, Breakpoints* breakpoints) {
+  if (breakpoints && breakpoints->empty()) breakpoints = nullptr;
+  auto& perf = cpu.counters();
+  const u64 end = maxSteps > ~perf.instret ? ~0ull : perf.instret + maxSteps;
+  cpu.beginRun(end);
+  for (;;) {
+    while (perf.instret < cpu.getSliceEnd()) {
+      const u32 done = cpu.stepFused(mem, cpu.getSliceEnd() - perf.instret >= 2, breakpoints);
+      if (!done) return StopReason::Halt;
+      if (kToDepth && cpu.getCallDepth() <= depth) return StopReason::Return;
+      if (breakpoints) {
+        perf.bpChecks++;
+        if (breakpoints->check(cpu.getPC(), cpu, mem)) {
+          perf.bpHits++;
+          return StopReason::Breakpoint;
+        }
+      }
+    }
+    if (perf.instret >= end) return StopReason::StepLimit;
+    cpu.takeInterrupt();
+  }
+}
+
+StopReason CPU::run(Memory& mem, u64 maxSteps, Breakpoints* breakpoints) {
+  return runLoop<false>(*this, mem, maxSteps, 0, breakpoints);
+}
+
+StopReason CPU::runToDepth(Memory& mem, u64 maxSteps, i64 depth, Breakpoints* breakpoints) {
+  return runLoop<true>(*this, mem, maxSteps, depth, breakpoints);
+}
+
+u32 CPU::fusionPartner(const Memory& mem, const Breakpoints* breakpoints) const {
+  const u64 next = pc + 4;
+  if (next / 4 >= mem.sizeWords() || (breakpoints && breakpoints->contains(next))) return enc::OP_HALT;
+  return mem.loadWord(next);
+}
+
+// Second half of a fused pair: the CBZ/CBNZ/B.cond word after PC.
+u32 CPU::fusedBranch(u32 branch, bool take) {
+  const u64 at = pc + 4;
+  if (coverage) {
+    coverage->exec(at);
+    coverage->branch(at, take);
+  }
+  pc = take ? at + 4ull * (u64)enc::sext(enc::get(branch,23,5), 19) : at + 4;
+  perf.fusedPairs++;
+  return 2;
+}
+
+void CPU::execSized(Memory& mem, u32 instr) {
+  using namespace enc;
+  const u64 ea = X[get(instr,9,5)] + (u64)sext(get(instr,20,12), 9);
+  const int rt = (int)get(instr,4,0);
+  switch (get(instr,31,21)) {
+    case OP_LDURB:  X[rt] = mem.loadByte(ea); break;
+    case OP_LDURH:  X[rt] = mem.loadHalf(ea); break;
+    case OP_LDURSW: X[rt] = (u64)(i64)(std::int32_t)mem.loadWord(ea, this); break;
+    case OP_LDURD:  X[rt] = mem.loadDouble(ea); break;
+    case OP_STURB:  mem.storeByte(ea, (u8)X[rt]); break;
+    case OP_STURH:  mem.storeHalf(ea, (u16)X[rt]); break;
+    default:        mem.storeDouble(ea, X[rt]); break;
+  }
 }
 
-bool CPU::step(Memory& mem) {
+u32 CPU::exec(Memory& mem, u32 instr, bool fuse, const Breakpoints* breakpoints) {
   using namespace enc;
-  u32 instr = mem.loadWord(pc);
+  if (coverage) coverage->exec(pc);
 
-  if (instr == OP_HALT) return false;
-  if (instr == OP_NOP) { pc += 4; return true; }
+  if (instr == OP_HALT) return 0;
+  if (instr == OP_NOP) { pc += 4; return 1; }
 
   u32 op6  = get(instr,31,26);
   u32 op8  = get(instr,31,24);
@@ -49,12 +155,15 @@ bool CPU::step(Memory& mem) {
   // B / BL
   if (op6 == OP_B || op6 == OP_BL) {
     i64 imm = sext(get(instr,25,0), 26);
+    u64 target = pc + 4ull * (u64)imm;
     if (op6 == OP_BL) {
       // link register X30 stores return address (next PC)
       X[30] = pc + 4;
+      calls.push(target, pc + 4);
+      if (callProfiler) callProfiler->onCall(target, perf.instret + 1);
     }
-    pc = pc + 4ull * (u64)imm;
-    return true;
+    pc = target;
+    return 1;
   }
 
   // CBZ / CBNZ
@@ -63,37 +172,43 @@ bool CPU::step(Memory& mem) {
     int rt = (int)get(instr,4,0);
     u64 v = X[rt];
     bool take = (op8 == OP_CBZ) ? (v == 0) : (v != 0);
+    if (coverage) coverage->branch(pc, take);
     if (take) pc = pc + 4ull * (u64)imm;
     else pc += 4;
-    return true;
+    return 1;
   }
 
   // B.cond (custom)
   if (op8 == OP_BCOND) {
-    u32 cond = get(instr,23,20);
+    u32 cond = get(instr,3,0);
     i64 imm = sext(get(instr,23,5), 19);
-    bool take = false;
-    if (cond == (u32)Cond::EQ) take = flags.Z;
-    else if (cond == (u32)Cond::NE) take = !flags.Z;
-    else if (cond == (u32)Cond::LT) take = flags.N;         // signed less-than after CMP (N==1)
-    else if (cond == (u32)Cond::GE) take = !flags.N;         // signed >= after CMP
+    bool take = flags.cond(cond); // flags are only computed here, on demand
+    if (coverage) coverage->branch(pc, take);
     if (take) pc = pc + 4ull * (u64)imm;
     else pc += 4;
-    return true;
+    return 1;
   }
 
-  // I-format ADDI/SUBI
-  if (op10 == OP_ADDI || op10 == OP_SUBI) {
+  // I-format ADDI/SUBI (+ flag-setting ADDIS/SUBIS)
+  if (op10 == OP_ADDI || op10 == OP_SUBI || op10 == OP_ADDIS || op10 == OP_SUBIS) {
     u32 imm12 = get(instr,21,10);
     int rn = (int)get(instr,9,5);
     int rd = (int)get(instr,4,0);
 
     u64 a = X[rn];
     u64 b = (u64)imm12;
-    u64 r = (op10 == OP_ADDI) ? add64(a, b) : (a - b);
-    X[rd] = r;
+    const bool isAdd = (op10 == OP_ADDI || op10 == OP_ADDIS);
+    if (op10 == OP_ADDIS) flags.setAdd(a, b);
+    else if (op10 == OP_SUBIS) flags.setSub(a, b);
+    X[rd] = isAdd ? add64(a, b) : sub64(a, b);
+    if (fuse && (op10 == OP_ADDI || op10 == OP_SUBI)) {
+      // Loop counter + CBZ/CBNZ
+      const u32 next = fusionPartner(mem, breakpoints);
+      const u32 nop8 = get(next,31,24);
+      if (nop8 == OP_CBZ || nop8 == OP_CBNZ) return fusedBranch(next, (X[get(next,4,0)] == 0) == (nop8 == OP_CBZ));
+    }
     pc += 4;
-    return true;
+    return 1;
   }
 
   // D-format LDUR/STUR
@@ -104,30 +219,39 @@ bool CPU::step(Memory& mem) {
 
     u64 ea = X[rn] + (i64)addr9;  // byte addr (must be aligned to 4 for word)
     if (op11 == OP_LDUR) {
-      u32 w = mem.loadWord(ea);
+      u32 w = mem.loadWord(ea, this);
       X[rt] = (u64)w;
+      if (fuse) {
+        // LDUR + an ADD of the loaded value
+        const u32 next = fusionPartner(mem, breakpoints);
+        const u32 nrm = get(next,20,16), nrn = get(next,9,5);
+        if (get(next,31,21) == OP_ADD && ((int)nrm == rt || (int)nrn == rt)) {
+          X[get(next,4,0)] = X[nrn] + X[nrm];
+          if (coverage) coverage->exec(pc + 4);
+          pc += 8;
+          perf.fusedPairs++;
+          return 2;
+        }
+      }
     } else {
-      mem.storeWord(ea, (u32)(X[rt] & 0xFFFFFFFFull));
+      mem.storeWord(ea, (u32)(X[rt] & 0xFFFFFFFFull), this);
     }
     pc += 4;
-    return true;
+    return 1;
   }
 
-  // R-format ADD/SUB
-  if (op11 == OP_ADD || op11 == OP_SUB) {
+  // R-format ADD/SUB (+ flag-setting ADDS/SUBS; plain ADD/SUB leave flags alone)
+  if (op11 == OP_ADD || op11 == OP_SUB || op11 == OP_ADDS || op11 == OP_SUBS) {
     int rm = (int)get(instr,20,16);
     int rn = (int)get(instr,9,5);
     int rd = (int)get(instr,4,0);
     u64 a = X[rn];
     u64 b = X[rm];
-    if (op11 == OP_ADD) X[rd] = add64(a, b);
-    else {
-      bool Z=false, N=false;
-      X[rd] = sub64(a, b, Z, N);
-      // SUB doesn't set flags in sheet; we leave flags unchanged.
-    }
+    if (op11 == OP_ADDS) flags.setAdd(a, b);
+    else if (op11 == OP_SUBS) flags.setSub(a, b);
+    X[rd] = (op11 == OP_ADD || op11 == OP_ADDS) ? add64(a, b) : sub64(a, b);
     pc += 4;
-    return true;
+    return 1;
   }
 
   // Custom XEXT
@@ -139,49 +263,131 @@ bool CPU::step(Memory& mem) {
     auto f = (XFunct)funct;
 
     if (f == XFunct::CMP) {
-      bool Z=false, N=false;
-      (void)sub64(X[rn], X[rm], Z, N);
-      flags.Z = Z;
-      flags.N = N;
+      flags.setSub(X[rn], X[rm]);
+      if (fuse) {
+        const u32 next = fusionPartner(mem, breakpoints);
+        if (get(next,31,24) == OP_BCOND) return fusedBranch(next, flags.cond(get(next,3,0)));
+      }
       pc += 4;
-      return true;
+      return 1;
     }
     if (f == XFunct::AND) {
       X[rd] = X[rn] & X[rm];
       pc += 4;
-      return true;
+      return 1;
     }
     if (f == XFunct::ORR) {
       X[rd] = X[rn] | X[rm];
       pc += 4;
-      return true;
+      return 1;
     }
     if (f == XFunct::EOR) {
       X[rd] = X[rn] ^ X[rm];
       pc += 4;
-      return true;
+      return 1;
     }
     if (f == XFunct::LSL) {
       u64 sh = (u64)rm;
       X[rd] = X[rn] << (sh & 63ull);
       pc += 4;
-      return true;
+      return 1;
     }
     if (f == XFunct::LSR) {
       u64 sh = (u64)rm;
       X[rd] = X[rn] >> (sh & 63ull);
       pc += 4;
-      return true;
+      return 1;
     }
     if (f == XFunct::MUL) {
       X[rd] = X[rn] * X[rm];
       pc += 4;
-      return true;
+      return 1;
     }
     if (f == XFunct::RET) {
+      const std::size_t popped = calls.pop(X[rn]);
+      if (callProfiler && popped) callProfiler->onReturn(popped, perf.instret + 1);
       pc = X[rn];
-      return true;
+      return 1;
+    }
+    if (f == XFunct::CAS) {
+      X[rm] = (u64)mem.compareExchangeWord(X[rn], (u32)X[rm], (u32)X[rd]);
+      pc += 4;
+      return 1;
+    }
+    if (f == XFunct::LDADD) {
+      X[rd] = (u64)mem.fetchAddWord(X[rn], (u32)X[rm]);
+      pc += 4;
+      return 1;
+    }
+    if (f == XFunct::HARTID) {
+      X[rd] = (u64)hartId;
+      pc += 4;
+      return 1;
+    }
+    if (f == XFunct::HCALL) {
+      if (!host) throw std::runtime_error("HCALL without a host interface.");
+      if (!host->call((u32)rm, *this, mem)) return 0; // EXIT: stays on the HCALL, like HALT
+      pc += 4;
+      return 1;
+    }
+    if (f == XFunct::ERET) {
+      if (!irq.inHandler) throw std::runtime_error("ERET outside an interrupt handler.");
+      irq.inHandler = false;
+      flags.set(irq.saved);
+      pc = irq.elr;
+      updateDeadline();
+      return 1;
+    }
+  }
+
+  // Vector extension
+  if (op11 == OP_VEXT) {
+    int rm = (int)get(instr,20,16);
+    u32 funct = get(instr,15,10);
+    int rn = (int)get(instr,9,5);
+    int rd = (int)get(instr,4,0);
+    const bool lanes64 = (funct & VLANES64) != 0;
+    auto f = (VFunct)(funct & 0x1F);
+
+    if (f <= VFunct::EOR) {
+      V[rd] = vec::apply((u32)f, lanes64, V[rn], V[rm]);
+      pc += 4;
+      return 1;
+    }
+    if (f == VFunct::LDR || f == VFunct::STR) {
+      u32 w[4];
+      if (f == VFunct::LDR) {
+        mem.loadWords(X[rn], w, 4);
+        std::memcpy(V[rd].d, w, sizeof w);
+      } else {
+        std::memcpy(w, V[rd].d, sizeof w);
+        mem.storeWords(X[rn], w, 4);
+      }
+      if (rm & 1) X[rn] += 16; // post-index
+      pc += 4;
+      return 1;
     }
+    if (f == VFunct::UMOV) {
+      X[rd] = lanes64 ? V[rn].d[rm & 1] : (u64)V[rn].lane32(rm & 3);
+      pc += 4;
+      return 1;
+    }
+    if (f == VFunct::DUP) {
+      if (lanes64) {
+        V[rd].d[0] = V[rd].d[1] = X[rn];
+      } else {
+        for (int i = 0; i < 4; i++) V[rd].setLane32(i, (u32)X[rn]);
+      }
+      pc += 4;
+      return 1;
+    }
+  }
+
+  // Byte, halfword, signed word and doubleword loads/stores
+  if (isSizedLoad(op11) || isSizedStore(op11)) {
+    execSized(mem, instr);
+    pc += 4;
+    return 1;
   }
 
   throw std::runtime_error("Unknown instruction word at PC.");
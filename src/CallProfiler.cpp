@@ -0,0 +1,102 @@
+#include "CallProfiler.h"
+#include <algorithm>
+#include <ostream>
+
+void CallProfiler::start(u64 entryPc, u64 instret) {
+  nodes.assign(1, Node{});
+  nodes[0].func = entryPc;
+  stack.clear();
+  funcs.clear();
+  active.clear();
+  mark = instret;
+  stack.push_back({entryPc, instret, 0});
+  funcs[entryPc].addr = entryPc;
+  active[entryPc] = 1;
+}
+
+void CallProfiler::charge(u64 instret) {
+  if (stack.empty() || instret <= mark) return;
+  const u64 n = instret - mark;
+  nodes[stack.back().node].exclusive += n;
+  funcs[stack.back().func].exclusive += n;
+  mark = instret;
+}
+
+void CallProfiler::push(u64 func, u64 instret) {
+  std::size_t parent = stack.back().node;
+  auto it = nodes[parent].children.find(func);
+  std::size_t node;
+  if (it != nodes[parent].children.end()) {
+    node = it->second;
+  } else {
+    node = nodes.size();
+    nodes[parent].children.emplace(func, node);
+    Node n;
+    n.func = func;
+    n.parent = parent;
+    nodes.push_back(std::move(n));
+  }
+  stack.push_back({func, instret, node});
+  auto& f = funcs[func];
+  f.addr = func;
+  f.calls++;
+  active[func]++;
+}
+
+void CallProfiler::pop(u64 instret) {
+  const Frame fr = stack.back();
+  stack.pop_back();
+  if (--active[fr.func] == 0) funcs[fr.func].inclusive += instret - fr.enterInstret;
+}
+
+void CallProfiler::onCall(u64 target, u64 instret) {
+  if (stack.empty()) return;
+  charge(instret); // the BL belongs to the caller
+  push(target, instret);
+}
+
+void CallProfiler::onReturn(std::size_t frames, u64 instret) {
+  // Frames from before 'profile start' are not ours; the root stays.
+  if (stack.size() < 2) return;
+  charge(instret); // the RET belongs to the callee
+  for (; frames > 0 && stack.size() > 1; frames--) pop(instret);
+}
+
+std::vector<CallProfiler::FunctionStats> CallProfiler::functions(u64 instret) {
+  charge(instret);
+  auto live = funcs;
+  // Outermost live activation of each function: add its time so far.
+  std::unordered_map<u64, bool> seen;
+  for (auto& fr : stack) {
+    if (seen[fr.func]) continue;
+    seen[fr.func] = true;
+    live[fr.func].inclusive += mark - fr.enterInstret;
+  }
+  std::vector<FunctionStats> out;
+  out.reserve(live.size());
+  for (auto& [addr, f] : live) out.push_back(f);
+  std::sort(out.begin(), out.end(), [](const FunctionStats& a, const FunctionStats& b) {
+    if (a.inclusive != b.inclusive) return a.inclusive > b.inclusive;
+    return a.addr < b.addr;
+  });
+  return out;
+}
+
+void CallProfiler::writeFolded(std::ostream& out, u64 instret, const Namer& name) {
+  charge(instret);
+  if (nodes.empty()) return;
+  // Depth-first over the context tree, keeping the path as text.
+  std::vector<std::pair<std::size_t, std::size_t>> work{{0, 0}}; // node, path length before it
+  std::string path;
+  while (!work.empty()) {
+    auto [n, len] = work.back();
+    work.pop_back();
+    path.resize(len);
+    if (len) path += ';';
+    path += name(nodes[n].func);
+    if (nodes[n].exclusive) out << path << " " << nodes[n].exclusive << "\n";
+    std::vector<std::pair<u64, std::size_t>> kids(nodes[n].children.begin(), nodes[n].children.end());
+    std::sort(kids.rbegin(), kids.rend()); // pushed in reverse: visited by address
+    for (auto& k : kids) work.push_back({k.second, path.size()});
+  }
+}
@@ -0,0 +1,365 @@
+#include "Checkpoint.h"
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr char kMagic[8] = {'A', 'R', 'M', 'C', 'K', 'P', 'T', '\0'};
+static constexpr std::size_t kChunkBytes = 1 << 20;  // file I/O granularity
+static constexpr u64 kEndOfPages = ~0ull;
+static constexpr u64 kMaxWords = 1ull << 32;          // 16 GB, the simulator's memory limit
+static constexpr u64 kMaxHarts = 4096;
+
+namespace {
+
+u64 loadLE64(const unsigned char* p) {
+  u64 v;
+  std::memcpy(&v, p, 8);
+  if constexpr (std::endian::native == std::endian::big) v = __builtin_bswap64(v);
+  return v;
+}
+
+void storeLE(unsigned char* p, u64 v, int bytes) {
+  for (int i = 0; i < bytes; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+// Multiply-rotate hash over 8-byte words; fed in pieces of any size, so
+// the writer and reader may split the stream differently.
+class Hasher {
+public:
+  void update(const unsigned char* p, std::size_t n) {
+    total += n;
+    while (n && used) {
+      pending[used++] = *p++;
+      n--;
+      if (used == 8) { mix(loadLE64(pending)); used = 0; }
+    }
+    for (; n >= 8; p += 8, n -= 8) mix(loadLE64(p));
+    while (n--) pending[used++] = *p++;
+  }
+
+  u64 digest() const {
+    unsigned char tail[8] = {};
+    std::memcpy(tail, pending, used);
+    u64 h = state;
+    h = std::rotl(h ^ loadLE64(tail), 31) * kMul;
+    h = std::rotl(h ^ total, 31) * kMul;
+    return h ^ (h >> 29);
+  }
+
+private:
+  static constexpr u64 kMul = 0x9E3779B97F4A7C15ull;
+  u64 state = 0x243F6A8885A308D3ull;
+  u64 total = 0;
+  unsigned char pending[8] = {};
+  std::size_t used = 0;
+
+  void mix(u64 w) { state = std::rotl(state ^ w, 31) * kMul; }
+};
+
+class Writer {
+public:
+  explicit Writer(int fd_): fd(fd_) { buf.reserve(kChunkBytes + 64); }
+
+  void bytes(const void* p, std::size_t n) {
+    auto c = static_cast<const unsigned char*>(p);
+    hash.update(c, n);
+    while (n) {
+      const std::size_t k = std::min(n, kChunkBytes - buf.size());
+      buf.insert(buf.end(), c, c + k);
+      c += k;
+      n -= k;
+      if (buf.size() == kChunkBytes) flush();
+    }
+  }
+  void num(u64 v, int width = 8) {
+    unsigned char b[8];
+    storeLE(b, v, width);
+    bytes(b, (std::size_t)width);
+  }
+  void str(const std::string& s) {
+    num(s.size());
+    bytes(s.data(), s.size());
+  }
+
+  // Appends the checksum (not itself hashed) and writes everything out.
+  u64 finish() {
+    unsigned char b[8];
+    storeLE(b, hash.digest(), 8);
+    buf.insert(buf.end(), b, b + 8);
+    flush();
+    return written;
+  }
+
+private:
+  int fd;
+  std::vector<unsigned char> buf;
+  Hasher hash;
+  u64 written = 0;
+
+  void flush() {
+    const unsigned char* p = buf.data();
+    std::size_t n = buf.size();
+    while (n) {
+      const ssize_t k = ::write(fd, p, n);
+      if (k < 0 && errno == EINTR) continue;
+      if (k <= 0) throw std::runtime_error(std::string("Checkpoint write failed: ") + std::strerror(errno));
+      p += k;
+      n -= (std::size_t)k;
+      written += (u64)k;
+    }
+    buf.clear();
+  }
+};
+
+class Reader {
+public:
+  Reader(std::istream& in_, const std::string& path_): in(in_), path(path_) {}
+
+  void bytes(void* p, std::size_t n) {
+    if (!in.read(static_cast<char*>(p), (std::streamsize)n)) throw std::runtime_error("Checkpoint truncated: " + path);
+  }
+  u64 num(int width = 8) {
+    unsigned char b[8] = {};
+    bytes(b, (std::size_t)width);
+    return loadLE64(b);
+  }
+  std::string str(u64 limit) {
+    const u64 n = num();
+    if (n > limit) throw std::runtime_error("Checkpoint corrupt: " + path);
+    std::string s(n, '\0');
+    bytes(s.data(), n);
+    return s;
+  }
+
+private:
+  std::istream& in;
+  const std::string& path;
+};
+
+// Checks magic and version, then the trailing checksum against the rest
+// of the file.
+void verify(const std::string& path) {
+  std::ifstream in(path, std::ios::binary | std::ios::ate);
+  if (!in) throw std::runtime_error("Cannot open file: " + path);
+  const u64 size = (u64)in.tellg();
+  if (size < sizeof kMagic + 16) throw std::runtime_error("Not a checkpoint: " + path);
+  in.seekg(0);
+  std::vector<unsigned char> buf(kChunkBytes);
+  Hasher hash;
+  u64 left = size - 8;
+  while (left) {
+    const std::size_t k = (std::size_t)std::min<u64>(left, buf.size());
+    if (!in.read(reinterpret_cast<char*>(buf.data()), (std::streamsize)k))
+      throw std::runtime_error("Cannot read file: " + path);
+    if (left == size - 8) {
+      if (std::memcmp(buf.data(), kMagic, sizeof kMagic) != 0) throw std::runtime_error("Not a checkpoint: " + path);
+      const u64 version = loadLE64(buf.data() + 8) & 0xFFFFFFFFu;
+      if (version != Checkpoint::kVersion) {
+        throw std::runtime_error("Checkpoint version " + std::to_string(version) + " not supported (expected " +
+                                 std::to_string(Checkpoint::kVersion) + "): " + path);
+      }
+    }
+    hash.update(buf.data(), k);
+    left -= k;
+  }
+  unsigned char b[8];
+  if (!in.read(reinterpret_cast<char*>(b), 8)) throw std::runtime_error("Cannot read file: " + path);
+  if (loadLE64(b) != hash.digest()) throw std::runtime_error("Checkpoint checksum mismatch (file damaged): " + path);
+}
+
+u64 nzcvBits(const Flags& f) { return (u64)f.N << 3 | (u64)f.Z << 2 | (u64)f.C << 1 | (u64)f.V; }
+Flags nzcvFlags(u64 b) { return {(b & 8) != 0, (b & 4) != 0, (b & 2) != 0, (b & 1) != 0}; }
+
+std::string directoryOf(const std::string& path) {
+  const auto slash = path.find_last_of('/');
+  return slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+}
+
+} // namespace
+
+Checkpoint::Hart Checkpoint::capture(const CPU& cpu) {
+  Hart h;
+  for (int i = 0; i < 32; i++) {
+    h.x[i] = cpu.getX(i);
+    h.v[i] = cpu.getV(i);
+  }
+  h.pc = cpu.getPC();
+  h.flags = cpu.getFlags();
+  h.calls = cpu.getCallStack();
+  h.instret = cpu.counters().instret;
+  h.irq = cpu.getInterrupts();
+  return h;
+}
+
+void Checkpoint::apply(const Hart& h, CPU& cpu) {
+  for (int i = 0; i < 32; i++) {
+    cpu.setX(i, h.x[i]);
+    cpu.setV(i, h.v[i]);
+  }
+  cpu.setPC(h.pc);
+  cpu.setFlags(h.flags);
+  cpu.setCallStack(h.calls);
+  cpu.counters().instret = h.instret;
+  cpu.setInterrupts(h.irq);
+}
+
+Checkpoint::SaveResult Checkpoint::save(const std::string& path, const Memory& mem) const {
+  const std::string tmp = path + ".tmp";
+  const int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) throw std::runtime_error("Cannot write file: " + tmp);
+  SaveResult r;
+  try {
+    Writer w(fd);
+    w.bytes(kMagic, sizeof kMagic);
+    w.num(kVersion, 4);
+    w.num(0, 4);
+    w.num(mem.sizeWords());
+    w.num(kPageWords);
+    w.num(harts.size());
+    w.num(curHart);
+    w.str(title);
+    for (const auto& h : harts) {
+      for (u64 x : h.x) w.num(x);
+      for (const auto& v : h.v) { w.num(v.d[0]); w.num(v.d[1]); }
+      w.num(h.pc);
+      w.num(nzcvBits(h.flags), 1);
+      w.num(h.instret);
+      w.num(h.irq.at);
+      w.num(h.irq.period);
+      w.num(h.irq.interval);
+      w.num(h.irq.vector);
+      w.num(h.irq.elr);
+      w.num(nzcvBits(h.irq.saved), 1);
+      w.num(h.irq.inHandler, 1);
+      w.num(h.irq.taken);
+      w.num(h.calls.get().size());
+      for (const auto& f : h.calls.get()) {
+        w.num(f.func);
+        w.num(f.returnAddr);
+      }
+      w.num(h.calls.untrackedCalls());
+    }
+    w.num(breakpoints.size());
+    for (const auto& b : breakpoints) {
+      w.num(b.addr);
+      w.num(b.ignore);
+      w.num(b.hits);
+      w.str(b.cond);
+    }
+
+    std::vector<u32> page(kPageWords);
+    unsigned char le[kPageWords * 4];
+    for (u64 first = 0; first < mem.sizeWords(); first += kPageWords) {
+      const std::size_t n = (std::size_t)std::min<u64>(kPageWords, mem.sizeWords() - first);
+      mem.loadWords(first * 4, page.data(), n);
+      if (std::all_of(page.begin(), page.begin() + (long)n, [](u32 v) { return v == 0; })) continue;
+      w.num(first / kPageWords);
+      if constexpr (std::endian::native == std::endian::little) {
+        w.bytes(page.data(), n * 4);
+      } else {
+        for (std::size_t i = 0; i < n; i++) storeLE(le + 4 * i, page[i], 4);
+        w.bytes(le, n * 4);
+      }
+      r.pages++;
+    }
+    w.num(kEndOfPages);
+    r.bytes = w.finish();
+    if (::fsync(fd) != 0) throw std::runtime_error(std::string("Checkpoint sync failed: ") + std::strerror(errno));
+  } catch (...) {
+    ::close(fd);
+    ::unlink(tmp.c_str());
+    throw;
+  }
+  ::close(fd);
+  if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+    ::unlink(tmp.c_str());
+    throw std::runtime_error("Cannot replace file: " + path);
+  }
+  // Make the rename itself durable.
+  const int dir = ::open(directoryOf(path).c_str(), O_RDONLY);
+  if (dir >= 0) {
+    ::fsync(dir);
+    ::close(dir);
+  }
+  return r;
+}
+
+Checkpoint Checkpoint::load(const std::string& path, Memory& mem) {
+  verify(path);
+  std::ifstream in(path, std::ios::binary);
+  if (!in) throw std::runtime_error("Cannot open file: " + path);
+  Reader r(in, path);
+  auto corrupt = [&] { return std::runtime_error("Checkpoint corrupt: " + path); };
+
+  unsigned char header[16]; // magic, version and reserved word, checked by verify()
+  r.bytes(header, sizeof header);
+  const u64 memWords = r.num(), pageWords = r.num(), nHarts = r.num();
+  Checkpoint c;
+  c.curHart = r.num();
+  if (memWords == 0 || memWords > kMaxWords || pageWords != kPageWords || nHarts == 0 || nHarts > kMaxHarts ||
+      c.curHart >= nHarts) throw corrupt();
+  c.title = r.str(1 << 20);
+  c.harts.resize(nHarts);
+  for (auto& h : c.harts) {
+    for (auto& x : h.x) x = r.num();
+    for (auto& v : h.v) { v.d[0] = r.num(); v.d[1] = r.num(); }
+    h.pc = r.num();
+    h.flags = nzcvFlags(r.num(1));
+    h.instret = r.num();
+    h.irq.at = r.num();
+    h.irq.period = r.num();
+    h.irq.interval = r.num();
+    h.irq.vector = r.num();
+    h.irq.elr = r.num();
+    h.irq.saved = nzcvFlags(r.num(1));
+    h.irq.inHandler = r.num(1) != 0;
+    h.irq.taken = r.num();
+    const u64 nFrames = r.num();
+    if (nFrames == 0 || nFrames > CallStack::kMaxDepth) throw corrupt();
+    std::vector<CallStack::Frame> frames(nFrames);
+    for (auto& f : frames) {
+      f.func = r.num();
+      f.returnAddr = r.num();
+    }
+    const u64 untracked = r.num();
+    if (untracked && nFrames != CallStack::kMaxDepth) throw corrupt();
+    h.calls.assign(std::move(frames), untracked);
+  }
+  const u64 nBreaks = r.num();
+  if (nBreaks > memWords) throw corrupt();
+  c.breakpoints.resize(nBreaks);
+  for (auto& b : c.breakpoints) {
+    b.addr = r.num();
+    b.ignore = r.num();
+    b.hits = r.num();
+    b.cond = r.str(1 << 20);
+  }
+
+  // The file checked out; from here on the machine is replaced.
+  if (mem.sizeWords() != memWords) mem.resize((std::size_t)memWords);
+  mem.clear();
+  std::vector<u32> page(kPageWords);
+  unsigned char le[kPageWords * 4];
+  for (;;) {
+    const u64 index = r.num();
+    if (index == kEndOfPages) break;
+    if (index >= (memWords + kPageWords - 1) / kPageWords) throw corrupt();
+    const u64 first = index * kPageWords;
+    const std::size_t n = (std::size_t)std::min<u64>(kPageWords, memWords - first);
+    r.bytes(le, n * 4);
+    for (std::size_t i = 0; i < n; i++) {
+      u32 v;
+      std::memcpy(&v, le + 4 * i, 4);
+      if constexpr (std::endian::native == std::endian::big) v = __builtin_bswap32(v);
+      page[i] = v;
+    }
+    mem.storeWords(first * 4, page.data(), n);
+  }
+  return c;
+}
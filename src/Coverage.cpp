@@ -0,0 +1,92 @@
+#include "Coverage.h"
+#include "Assembler.h"
+#include "Encoding.h"
+#include <iomanip>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+
+static bool isCondBranch(u32 w) {
+  u32 op8 = enc::get(w, 31, 24);
+  return op8 == enc::OP_CBZ || op8 == enc::OP_CBNZ || op8 == enc::OP_BCOND;
+}
+
+void Coverage::merge(const Coverage& other) {
+  if (other.bits.size() > bits.size()) bits.resize(other.bits.size(), 0);
+  for (std::size_t i = 0; i < other.bits.size(); i++) bits[i] |= other.bits[i];
+}
+
+void Coverage::relocate(const std::function<u64(u64)>& newAddr) {
+  std::vector<u8> moved(bits.size(), 0);
+  for (std::size_t i = 0; i < bits.size(); i++) {
+    if (!bits[i]) continue;
+    const u64 a = newAddr(4 * (u64)i);
+    if (a != ~0ull && a / 4 < moved.size()) moved[a / 4] |= bits[i];
+  }
+  bits.swap(moved);
+}
+
+void Coverage::save(std::ostream& out) const {
+  out << "; arm coverage: byte address, flags (1 executed, 2 taken, 4 fall-through)\n";
+  for (std::size_t i = 0; i < bits.size(); i++) {
+    if (!bits[i]) continue;
+    out << "0x" << std::hex << std::uppercase << std::setw(8) << std::setfill('0') << 4 * (u64)i
+        << std::dec << " " << (int)bits[i] << "\n";
+  }
+}
+
+void Coverage::mergeFile(std::istream& in) {
+  std::string line;
+  std::size_t lineNo = 0;
+  while (std::getline(in, line)) {
+    lineNo++;
+    auto semi = line.find(';');
+    if (semi != std::string::npos) line.resize(semi);
+    std::istringstream iss(line);
+    std::string addrTok;
+    unsigned flags = 0;
+    if (!(iss >> addrTok)) continue;
+    if (!(iss >> flags) || flags > 7) throw std::runtime_error("Bad coverage line " + std::to_string(lineNo));
+    std::size_t i = Memory::addrToIndex(std::stoull(addrTok, nullptr, 0));
+    if (i >= bits.size()) bits.resize(i + 1, 0);
+    bits[i] |= (u8)flags;
+  }
+}
+
+void Coverage::report(std::ostream& out, const Memory& mem, std::size_t endWord,
+                      const std::function<bool(u64)>& isCode,
+                      const std::function<std::string(u64)>& where) const {
+  std::size_t instrs = 0, executed = 0, branches = 0, both = 0, oneWay = 0;
+  for (std::size_t i = 0; i < endWord && i < mem.sizeWords(); i++) {
+    const u32 w = mem.getWordIndex(i);
+    const u8 c = at(i);
+    const u64 addr = 4 * (u64)i;
+    if (!c && !isCode(addr)) continue;
+    instrs++;
+    if (c & kExec) executed++;
+    std::string dirs;
+    if (isCondBranch(w)) {
+      branches++;
+      const bool t = c & kTaken, f = c & kFallthrough;
+      if (t && f) both++;
+      else if (t || f) oneWay++;
+      dirs = t && f ? "taken, fall-through" : t ? "taken only" : f ? "fall-through only" : "never";
+    }
+    std::ostringstream lineOut;
+    lineOut << ((c & kExec) ? "     " : "#### ") << std::setw(8) << addr << ": "
+            << std::left << std::setw(28) << Assembler::disasm(w, addr) << std::right;
+    if (!dirs.empty()) lineOut << " [" << dirs << "]";
+    lineOut << where(addr);
+    auto text = lineOut.str();
+    text.erase(text.find_last_not_of(' ') + 1);
+    out << text << "\n";
+  }
+  auto pct = [](std::size_t a, std::size_t b) { return b ? 100.0 * (double)a / (double)b : 0.0; };
+  out << std::fixed << std::setprecision(1);
+  out << "instructions: " << executed << "/" << instrs << " executed (" << pct(executed, instrs) << "%)\n";
+  out << "branches:     " << both << "/" << branches << " both directions (" << pct(both, branches) << "%), "
+      << oneWay << " one direction, " << (branches - both - oneWay) << " never reached\n";
+  out.unsetf(std::ios::floatfield);
+  out << std::setprecision(6);
+}
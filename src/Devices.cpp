@@ -0,0 +1,75 @@
+#include "Devices.h"
+#include "CPU.h"
+#include <sstream>
+#include <stdexcept>
+
+static std::runtime_error noRegister(const char* dev, u64 offset) {
+  std::ostringstream oss;
+  oss << "The " << dev << " has no register at +0x" << std::hex << offset << ".";
+  return std::runtime_error(oss.str());
+}
+
+Uart::Uart(Sink s): sink(std::move(s)) {}
+
+void Uart::drain() {
+  if (fill == 0) return;
+  sink(fifo.data(), fill);
+  sent += fill;
+  fill = 0;
+}
+
+u32 Uart::read(CPU*, u64 offset) {
+  std::lock_guard<std::mutex> g(lock);
+  if (offset == 0x0) return 0;
+  if (offset == 0x4) return 1u | (u32)fill << 8;
+  throw noRegister("uart", offset);
+}
+
+void Uart::write(CPU*, u64 offset, u32 value) {
+  if (offset != 0x0) throw noRegister("uart", offset);
+  std::lock_guard<std::mutex> g(lock);
+  const char c = (char)(value & 0xFF);
+  fifo[fill++] = c;
+  if (fill == kFifoBytes || c == '\n') drain();
+}
+
+void Uart::flush() {
+  std::lock_guard<std::mutex> g(lock);
+  drain();
+}
+
+std::string Uart::status() const {
+  std::lock_guard<std::mutex> g(lock);
+  return std::to_string(sent) + " bytes sent, " + std::to_string(fill) + " in the TX FIFO";
+}
+
+CPU& Timer::accessing(CPU* hart) {
+  if (!hart) throw std::runtime_error("The timer is only accessible from a hart.");
+  return *hart;
+}
+
+u32 Timer::read(CPU* hart, u64 offset) {
+  CPU& cpu = accessing(hart);
+  const Interrupts& irq = cpu.getInterrupts();
+  switch (offset) {
+    case 0x00: return (u32)cpu.counters().instret;
+    case 0x04: return (u32)(cpu.counters().instret >> 32);
+    case 0x08: return (irq.at != Interrupts::kNever ? 1u : 0u) | (irq.period ? 2u : 0u);
+    case 0x0C: return (u32)irq.interval;
+    case 0x10: return (u32)irq.vector;
+    case 0x14: return (u32)irq.taken;
+  }
+  throw noRegister("timer", offset);
+}
+
+void Timer::write(CPU* hart, u64 offset, u32 value) {
+  CPU& cpu = accessing(hart);
+  Interrupts irq = cpu.getInterrupts();
+  switch (offset) {
+    case 0x08: cpu.armTimer((value & 1) != 0, (value & 2) != 0); return;
+    case 0x0C: irq.interval = value; break;
+    case 0x10: irq.vector = value; break;
+    default: throw noRegister("timer", offset);
+  }
+  cpu.setInterrupts(irq);
+}
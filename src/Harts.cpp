@@ -0,0 +1,65 @@
+#include "Harts.h"
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+
+std::vector<StopReason> Harts::runParallel(std::vector<CPU>& cpus, Memory& mem, u64 maxStepsPerHart) {
+  std::vector<StopReason> reasons(cpus.size(), StopReason::StepLimit);
+  std::vector<std::exception_ptr> faults(cpus.size());
+
+  auto body = [&](std::size_t i) {
+    try {
+      reasons[i] = cpus[i].run(mem, maxStepsPerHart);
+    } catch (...) {
+      faults[i] = std::current_exception();
+    }
+  };
+
+  // Hart 0 runs on the calling thread; the rest get one host thread each.
+  std::vector<std::thread> threads;
+  threads.reserve(cpus.size());
+  for (std::size_t i = 1; i < cpus.size(); i++) threads.emplace_back(body, i);
+  if (!cpus.empty()) body(0);
+  for (auto& t : threads) t.join();
+
+  for (auto& f : faults) {
+    if (f) std::rethrow_exception(f);
+  }
+  return reasons;
+}
+
+std::vector<StopReason> Harts::runRoundRobin(std::vector<CPU>& cpus, Memory& mem, u64 quantum,
+                                             u64 maxStepsPerHart,
+                                             Breakpoints* breakpoints,
+                                             std::size_t& stoppedHart) {
+  if (quantum == 0) throw std::runtime_error("Round-robin quantum must be at least 1.");
+  std::vector<StopReason> reasons(cpus.size(), StopReason::StepLimit);
+  std::vector<u64> executed(cpus.size(), 0);
+  std::vector<bool> halted(cpus.size(), false);
+  stoppedHart = cpus.size();
+
+  bool progress = true;
+  while (progress) {
+    progress = false;
+    for (std::size_t i = 0; i < cpus.size(); i++) {
+      if (halted[i] || executed[i] >= maxStepsPerHart) continue;
+      auto& c = cpus[i];
+      const u64 before = c.counters().instret;
+      const u64 slice = std::min(quantum, maxStepsPerHart - executed[i]);
+      StopReason r = c.run(mem, slice, breakpoints);
+      executed[i] += c.counters().instret - before;
+      progress = true;
+
+      if (r == StopReason::Halt) {
+        halted[i] = true;
+        reasons[i] = StopReason::Halt;
+      } else if (r == StopReason::Breakpoint) {
+        reasons[i] = StopReason::Breakpoint;
+        stoppedHart = i;
+        return reasons;
+      }
+    }
+  }
+  return reasons;
+}
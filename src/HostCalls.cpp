@@ -0,0 +1,96 @@
+#include "HostCalls.h"
+#include "CPU.h"
+#include "Memory.h"
+#include <chrono>
+#include <stdexcept>
+#include <string>
+
+HostCalls::HostCalls(Sink s, Source src): sink(std::move(s)), source(std::move(src)) {
+  out.reserve(kBufferBytes);
+}
+
+// Throws unless [addr, addr+n) lies in guest memory.
+static void requireRange(const Memory& mem, u64 addr, u64 n) {
+  const u64 size = (u64)mem.sizeWords() * 4;
+  if (addr > size || n > size - addr) throw std::runtime_error("HCALL buffer out of range.");
+}
+
+static void readBytes(const Memory& mem, u64 addr, char* dst, std::size_t n) {
+  for (std::size_t i = 0; i < n; i++) dst[i] = (char)mem.loadByte(addr + i);
+}
+
+static void writeBytes(Memory& mem, u64 addr, const char* src, std::size_t n) {
+  for (std::size_t i = 0; i < n; i++) mem.storeByte(addr + i, (u8)src[i]);
+}
+
+void HostCalls::write(int fd, const char* data, std::size_t n) {
+  if (fd == 2) {
+    if (!out.empty()) sink(1, out.data(), out.size());
+    out.clear();
+    sink(2, data, n);
+    return;
+  }
+  if (out.size() + n > kBufferBytes) {
+    if (!out.empty()) sink(1, out.data(), out.size());
+    out.clear();
+    if (n >= kBufferBytes) { sink(1, data, n); return; }
+  }
+  out.insert(out.end(), data, data + n);
+}
+
+bool HostCalls::call(u32 service, CPU& cpu, Memory& mem) {
+  std::lock_guard<std::mutex> g(lock);
+  switch (service) {
+    case Write: {
+      const u64 fd = cpu.getX(0), buf = cpu.getX(1), len = cpu.getX(2);
+      if (fd != 1 && fd != 2) throw std::runtime_error("HCALL WRITE: fd must be 1 or 2.");
+      requireRange(mem, buf, len);
+      scratch.resize(len);
+      readBytes(mem, buf, scratch.data(), len);
+      write((int)fd, scratch.data(), len);
+      cpu.setX(0, len);
+      return true;
+    }
+    case Read: {
+      const u64 fd = cpu.getX(0), buf = cpu.getX(1), len = cpu.getX(2);
+      if (fd != 0) throw std::runtime_error("HCALL READ: fd must be 0.");
+      requireRange(mem, buf, len);
+      // Whatever the guest printed (a prompt, say) should be visible first.
+      if (!out.empty()) sink(1, out.data(), out.size());
+      out.clear();
+      scratch.resize(len);
+      const std::size_t got = len && source ? source(scratch.data(), len) : 0;
+      writeBytes(mem, buf, scratch.data(), got);
+      cpu.setX(0, got);
+      return true;
+    }
+    case Exit:
+      hasExited = true;
+      code = (i64)cpu.getX(0);
+      return false;
+    case InstrCount:
+      cpu.setX(0, cpu.counters().instret);
+      return true;
+    case Time: {
+      if (clock) {
+        cpu.setX(0, clock());
+        return true;
+      }
+      auto t = std::chrono::steady_clock::now().time_since_epoch();
+      cpu.setX(0, (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(t).count());
+      return true;
+    }
+  }
+  throw std::runtime_error("HCALL: unknown service " + std::to_string(service) + ".");
+}
+
+void HostCalls::output(const char* data, std::size_t n) {
+  std::lock_guard<std::mutex> g(lock);
+  write(1, data, n);
+}
+
+void HostCalls::flush() {
+  std::lock_guard<std::mutex> g(lock);
+  if (!out.empty()) sink(1, out.data(), out.size());
+  out.clear();
+}
@@ -1,11 +1,94 @@
 #include "Memory.h"
-#include <sstream>
-#include <iomanip>
+#include "Devices.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+#include <istream>
+#include <new>
+#include <ostream>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#define MEMORY_USE_MMAP 1
+#endif
 
-Memory::Memory(std::size_t nWords): words(nWords, 0) {}
+// The words are kept in host order, so byte views need a little-endian host.
+static_assert(std::endian::native == std::endian::little, "guest memory assumes a little-endian host");
+
+static constexpr std::size_t kPageBytes = 4096;
+static constexpr std::size_t kHugePageBytes = 2 * 1024 * 1024;
+// Below this, clear() just zeroes the words; above, it releases the pages.
+static constexpr std::size_t kLazyClearBytes = 1024 * 1024;
+
+static std::size_t roundUp(std::size_t v, std::size_t to) { return (v + to - 1) / to * to; }
+
+static std::size_t mappingBytes(std::size_t nWords) {
+  std::size_t bytes = std::max<std::size_t>(nWords * 4, 1);
+  return roundUp(bytes, bytes >= kHugePageBytes ? kHugePageBytes : kPageBytes);
+}
+
+// Returns 'bytes' of zeroed memory, aligned to 2 MB when it is that big.
+static u32* mapWords(std::size_t bytes) {
+#ifdef MEMORY_USE_MMAP
+  const std::size_t align = bytes >= kHugePageBytes ? kHugePageBytes : kPageBytes;
+  const std::size_t slack = align > kPageBytes ? align : 0;
+  void* p = mmap(nullptr, bytes + slack, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) throw std::bad_alloc();
+  auto* raw = static_cast<char*>(p);
+  auto* base = reinterpret_cast<char*>(roundUp(reinterpret_cast<std::uintptr_t>(raw), align));
+  // Give back the unaligned head and the unused tail of the over-allocation.
+  if (base > raw) munmap(raw, (std::size_t)(base - raw));
+  if (raw + slack > base) munmap(base + bytes, (std::size_t)(raw + slack - base));
+#ifdef MADV_HUGEPAGE
+  if (align == kHugePageBytes) madvise(base, bytes, MADV_HUGEPAGE); // a hint; failure is harmless
+#endif
+  return reinterpret_cast<u32*>(base);
+#else
+  void* p = std::aligned_alloc(kPageBytes, bytes);
+  if (!p) throw std::bad_alloc();
+  std::memset(p, 0, bytes);
+  return static_cast<u32*>(p);
+#endif
+}
+
+static void unmapWords(u32* p, std::size_t bytes) {
+  if (!p) return;
+#ifdef MEMORY_USE_MMAP
+  munmap(p, bytes);
+#else
+  (void)bytes;
+  std::free(p);
+#endif
+}
+
+Memory::Memory(std::size_t n): nWords(n), mappedBytes(mappingBytes(n)) {
+  words = mapWords(mappedBytes);
+}
+
+Memory::~Memory() { unmapWords(words, mappedBytes); }
 
 void Memory::clear() {
-  std::fill(words.begin(), words.end(), 0u);
+#if defined(MEMORY_USE_MMAP) && defined(__linux__)
+  // Private anonymous pages read back as zero after MADV_DONTNEED.
+  if (mappedBytes >= kLazyClearBytes && madvise(words, mappedBytes, MADV_DONTNEED) == 0) return;
+#endif
+  std::memset(words, 0, nWords * 4);
+}
+
+void Memory::resize(std::size_t newWords) {
+  for (const auto& [base, dev] : devices) {
+    if (base < (u64)newWords * 4) {
+      throw std::runtime_error("Memory would overlap the " + std::string(dev->name()) + " device page.");
+    }
+  }
+  const std::size_t bytes = mappingBytes(newWords);
+  u32* fresh = mapWords(bytes);
+  std::memcpy(fresh, words, std::min(nWords, newWords) * 4);
+  unmapWords(words, mappedBytes);
+  words = fresh;
+  nWords = newWords;
+  mappedBytes = bytes;
 }
 
 void Memory::requireAligned4(u64 byteAddr) {
@@ -16,70 +99,242 @@ std::size_t Memory::addrToIndex(u64 byteAddr) {
   return static_cast<std::size_t>(byteAddr / 4);
 }
 
-u32 Memory::loadWord(u64 byteAddr) const {
+// atomic_ref needs a non-const object even for loads; the word is never modified through it.
+static std::atomic_ref<u32> atomicWord(const u32& w) {
+  return std::atomic_ref<u32>(const_cast<u32&>(w));
+}
+
+u32 Memory::loadWord(u64 byteAddr, CPU* hart) const {
   auto i = addrToIndex(byteAddr);
-  if (i >= words.size()) throw std::runtime_error("Memory read out of range.");
-  return words[i];
+  if (i >= nWords) {
+    if (Device* d = deviceAt(byteAddr)) return d->read(hart, byteAddr % kDevicePageBytes);
+    throw std::runtime_error("Memory read out of range.");
+  }
+  return atomicWord(words[i]).load(std::memory_order_relaxed);
+}
+
+void Memory::storeWord(u64 byteAddr, u32 value, CPU* hart) {
+  auto i = addrToIndex(byteAddr);
+  if (i >= nWords) {
+    if (Device* d = deviceAt(byteAddr)) return d->write(hart, byteAddr % kDevicePageBytes, value);
+    throw std::runtime_error("Memory write out of range.");
+  }
+  atomicWord(words[i]).store(value, std::memory_order_relaxed);
 }
 
-void Memory::storeWord(u64 byteAddr, u32 value) {
+u32 Memory::fetchWord(u64 byteAddr) const {
   auto i = addrToIndex(byteAddr);
-  if (i >= words.size()) throw std::runtime_error("Memory write out of range.");
-  words[i] = value;
+  if (i >= nWords) throw std::runtime_error("Memory read out of range.");
+  return atomicWord(words[i]).load(std::memory_order_relaxed);
+}
+
+Device* Memory::deviceAt(u64 byteAddr) const {
+  const u64 base = byteAddr - byteAddr % kDevicePageBytes;
+  for (const auto& [b, dev] : devices) {
+    if (b == base) return dev.get();
+  }
+  return nullptr;
+}
+
+void Memory::mapDevice(u64 byteAddr, std::shared_ptr<Device> device) {
+  if (byteAddr % kDevicePageBytes != 0) throw std::runtime_error("Device address must be a multiple of 4096.");
+  if (byteAddr < (u64)nWords * 4) throw std::runtime_error("Device address lies inside memory.");
+  if (Device* other = deviceAt(byteAddr); other && other != device.get()) {
+    throw std::runtime_error("The " + std::string(other->name()) + " device is already mapped there.");
+  }
+  unmapDevice(*device);
+  devices.emplace_back(byteAddr, std::move(device));
+}
+
+void Memory::unmapDevice(const Device& device) {
+  std::erase_if(devices, [&](const auto& e) { return e.second.get() == &device; });
+}
+
+bool Memory::deviceBase(const Device& device, u64& byteAddr) const {
+  for (const auto& [b, dev] : devices) {
+    if (dev.get() == &device) { byteAddr = b; return true; }
+  }
+  return false;
+}
+
+// The T at byte offset 'byteAddr' of the mapping, as an atomic.
+template <class T>
+static std::atomic_ref<T> atomicAt(const u32* words, u64 byteAddr) {
+  auto* base = reinterpret_cast<char*>(const_cast<u32*>(words));
+  return std::atomic_ref<T>(*reinterpret_cast<T*>(base + byteAddr));
+}
+
+static bool inRange(u64 byteAddr, u64 n, std::size_t nWords) {
+  const u64 size = (u64)nWords * 4;
+  return byteAddr < size && n <= size - byteAddr;
+}
+
+// Unaligned accesses: n bytes, least significant first.
+static u64 loadBytes(const u32* words, u64 byteAddr, int n) {
+  u64 v = 0;
+  for (int i = 0; i < n; i++) v |= (u64)atomicAt<u8>(words, byteAddr + i).load(std::memory_order_relaxed) << (8 * i);
+  return v;
+}
+
+static void storeBytes(u32* words, u64 byteAddr, u64 v, int n) {
+  for (int i = 0; i < n; i++) atomicAt<u8>(words, byteAddr + i).store((u8)(v >> (8 * i)), std::memory_order_relaxed);
+}
+
+u8 Memory::loadByte(u64 byteAddr) const {
+  if (!inRange(byteAddr, 1, nWords)) throw std::runtime_error("Memory read out of range.");
+  return atomicAt<u8>(words, byteAddr).load(std::memory_order_relaxed);
+}
+
+u16 Memory::loadHalf(u64 byteAddr) const {
+  if (!inRange(byteAddr, 2, nWords)) throw std::runtime_error("Memory read out of range.");
+  if (byteAddr % 2 != 0) return (u16)loadBytes(words, byteAddr, 2);
+  return atomicAt<u16>(words, byteAddr).load(std::memory_order_relaxed);
+}
+
+u64 Memory::loadDouble(u64 byteAddr) const {
+  if (!inRange(byteAddr, 8, nWords)) throw std::runtime_error("Memory read out of range.");
+  if (byteAddr % 8 != 0) return loadBytes(words, byteAddr, 8);
+  return atomicAt<u64>(words, byteAddr).load(std::memory_order_relaxed);
+}
+
+void Memory::storeByte(u64 byteAddr, u8 value) {
+  if (!inRange(byteAddr, 1, nWords)) throw std::runtime_error("Memory write out of range.");
+  atomicAt<u8>(words, byteAddr).store(value, std::memory_order_relaxed);
+}
+
+void Memory::storeHalf(u64 byteAddr, u16 value) {
+  if (!inRange(byteAddr, 2, nWords)) throw std::runtime_error("Memory write out of range.");
+  if (byteAddr % 2 != 0) storeBytes(words, byteAddr, value, 2);
+  else atomicAt<u16>(words, byteAddr).store(value, std::memory_order_relaxed);
+}
+
+void Memory::storeDouble(u64 byteAddr, u64 value) {
+  if (!inRange(byteAddr, 8, nWords)) throw std::runtime_error("Memory write out of range.");
+  if (byteAddr % 8 != 0) storeBytes(words, byteAddr, value, 8);
+  else atomicAt<u64>(words, byteAddr).store(value, std::memory_order_relaxed);
+}
+
+void Memory::loadWords(u64 byteAddr, u32* out, std::size_t n) const {
+  auto i = addrToIndex(byteAddr);
+  if (i > nWords || n > nWords - i) throw std::runtime_error("Memory read out of range.");
+  for (std::size_t k = 0; k < n; k++) out[k] = atomicWord(words[i + k]).load(std::memory_order_relaxed);
+}
+
+void Memory::storeWords(u64 byteAddr, const u32* in, std::size_t n) {
+  auto i = addrToIndex(byteAddr);
+  if (i > nWords || n > nWords - i) throw std::runtime_error("Memory write out of range.");
+  for (std::size_t k = 0; k < n; k++) atomicWord(words[i + k]).store(in[k], std::memory_order_relaxed);
+}
+
+u32 Memory::compareExchangeWord(u64 byteAddr, u32 expected, u32 desired) {
+  auto i = addrToIndex(byteAddr);
+  if (i >= nWords) throw std::runtime_error("Memory write out of range.");
+  atomicWord(words[i]).compare_exchange_strong(expected, desired, std::memory_order_seq_cst);
+  return expected; // holds the previous value whether or not the swap happened
+}
+
+u32 Memory::fetchAddWord(u64 byteAddr, u32 delta) {
+  auto i = addrToIndex(byteAddr);
+  if (i >= nWords) throw std::runtime_error("Memory write out of range.");
+  return atomicWord(words[i]).fetch_add(delta, std::memory_order_seq_cst);
 }
 
 u32 Memory::getWordIndex(std::size_t i) const {
-  if (i >= words.size()) throw std::runtime_error("Memory index out of range.");
+  if (i >= nWords) throw std::runtime_error("Memory index out of range.");
   return words[i];
 }
 
 void Memory::setWordIndex(std::size_t i, u32 v) {
-  if (i >= words.size()) throw std::runtime_error("Memory index out of range.");
+  if (i >= nWords) throw std::runtime_error("Memory index out of range.");
   words[i] = v;
 }
 
-static bool parseHexWord(const std::string& s, u32& out) {
-  std::string t = s;
-  // strip comments
-  auto pos = t.find_first_of(";#");
-  if (pos != std::string::npos) t = t.substr(0, pos);
-  // trim
-  auto l = t.find_first_not_of(" \t\r\n");
-  if (l == std::string::npos) return false;
-  auto r = t.find_last_not_of(" \t\r\n");
-  t = t.substr(l, r - l + 1);
-
-  if (t.rfind("0x", 0) == 0 || t.rfind("0X", 0) == 0) t = t.substr(2);
-  if (t.empty()) return false;
-  for (char c: t) {
-    if (!std::isxdigit(static_cast<unsigned char>(c))) return false;
+static constexpr std::size_t kHexBufferBytes = 64 * 1024;
+static constexpr std::size_t kMinZeroRun = 4; // shorter zero runs are cheaper to write than a marker
+
+static void appendHex(std::string& buf, u64 v, int minDigits) {
+  static const char kDigits[] = "0123456789ABCDEF";
+  char tmp[16];
+  int n = 0;
+  do { tmp[n++] = kDigits[v & 0xF]; v >>= 4; } while (v != 0);
+  while (n < minDigits) tmp[n++] = '0';
+  buf += "0x";
+  while (n > 0) buf += tmp[--n];
+}
+
+std::size_t Memory::writeHexWords(std::ostream& out, const u32* w, std::size_t n, u64 baseAddr, bool sparse) {
+  std::string buf;
+  std::size_t written = 0;
+  buf.reserve(kHexBufferBytes + 64);
+  bool marker = baseAddr != 0;
+  for (std::size_t i = 0; i < n; i++) {
+    if (sparse && w[i] == 0) {
+      std::size_t j = i;
+      while (j < n && w[j] == 0) j++;
+      if (j - i >= kMinZeroRun) {
+        i = j - 1;
+        marker = true;
+        continue;
+      }
+    }
+    if (marker) {
+      buf += '@';
+      appendHex(buf, baseAddr + 4 * (u64)i, 8);
+      buf += '\n';
+      marker = false;
+    }
+    appendHex(buf, w[i], 8);
+    buf += '\n';
+    written++;
+    if (buf.size() >= kHexBufferBytes) {
+      out.write(buf.data(), (std::streamsize)buf.size());
+      buf.clear();
+    }
   }
-  std::stringstream ss;
-  ss << std::hex << t;
-  unsigned long long v = 0;
-  ss >> v;
-  out = static_cast<u32>(v & 0xFFFFFFFFull);
+  out.write(buf.data(), (std::streamsize)buf.size());
+  return written;
+}
+
+std::size_t Memory::saveHex(std::ostream& out, std::size_t firstWord, std::size_t endWord, bool sparse) const {
+  if (firstWord > endWord || endWord > nWords) throw std::runtime_error("Save range out of memory.");
+  return writeHexWords(out, words + firstWord, endWord - firstWord, 4 * (u64)firstWord, sparse);
+}
+
+static int hexDigit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// Parses "[0x]HEX" at p, followed only by blanks or a comment.
+// Returns false for anything else (such lines are skipped).
+static bool parseHex(const char* p, u64& out) {
+  if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) p += 2;
+  u64 v = 0;
+  int digits = 0;
+  for (int d; (d = hexDigit(*p)) >= 0; p++, digits++) v = (v << 4) | (u64)d;
+  while (*p == ' ' || *p == '\t' || *p == '\r') p++;
+  if (digits == 0 || (*p != '\0' && *p != ';' && *p != '#')) return false;
+  out = v;
   return true;
 }
 
-void Memory::loadProgramHexLines(const std::vector<std::string>& lines) {
+void Memory::loadHex(std::istream& in) {
   clear();
   std::size_t idx = 0;
-  for (const auto& line : lines) {
-    u32 w = 0;
-    if (!parseHexWord(line, w)) continue;
-    if (idx >= words.size()) throw std::runtime_error("Program too large for memory.");
-    words[idx++] = w;
-  }
-}
-
-std::vector<std::string> Memory::dumpProgramHexLines(std::size_t maxWords) const {
-  std::vector<std::string> out;
-  std::size_t n = (maxWords == 0) ? words.size() : std::min(maxWords, words.size());
-  for (std::size_t i = 0; i < n; i++) {
-    std::ostringstream oss;
-    oss << "0x" << std::hex << std::uppercase << std::setw(8) << std::setfill('0') << words[i];
-    out.push_back(oss.str());
+  std::string line;
+  while (std::getline(in, line)) {
+    const char* p = line.c_str();
+    while (*p == ' ' || *p == '\t') p++;
+    bool isMarker = *p == '@';
+    u64 v = 0;
+    if (!parseHex(p + (isMarker ? 1 : 0), v)) continue;
+    if (isMarker) {
+      idx = addrToIndex(v);
+      continue;
+    }
+    if (idx >= nWords) throw std::runtime_error("Program too large for memory.");
+    words[idx++] = static_cast<u32>(v & 0xFFFFFFFFull);
   }
-  return out;
 }
@@ -0,0 +1,481 @@
+#include "Optimizer.h"
+#include "Assembler.h"
+#include "Encoding.h"
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+
+namespace {
+
+using namespace enc;
+
+enum class Kind { Plain, Branch, Call, CondBranch, Ret, Halt, Unknown };
+
+constexpr std::size_t kNone = ~std::size_t(0);
+constexpr int kMaxChain = 64; // hops followed through B-to-B chains
+
+struct Insn {
+  u64 addr = 0;   // byte address before optimization
+  u32 word = 0;
+  Kind kind = Kind::Plain;
+  u64 target = 0; // branch target, as a byte address before optimization
+  std::size_t run = 0;
+  bool removed = false;
+  u64 newAddr = 0;
+  std::string rules; // what happened to it, for the report
+};
+
+Kind classify(u32 w, u64 pc, u64& target) {
+  if (w == OP_HALT) return Kind::Halt;
+  if (w == OP_NOP) return Kind::Plain;
+  const u32 op6 = get(w,31,26), op8 = get(w,31,24), op10 = get(w,31,22), op11 = get(w,31,21);
+  if (op6 == OP_B || op6 == OP_BL) {
+    target = pc + 4ull * (u64)sext(get(w,25,0), 26);
+    return op6 == OP_B ? Kind::Branch : Kind::Call;
+  }
+  if (op8 == OP_CBZ || op8 == OP_CBNZ || op8 == OP_BCOND) {
+    target = pc + 4ull * (u64)sext(get(w,23,5), 19);
+    return Kind::CondBranch;
+  }
+  if (op10 == OP_ADDI || op10 == OP_SUBI || op10 == OP_ADDIS || op10 == OP_SUBIS) return Kind::Plain;
+  if (op11 == OP_LDUR || op11 == OP_STUR || op11 == OP_ADD || op11 == OP_SUB ||
+      op11 == OP_ADDS || op11 == OP_SUBS || isSizedLoad(op11) || isSizedStore(op11)) return Kind::Plain;
+  if (op11 == OP_XEXT) {
+    auto f = (XFunct)get(w,15,10);
+    if (f == XFunct::RET || f == XFunct::ERET) return Kind::Ret;
+    if (f <= XFunct::HCALL) return Kind::Plain;
+  }
+  if (op11 == OP_VEXT && get(w,14,10) <= (u32)VFunct::DUP) return Kind::Plain;
+  return Kind::Unknown;
+}
+
+// Registers an instruction writes, and which of them are certainly zero
+// afterwards given the registers 'zeroIn' that are zero before it.
+void regEffects(u32 w, u32 zeroIn, u32& writes, u32& zeros) {
+  writes = zeros = 0;
+  auto bit = [](u32 r) { return 1u << r; };
+  auto isZero = [&](u32 r) { return (zeroIn & bit(r)) != 0; };
+  const u32 op6 = get(w,31,26), op10 = get(w,31,22), op11 = get(w,31,21);
+  const u32 rm = get(w,20,16), rn = get(w,9,5), rd = get(w,4,0);
+  if (w == OP_NOP || w == OP_HALT) return;
+  if (op6 == OP_BL) { writes = bit(30); return; }
+  if (op10 == OP_ADDI || op10 == OP_SUBI || op10 == OP_ADDIS || op10 == OP_SUBIS) {
+    writes = bit(rd);
+    if (get(w,21,10) == 0 && isZero(rn)) zeros = writes;
+    return;
+  }
+  if (op11 == OP_ADD || op11 == OP_ADDS || op11 == OP_SUB || op11 == OP_SUBS) {
+    writes = bit(rd);
+    const bool sub = op11 == OP_SUB || op11 == OP_SUBS;
+    if ((isZero(rn) && isZero(rm)) || (sub && rn == rm)) zeros = writes;
+    return;
+  }
+  if (op11 == OP_LDUR || isSizedLoad(op11)) { writes = bit(rd); return; }
+  if (op11 == OP_XEXT) {
+    switch ((XFunct)get(w,15,10)) {
+      case XFunct::AND: case XFunct::MUL:
+        writes = bit(rd);
+        if (isZero(rn) || isZero(rm)) zeros = writes;
+        return;
+      case XFunct::ORR:
+        writes = bit(rd);
+        if (isZero(rn) && isZero(rm)) zeros = writes;
+        return;
+      case XFunct::EOR:
+        writes = bit(rd);
+        if (rn == rm || (isZero(rn) && isZero(rm))) zeros = writes;
+        return;
+      case XFunct::LSL: case XFunct::LSR:
+        writes = bit(rd);
+        if (isZero(rn)) zeros = writes;
+        return;
+      case XFunct::LDADD: case XFunct::HARTID: writes = bit(rd); return;
+      case XFunct::CAS: writes = bit(rm); return;
+      case XFunct::HCALL: writes = bit(0); return;
+      default: return;
+    }
+  }
+  if (op11 == OP_VEXT) {
+    auto f = (VFunct)get(w,14,10);
+    if (f == VFunct::UMOV) writes = bit(rd);
+    if ((f == VFunct::LDR || f == VFunct::STR) && (rm & 1)) writes = bit(rn);
+  }
+}
+
+bool setsFlags(u32 w) {
+  const u32 op10 = get(w,31,22), op11 = get(w,31,21);
+  if (op10 == OP_ADDIS || op10 == OP_SUBIS || op11 == OP_ADDS || op11 == OP_SUBS) return true;
+  return op11 == OP_XEXT && (XFunct)get(w,15,10) == XFunct::CMP;
+}
+
+bool readsFlags(u32 w) { return get(w,31,24) == OP_BCOND; }
+
+// The branch word re-aimed: the instruction is at 'at' and should go to 'to'.
+// Returns false when the offset does not fit.
+bool retarget(u32& w, Kind kind, u64 at, u64 to) {
+  const i64 off = ((i64)to - (i64)at) / 4;
+  if (kind == Kind::Branch || kind == Kind::Call) {
+    if (off < -(1ll << 25) || off >= (1ll << 25)) return false;
+    w = set(w, 25, 0, (u32)off);
+    return true;
+  }
+  if (off < -(1ll << 18) || off >= (1ll << 18)) return false;
+  w = set(w, 23, 5, (u32)off);
+  return true;
+}
+
+class Pass {
+public:
+  Pass(Memory& m, const std::vector<u64>& e): mem(m), entries(e) {}
+
+  Optimizer::Result run() {
+    discover();
+    checkMovable();
+    for (int round = 0; round < 1000 && rewriteOnce(); round++) {}
+    return finish();
+  }
+
+private:
+  Memory& mem;
+  std::vector<u64> entries;
+  std::vector<Insn> code; // reachable words by address
+  std::unordered_map<u64, std::size_t> index;
+  std::string notMoved;
+  std::size_t retargets = 0;
+
+  bool inMemory(u64 a) const { return a % 4 == 0 && a / 4 < mem.sizeWords(); }
+
+  void discover() {
+    std::map<u64, Insn> found;
+    std::vector<u64> work;
+    for (u64 e : entries) if (inMemory(e)) work.push_back(e);
+    while (!work.empty()) {
+      const u64 a = work.back();
+      work.pop_back();
+      if (found.count(a)) continue;
+      Insn in;
+      in.addr = a;
+      in.word = mem.loadWord(a);
+      in.kind = classify(in.word, a, in.target);
+      found[a] = in;
+      auto follow = [&](u64 t) {
+        if (inMemory(t)) work.push_back(t);
+        else if (notMoved.empty()) notMoved = "the branch at " + std::to_string(a) + " leaves memory";
+      };
+      if (in.kind == Kind::Branch || in.kind == Kind::Call || in.kind == Kind::CondBranch) follow(in.target);
+      if (in.kind == Kind::Plain || in.kind == Kind::Call || in.kind == Kind::CondBranch) {
+        if (inMemory(a + 4)) work.push_back(a + 4);
+      }
+    }
+    for (auto& [a, in] : found) {
+      if (!code.empty() && code.back().addr + 4 != a) in.run = code.back().run + 1;
+      else if (!code.empty()) in.run = code.back().run;
+      index[a] = code.size();
+      code.push_back(in);
+    }
+  }
+
+  void checkMovable() {
+    for (const auto& in : code) {
+      if (!notMoved.empty()) return;
+      if (in.kind == Kind::Ret && (XFunct)get(in.word,15,10) == XFunct::ERET) {
+        notMoved = "ERET at " + std::to_string(in.addr) + ": interrupt vectors are not relocated";
+      } else if (in.kind == Kind::Ret && get(in.word,9,5) != 30) {
+        notMoved = "RET X" + std::to_string(get(in.word,9,5)) + " at " + std::to_string(in.addr) +
+                   " may jump to a computed address";
+      } else if (in.kind != Kind::Call) {
+        u32 writes, zeros;
+        regEffects(in.word, 0, writes, zeros);
+        if (writes & (1u << 30)) notMoved = "X30 is written at " + std::to_string(in.addr) + " (not by BL)";
+      }
+    }
+  }
+
+  bool movable() const { return notMoved.empty(); }
+
+  std::size_t next(std::size_t i) const {
+    for (std::size_t j = i + 1; j < code.size() && code[j].run == code[i].run; j++) {
+      if (!code[j].removed) return j;
+    }
+    return kNone;
+  }
+
+  // First instruction still present at or after 'addr' (a code address).
+  std::size_t resolve(u64 addr) const {
+    auto it = index.find(addr);
+    if (it == index.end()) return kNone;
+    std::size_t i = it->second;
+    while (i < code.size() && code[i].removed) i++;
+    return i < code.size() && code[i].run == code[it->second].run ? i : kNone;
+  }
+
+  bool isBranch(const Insn& in) const {
+    return in.kind == Kind::Branch || in.kind == Kind::Call || in.kind == Kind::CondBranch;
+  }
+
+  void note(std::size_t i, const char* rule) {
+    if (!code[i].rules.empty()) code[i].rules += ", ";
+    code[i].rules += rule;
+  }
+
+  void remove(std::size_t i, const char* rule) {
+    code[i].removed = true;
+    note(i, rule);
+  }
+
+  // Instructions control can arrive at other than by falling through:
+  // entries, branch targets and return sites after a BL.
+  std::vector<bool> landingPads() const {
+    std::vector<bool> pad(code.size(), false);
+    for (u64 e : entries) if (auto t = resolve(e); t != kNone) pad[t] = true;
+    for (std::size_t i = 0; i < code.size(); i++) {
+      if (code[i].removed) continue;
+      if (isBranch(code[i])) if (auto t = resolve(code[i].target); t != kNone) pad[t] = true;
+      if (code[i].kind == Kind::Call) if (auto n = next(i); n != kNone) pad[n] = true;
+    }
+    return pad;
+  }
+
+  // Registers certainly zero before each instruction (nothing is assumed
+  // at entries or after a call returns).
+  std::vector<u32> zeroRegs() const {
+    std::vector<u32> in(code.size(), ~0u);
+    std::vector<std::size_t> work;
+    for (u64 e : entries) if (auto t = resolve(e); t != kNone) in[t] = 0;
+    for (std::size_t i = 0; i < code.size(); i++) if (!code[i].removed) work.push_back(i);
+    auto flow = [&](std::size_t s, u32 v) {
+      if (s == kNone || (in[s] & v) == in[s]) return;
+      in[s] &= v;
+      work.push_back(s);
+    };
+    while (!work.empty()) {
+      const std::size_t i = work.back();
+      work.pop_back();
+      const Insn& c = code[i];
+      u32 writes, zeros;
+      regEffects(c.word, in[i], writes, zeros);
+      const u32 out = (in[i] & ~writes) | zeros;
+      switch (c.kind) {
+        case Kind::Plain: flow(next(i), out); break;
+        case Kind::Branch: flow(resolve(c.target), out); break;
+        case Kind::Call: flow(resolve(c.target), out); flow(next(i), 0); break;
+        case Kind::CondBranch: flow(resolve(c.target), out); flow(next(i), out); break;
+        default: break;
+      }
+    }
+    return in;
+  }
+
+  // Whether NZCV may still be read from before each instruction. Calls,
+  // returns, HALT and unknown words count as reads: the final flags are
+  // part of the visible result.
+  std::vector<bool> flagsLive() const {
+    std::vector<bool> live(code.size(), false);
+    auto at = [&](std::size_t s) { return s == kNone || live[s]; };
+    for (bool changed = true; changed;) {
+      changed = false;
+      for (std::size_t k = code.size(); k-- > 0;) {
+        const Insn& c = code[k];
+        if (c.removed || live[k]) continue;
+        bool v;
+        switch (c.kind) {
+          case Kind::Plain: v = !setsFlags(c.word) && at(next(k)); break;
+          case Kind::Branch: v = at(resolve(c.target)); break;
+          case Kind::CondBranch: v = readsFlags(c.word) || at(resolve(c.target)) || at(next(k)); break;
+          default: v = true; break;
+        }
+        if (v) { live[k] = true; changed = true; }
+      }
+    }
+    return live;
+  }
+
+  // One sweep of the simple rules, then at most one CFG-changing rewrite.
+  // Returns whether anything changed.
+  bool rewriteOnce() {
+    bool changed = false;
+    for (std::size_t i = 0; i < code.size(); i++) {
+      Insn& c = code[i];
+      if (c.removed) continue;
+      const u32 w = c.word;
+      if (movable() && (w == OP_NOP || isMoveToSelf(w))) {
+        remove(i, w == OP_NOP ? "NOP removed" : "no-op removed");
+        changed = true;
+        continue;
+      }
+      if (!isBranch(c)) continue;
+      // Branch to a B: go to where the B goes.
+      u64 t = c.target;
+      for (int hop = 0; hop < kMaxChain; hop++) {
+        std::size_t ti = resolve(t);
+        if (ti == kNone || code[ti].kind != Kind::Branch || resolve(code[ti].target) == ti) break;
+        t = code[ti].target;
+      }
+      if (resolve(t) != resolve(c.target)) {
+        u32 probe = c.word;
+        if (retarget(probe, c.kind, c.addr, t)) {
+          c.target = t;
+          retargets++;
+          note(i, "branch chain shortened");
+          changed = true;
+        }
+      }
+      if (movable() && c.kind != Kind::Call && resolve(c.target) == next(i)) {
+        remove(i, "branch to next instruction removed");
+        changed = true;
+      }
+    }
+    if (!movable()) return changed;
+    if (pruneUnreachable()) changed = true;
+    return changed || invertOverBranch() || cmpToCbz();
+  }
+
+  // Code no longer reached once branches skip the B it used to go through.
+  bool pruneUnreachable() {
+    std::vector<bool> seen(code.size(), false);
+    std::vector<std::size_t> work;
+    for (u64 e : entries) if (auto t = resolve(e); t != kNone) work.push_back(t);
+    while (!work.empty()) {
+      const std::size_t i = work.back();
+      work.pop_back();
+      if (i == kNone || seen[i]) continue;
+      seen[i] = true;
+      const Insn& c = code[i];
+      if (isBranch(c)) work.push_back(resolve(c.target));
+      if (c.kind == Kind::Plain || c.kind == Kind::Call || c.kind == Kind::CondBranch) work.push_back(next(i));
+    }
+    bool changed = false;
+    for (std::size_t i = 0; i < code.size(); i++) {
+      if (code[i].removed || seen[i]) continue;
+      remove(i, "unreachable");
+      changed = true;
+    }
+    return changed;
+  }
+
+  static bool isMoveToSelf(u32 w) {
+    const u32 op10 = get(w,31,22);
+    return (op10 == OP_ADDI || op10 == OP_SUBI) && get(w,21,10) == 0 && get(w,9,5) == get(w,4,0);
+  }
+
+  // B.cond/CBZ/CBNZ L1; B L2; L1:  ->  inverted branch to L2.
+  bool invertOverBranch() {
+    auto pad = landingPads();
+    for (std::size_t i = 0; i < code.size(); i++) {
+      Insn& c = code[i];
+      if (c.removed || c.kind != Kind::CondBranch) continue;
+      const std::size_t j = next(i);
+      if (j == kNone || code[j].kind != Kind::Branch || pad[j]) continue;
+      if (resolve(c.target) != next(j)) continue;
+      u32 w = c.word;
+      if (get(w,31,24) == OP_BCOND) {
+        const u32 cond = get(w,3,0);
+        if (cond >= (u32)Cond::AL) continue;
+        w = set(w, 3, 0, cond ^ 1);
+      } else {
+        w = set(w, 31, 24, get(w,31,24) == OP_CBZ ? OP_CBNZ : OP_CBZ);
+      }
+      if (!retarget(w, c.kind, c.addr, code[j].target)) continue;
+      c.word = w;
+      c.target = code[j].target;
+      note(i, "condition inverted over B");
+      remove(j, "B folded into the inverted branch");
+      return true;
+    }
+    return false;
+  }
+
+  // CMP Xn, Xm; B.EQ/B.NE L with Xm (or Xn) zero  ->  CBZ/CBNZ Xn (or Xm), L.
+  bool cmpToCbz() {
+    auto pad = landingPads();
+    auto zero = zeroRegs();
+    auto live = flagsLive();
+    for (std::size_t i = 0; i < code.size(); i++) {
+      Insn& c = code[i];
+      if (c.removed || code[i].kind != Kind::Plain) continue;
+      if (get(c.word,31,21) != OP_XEXT || (XFunct)get(c.word,15,10) != XFunct::CMP) continue;
+      const std::size_t j = next(i);
+      if (j == kNone || pad[j] || get(code[j].word,31,24) != OP_BCOND) continue;
+      const u32 cond = get(code[j].word,3,0);
+      if (cond != (u32)Cond::EQ && cond != (u32)Cond::NE) continue;
+      const u32 rn = get(c.word,9,5), rm = get(c.word,20,16);
+      u32 tested;
+      if (zero[i] & (1u << rm)) tested = rn;
+      else if (zero[i] & (1u << rn)) tested = rm;
+      else continue;
+      const std::size_t taken = resolve(code[j].target), fall = next(j);
+      if (taken == kNone || live[taken] || fall == kNone || live[fall]) continue;
+      u32 w = 0;
+      w = set(w, 31, 24, cond == (u32)Cond::EQ ? OP_CBZ : OP_CBNZ);
+      w = set(w, 4, 0, tested);
+      if (!retarget(w, Kind::CondBranch, c.addr, code[j].target)) continue;
+      c.word = w;
+      c.kind = Kind::CondBranch;
+      c.target = code[j].target;
+      note(i, "CMP with zero + B.cond turned into CBZ/CBNZ");
+      remove(j, "B.cond merged into CBZ/CBNZ");
+      return true;
+    }
+    return false;
+  }
+
+  Optimizer::Result finish() {
+    Optimizer::Result r;
+    r.codeWords = code.size();
+    r.retargeted = retargets;
+    r.notMoved = notMoved;
+
+    // New addresses: each run is compacted towards its start.
+    std::vector<std::pair<u64, u64>> freed; // [from, to) byte ranges to pad
+    for (std::size_t s = 0; s < code.size();) {
+      std::size_t e = s;
+      while (e < code.size() && code[e].run == code[s].run) e++;
+      u64 cursor = code[s].addr;
+      for (std::size_t k = s; k < e; k++) {
+        if (!code[k].removed) { code[k].newAddr = cursor; cursor += 4; }
+      }
+      u64 after = cursor;
+      for (std::size_t k = e; k-- > s;) {
+        if (code[k].removed) code[k].newAddr = after;
+        else after = code[k].newAddr;
+      }
+      if (cursor < code[e - 1].addr + 4) freed.push_back({cursor, code[e - 1].addr + 4});
+      s = e;
+    }
+    for (auto& c : code) {
+      r.relocation[c.addr] = c.newAddr;
+      if (c.removed) { r.removedAddrs.insert(c.addr); r.removed++; }
+    }
+
+    for (auto& c : code) {
+      if (c.removed || !isBranch(c)) continue;
+      if (!retarget(c.word, c.kind, c.newAddr, r.map(c.target))) {
+        throw std::runtime_error("optimize: branch offset out of range at " + std::to_string(c.addr));
+      }
+    }
+
+    // Report before overwriting: 'before' is the original word.
+    for (auto& c : code) {
+      if (c.rules.empty() && (c.removed || c.newAddr == c.addr)) continue;
+      if (c.rules.empty() && mem.loadWord(c.addr) == c.word) continue; // only moved
+      Optimizer::Change ch;
+      ch.addr = c.addr;
+      ch.before = Assembler::disasm(mem.loadWord(c.addr), c.addr);
+      ch.after = c.removed ? "" : Assembler::disasm(c.word, c.newAddr);
+      ch.rule = c.rules.empty() ? "branch relocated" : c.rules;
+      r.changes.push_back(std::move(ch));
+    }
+
+    for (auto& c : code) if (!c.removed) mem.storeWord(c.newAddr, c.word);
+    for (auto [from, to] : freed) {
+      for (u64 a = from; a < to; a += 4) mem.storeWord(a, OP_HALT);
+    }
+    return r;
+  }
+};
+
+} // namespace
+
+Optimizer::Result Optimizer::optimize(Memory& mem, const std::vector<u64>& entries) {
+  return Pass(mem, entries).run();
+}
@@ -0,0 +1,94 @@
+#include "OutputPipeline.h"
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+static std::size_t roundUpPow2(std::size_t n) {
+  std::size_t p = 1;
+  while (p < n) p <<= 1;
+  return p;
+}
+
+OutputPipeline::OutputPipeline(const UI& ui_, std::size_t capacity)
+  : ui(ui_), ring(roundUpPow2(capacity < 2 ? 2 : capacity)), mask(ring.size() - 1) {}
+
+OutputPipeline::~OutputPipeline() {
+  if (!writer.joinable()) return;
+  stopping.store(true, std::memory_order_release);
+  wake.fetch_add(1, std::memory_order_release);
+  wake.notify_one();
+  writer.join();
+}
+
+void OutputPipeline::start() {
+  writer = std::thread([this] { writerLoop(); });
+}
+
+bool OutputPipeline::push(const StateRecord& rec) {
+  if (!writer.joinable()) start();
+
+  const u64 t = tail.load(std::memory_order_relaxed);
+  u64 h = head.load(std::memory_order_acquire);
+  while (t - h >= ring.size()) {
+    if (policy == Policy::Drop) {
+      droppedCount.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    // Backpressure: sleep until the writer frees a slot.
+    head.wait(h, std::memory_order_acquire);
+    h = head.load(std::memory_order_acquire);
+  }
+
+  ring[t & mask] = rec;
+  tail.store(t + 1, std::memory_order_release);
+  wake.fetch_add(1, std::memory_order_release);
+  wake.notify_one();
+  return true;
+}
+
+void OutputPipeline::flush() {
+  if (!writer.joinable()) return;
+  const u64 target = tail.load(std::memory_order_relaxed);
+  u64 w = writtenCount.load(std::memory_order_acquire);
+  while (w < target) {
+    writtenCount.wait(w, std::memory_order_acquire);
+    w = writtenCount.load(std::memory_order_acquire);
+  }
+}
+
+void OutputPipeline::writerLoop() {
+  // Render into one large buffer and hand it to stdout in a single write
+  // whenever the ring runs dry or the buffer grows past the threshold.
+  constexpr std::size_t kFlushBytes = 256 * 1024;
+  std::ostringstream buf;
+  u64 pending = 0;
+
+  auto emit = [&] {
+    const std::string text = buf.str();
+    std::cout.write(text.data(), (std::streamsize)text.size());
+    std::cout.flush();
+    buf.str({});
+    writtenCount.fetch_add(pending, std::memory_order_release);
+    writtenCount.notify_all();
+    pending = 0;
+  };
+
+  while (true) {
+    const u32 seen = wake.load(std::memory_order_acquire);
+    u64 h = head.load(std::memory_order_relaxed);
+    u64 t = tail.load(std::memory_order_acquire);
+    if (h == t) {
+      if (pending) emit();
+      if (stopping.load(std::memory_order_acquire)) break;
+      wake.wait(seen, std::memory_order_acquire);
+      continue;
+    }
+    for (; h != t; h++) {
+      ui.render(ring[h & mask], buf);
+      head.store(h + 1, std::memory_order_release);
+      pending++;
+      if ((std::size_t)buf.tellp() >= kFlushBytes) emit();
+    }
+    head.notify_one();
+  }
+}
@@ -0,0 +1,108 @@
+#include "Sampler.h"
+#include "Assembler.h"
+#include "Breakpoints.h"
+#include <algorithm>
+#include <iomanip>
+#include <ostream>
+#include <unordered_map>
+#include <unordered_set>
+
+void Sampler::start(u64 samplePeriod) {
+  period = std::max<u64>(samplePeriod, 1);
+  taken = lost = 0;
+  buffer.clear();
+  buffer.reserve(kBufferWords);
+}
+
+u64 Sampler::nextSlice() {
+  // Period +- 1/8, uniformly.
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  const u64 spread = period / 4;
+  if (spread == 0) return period;
+  return period - spread / 2 + rng % (spread + 1);
+}
+
+void Sampler::record(const CPU& cpu) {
+  const auto& frames = cpu.getCallStack().get();
+  const std::size_t n = std::min(frames.size(), kMaxSampleDepth);
+  if (buffer.size() + 2 + n > kBufferWords) {
+    lost++;
+    return;
+  }
+  buffer.push_back(cpu.getPC());
+  buffer.push_back(n);
+  for (std::size_t i = 0; i < n; i++) buffer.push_back(frames[frames.size() - 1 - i].func);
+  taken++;
+}
+
+StopReason Sampler::run(CPU& cpu, Memory& mem, u64 maxSteps, Breakpoints* breakpoints, const i64* depth) {
+  u64 left = maxSteps;
+  while (left > 0) {
+    const u64 slice = std::min(left, nextSlice());
+    const u64 before = cpu.counters().instret;
+    StopReason r = depth ? cpu.runToDepth(mem, slice, *depth, breakpoints) : cpu.run(mem, slice, breakpoints);
+    left -= std::min(left, std::max<u64>(cpu.counters().instret - before, 1));
+    if (r != StopReason::StepLimit) return r;
+    record(cpu);
+  }
+  return StopReason::StepLimit;
+}
+
+void Sampler::relocate(const std::function<u64(u64)>& map) {
+  for (std::size_t i = 0; i < buffer.size();) {
+    const u64 n = buffer[i + 1];
+    buffer[i] = map(buffer[i]);
+    for (u64 k = 0; k < n; k++) buffer[i + 2 + k] = map(buffer[i + 2 + k]);
+    i += 2 + n;
+  }
+}
+
+void Sampler::report(std::ostream& out, const Memory& mem, std::size_t top, const Namer& name,
+                     const std::function<std::string(u64)>& where) const {
+  std::unordered_map<u64, u64> perPc, self, total;
+  std::unordered_set<u64> seen;
+  for (std::size_t i = 0; i < buffer.size();) {
+    const u64 pc = buffer[i], n = buffer[i + 1];
+    perPc[pc]++;
+    if (n) self[buffer[i + 2]]++;
+    seen.clear();
+    for (u64 k = 0; k < n; k++) {
+      if (seen.insert(buffer[i + 2 + k]).second) total[buffer[i + 2 + k]]++;
+    }
+    i += 2 + n;
+  }
+
+  auto sorted = [](const std::unordered_map<u64, u64>& m) {
+    std::vector<std::pair<u64, u64>> v(m.begin(), m.end());
+    std::sort(v.begin(), v.end(), [](auto& a, auto& b) { return a.second != b.second ? a.second > b.second : a.first < b.first; });
+    return v;
+  };
+  auto pct = [this](u64 n) { return taken ? 100.0 * (double)n / (double)taken : 0.0; };
+
+  out << taken << " samples, one per ~" << period << " instructions";
+  if (lost) out << " (" << lost << " dropped: buffer full)";
+  out << "\n\n" << std::fixed << std::setprecision(1);
+  out << std::setw(10) << "samples" << std::setw(8) << "%" << std::setw(10) << "PC" << "  instruction\n";
+  auto pcs = sorted(perPc);
+  for (std::size_t i = 0; i < pcs.size() && i < top; i++) {
+    auto [pc, n] = pcs[i];
+    std::string text = "?";
+    if (pc / 4 < mem.sizeWords()) text = Assembler::disasm(mem.loadWord(pc), pc);
+    out << std::setw(10) << n << std::setw(7) << pct(n) << "%" << std::setw(10) << pc << "  "
+        << text << where(pc) << "\n";
+  }
+
+  out << "\n" << std::left << std::setw(24) << "function" << std::right << std::setw(10) << "self"
+      << std::setw(8) << "%" << std::setw(10) << "total" << std::setw(8) << "%" << "\n";
+  auto funcs = sorted(total);
+  for (std::size_t i = 0; i < funcs.size() && i < top; i++) {
+    auto [f, n] = funcs[i];
+    auto s = self.count(f) ? self.at(f) : 0;
+    out << std::left << std::setw(24) << name(f) << std::right << std::setw(10) << s << std::setw(7)
+        << pct(s) << "%" << std::setw(10) << n << std::setw(7) << pct(n) << "%\n";
+  }
+  out.unsetf(std::ios::floatfield);
+  out << std::setprecision(6);
+}
@@ -0,0 +1,243 @@
+#include "Script.h"
+#include <cctype>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+std::string trim(const std::string& s) {
+  auto l = s.find_first_not_of(" \t\r\n");
+  if (l == std::string::npos) return "";
+  auto r = s.find_last_not_of(" \t\r\n");
+  return s.substr(l, r - l + 1);
+}
+
+bool isNameChar(char c) { return std::isalnum((unsigned char)c) || c == '_'; }
+
+// Recursive descent over the text, evaluating as it goes.
+class ExprParser {
+public:
+  ExprParser(const std::string& text, const ScriptVars& vars): s(text), vars(vars) {}
+
+  i64 parse() {
+    const i64 v = binary(0);
+    skipSpace();
+    if (i != s.size()) fail("unexpected '" + s.substr(i) + "'");
+    return v;
+  }
+
+private:
+  const std::string& s;
+  const ScriptVars& vars;
+  std::size_t i = 0;
+
+  [[noreturn]] void fail(const std::string& msg) const {
+    throw std::runtime_error("Expression '" + s + "': " + msg);
+  }
+
+  void skipSpace() {
+    while (i < s.size() && std::isspace((unsigned char)s[i])) i++;
+  }
+
+  // Binary operators by precedence level, loosest first.
+  static constexpr const char* kLevels[][3] = {
+    {"|", nullptr, nullptr}, {"^", nullptr, nullptr}, {"&", nullptr, nullptr},
+    {"<<", ">>", nullptr},   {"+", "-", nullptr},     {"*", "/", "%"},
+  };
+  static constexpr int kNumLevels = 6;
+
+  const char* op(int level) {
+    skipSpace();
+    for (const char* o : kLevels[level]) {
+      if (o && s.compare(i, std::char_traits<char>::length(o), o) == 0) {
+        i += std::char_traits<char>::length(o);
+        return o;
+      }
+    }
+    return nullptr;
+  }
+
+  i64 binary(int level) {
+    if (level == kNumLevels) return unary();
+    i64 lhs = binary(level + 1);
+    while (const char* o = op(level)) {
+      const i64 rhs = binary(level + 1);
+      const u64 a = (u64)lhs, b = (u64)rhs;
+      switch (o[0]) {
+        case '|': lhs = (i64)(a | b); break;
+        case '^': lhs = (i64)(a ^ b); break;
+        case '&': lhs = (i64)(a & b); break;
+        case '<': lhs = (i64)(a << (b & 63)); break;
+        case '>': lhs = (i64)(a >> (b & 63)); break;
+        case '+': lhs = (i64)(a + b); break;
+        case '-': lhs = (i64)(a - b); break;
+        case '*': lhs = (i64)(a * b); break;
+        default:
+          if (rhs == 0) fail("division by zero");
+          if (rhs == -1) lhs = o[0] == '/' ? (i64)(0 - a) : 0; // no overflow trap
+          else lhs = o[0] == '/' ? lhs / rhs : lhs % rhs;
+          break;
+      }
+    }
+    return lhs;
+  }
+
+  i64 unary() {
+    skipSpace();
+    if (i == s.size()) fail("expected a value");
+    const char c = s[i];
+    if (c == '-') { i++; return (i64)(0 - (u64)unary()); }
+    if (c == '~') { i++; return ~unary(); }
+    if (c == '(') {
+      i++;
+      const i64 v = binary(0);
+      skipSpace();
+      if (i == s.size() || s[i] != ')') fail("expected ')'");
+      i++;
+      return v;
+    }
+    if (c == '#' || std::isdigit((unsigned char)c)) {
+      if (c == '#') i++;
+      std::size_t used = 0;
+      u64 v = 0;
+      try {
+        v = std::stoull(s.substr(i), &used, 0);
+      } catch (const std::exception&) {
+        fail("bad number");
+      }
+      i += used;
+      return (i64)v;
+    }
+    if (c == '$') i++;
+    const std::size_t start = i;
+    while (i < s.size() && isNameChar(s[i])) i++;
+    const std::string name = s.substr(start, i - start);
+    if (!ScriptVars::validName(name)) fail(name.empty() ? "unexpected '" + s.substr(i) + "'" : "bad name '" + name + "'");
+    i64 v = 0;
+    if (!vars.get(name, v)) throw std::runtime_error("Unknown variable: " + name);
+    return v;
+  }
+};
+
+} // namespace
+
+void ScriptVars::set(const std::string& name, i64 value) {
+  if (!validName(name)) throw std::runtime_error("Bad variable name: " + name);
+  vars[name] = value;
+}
+
+bool ScriptVars::get(const std::string& name, i64& value) const {
+  auto it = vars.find(name);
+  if (it == vars.end()) return false;
+  value = it->second;
+  return true;
+}
+
+i64 ScriptVars::eval(const std::string& expr) const { return ExprParser(expr, *this).parse(); }
+
+bool ScriptVars::validName(const std::string& name) {
+  if (name.empty() || std::isdigit((unsigned char)name[0])) return false;
+  for (char c : name) {
+    if (!isNameChar(c)) return false;
+  }
+  return true;
+}
+
+std::string ScriptVars::expand(const std::string& line) const {
+  std::string out;
+  out.reserve(line.size() + 16);
+  for (std::size_t i = 0; i < line.size();) {
+    if (line[i] != '$') { out += line[i++]; continue; }
+    i++;
+    if (i < line.size() && line[i] == '$') { out += '$'; i++; continue; }
+    if (i < line.size() && (line[i] == '(' || line[i] == '{')) {
+      // $(EXPR) up to the matching ')', ${NAME} up to '}'
+      const char open = line[i], close = open == '(' ? ')' : '}';
+      int nest = 0;
+      std::size_t j = i;
+      for (; j < line.size(); j++) {
+        if (line[j] == open) nest++;
+        else if (line[j] == close && --nest == 0) break;
+      }
+      if (j == line.size()) throw std::runtime_error(std::string("Missing '") + close + "' after $" + open + ".");
+      const std::string inner = line.substr(i + 1, j - i - 1);
+      if (open == '{' && !validName(trim(inner))) throw std::runtime_error("Bad variable name: " + inner);
+      out += std::to_string(eval(inner));
+      i = j + 1;
+      continue;
+    }
+    const std::size_t start = i;
+    while (i < line.size() && isNameChar(line[i])) i++;
+    const std::string name = line.substr(start, i - start);
+    if (!validName(name)) throw std::runtime_error("Expected a variable name after '$'.");
+    i64 v = 0;
+    if (!get(name, v)) throw std::runtime_error("Unknown variable: " + name);
+    out += std::to_string(v);
+  }
+  return out;
+}
+
+Script Script::load(const std::string& path) {
+  std::ifstream in(path);
+  if (!in) throw std::runtime_error("Cannot open file: " + path);
+  Script sc;
+  sc.path = path;
+  std::vector<std::size_t> open; // indices of 'for' lines awaiting their 'end'
+  std::string raw;
+  for (int number = 1; std::getline(in, raw); number++) {
+    std::string text = trim(raw);
+    if (text.empty() || text[0] == '#') continue;
+    const bool isFor = text.compare(0, 4, "for ") == 0;
+    if (text == "end") {
+      if (open.empty()) throw std::runtime_error(path + ":" + std::to_string(number) + ": 'end' without 'for'.");
+      sc.lines[open.back()].end = sc.lines.size();
+      open.pop_back();
+    }
+    if (isFor) open.push_back(sc.lines.size());
+    sc.lines.push_back({std::move(text), number, 0});
+  }
+  if (!open.empty()) {
+    throw std::runtime_error(path + ":" + std::to_string(sc.lines[open.back()].number) + ": 'for' without 'end'.");
+  }
+  return sc;
+}
+
+u64 Script::run(ScriptVars& vars, const Exec& exec) const {
+  u64 count = 0;
+  runRange(0, lines.size(), vars, exec, count);
+  return count;
+}
+
+bool Script::runRange(std::size_t first, std::size_t last, ScriptVars& vars, const Exec& exec, u64& count) const {
+  for (std::size_t k = first; k < last; k++) {
+    const Line& ln = lines[k];
+    try {
+      if (ln.end) {
+        // for NAME FIRST LAST [STEP]: the bounds are expressions without blanks,
+        // or with blanks inside $(...)
+        std::istringstream iss(vars.expand(ln.text.substr(4)));
+        std::string name, a, b, c;
+        if (!(iss >> name >> a >> b)) throw std::runtime_error("Usage: for NAME FIRST LAST [STEP]");
+        iss >> c;
+        const i64 from = vars.eval(a), to = vars.eval(b), step = c.empty() ? 1 : vars.eval(c);
+        if (step == 0) throw std::runtime_error("for: STEP must not be 0.");
+        for (i64 v = from; step > 0 ? v <= to : v >= to; v += step) {
+          vars.set(name, v);
+          if (!runRange(k + 1, ln.end, vars, exec, count)) return false;
+          if ((step > 0 && v > INT64_MAX - step) || (step < 0 && v < INT64_MIN - step)) break;
+        }
+        k = ln.end;
+        continue;
+      }
+      count++;
+      if (!exec(ln.text)) return false;
+    } catch (const std::exception& e) {
+      const std::string what = e.what();
+      // Keep the innermost location when loops or nested scripts rethrow.
+      if (what.compare(0, path.size() + 1, path + ":") == 0) throw;
+      throw std::runtime_error(path + ":" + std::to_string(ln.number) + ": " + what);
+    }
+  }
+  return true;
+}
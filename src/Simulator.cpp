@@ -1,10 +1,17 @@
 #include "Simulator.h"
 #include "Assembler.h"
+#include "Checkpoint.h"
+#include "Encoding.h"
+#include "Optimizer.h"
+#include "Translator.h"
 #include <algorithm>
+#include <chrono>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <stdexcept>
+#include <tuple>
 #include <vector>
 
 static std::string trim(std::string s) {
@@ -31,7 +38,39 @@ static u64 parseAddrToken(const std::string& tok) {
   return parseHashNum(trim(tok));
 }
 
-Simulator::Simulator(): cpu(), mem(256/4), ui() {
+static u64 nowNs() {
+  using namespace std::chrono;
+  return (u64)duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Host side of HCALL WRITE/READ.
+static void writeGuestOutput(int fd, const char* data, std::size_t n) {
+  if (fd == 2) {
+    std::cout.flush();
+    std::cerr.write(data, (std::streamsize)n);
+  } else {
+    std::cout.write(data, (std::streamsize)n);
+  }
+}
+
+// Up to n bytes from stdin, stopping after a newline (like a terminal read).
+static std::size_t readGuestInput(char* data, std::size_t n) {
+  std::size_t got = 0;
+  char ch;
+  while (got < n && std::cin.get(ch)) {
+    data[got++] = ch;
+    if (ch == '\n') break;
+  }
+  return got;
+}
+
+Simulator::Simulator(std::size_t memWords)
+    : harts(1), mem(memWords), ui(), host(writeGuestOutput, readGuestInput) {
+  harts[0].setHostCalls(&host);
+  uart = std::make_shared<Uart>([this](const char* data, std::size_t n) { host.output(data, n); });
+  timer = std::make_shared<Timer>();
+  mem.mapDevice(kDeviceBase, uart);
+  mem.mapDevice(kDeviceBase + Memory::kDevicePageBytes, timer);
   ui.setCursor(0);
   // Match the reference format: show memory as decoded instructions by default.
   ui.setMemMode(MemMode::CODE);
@@ -45,10 +84,12 @@ void Simulator::cmdBreak(const std::string& restIn) {
       return;
     }
     std::cout << "Breakpoints (PC byte addresses):\n";
-    // Print in sorted order for readability.
-    std::vector<u64> bps(breakpoints.begin(), breakpoints.end());
-    std::sort(bps.begin(), bps.end());
-    for (auto a : bps) std::cout << "  * " << a << "\n";
+    for (auto& [a, bp] : breakpoints.list()) {
+      std::cout << "  * " << a;
+      if (!bp->condText.empty()) std::cout << " if " << bp->condText;
+      if (bp->ignore) std::cout << " after " << bp->ignore;
+      std::cout << "  (hits: " << bp->hits << ")\n";
+    }
     return;
   }
 
@@ -65,8 +106,8 @@ void Simulator::cmdBreak(const std::string& restIn) {
     iss >> cmd >> addrTok;
     if (addrTok.empty()) throw std::runtime_error("Usage: break del #addr");
     u64 a = parseAddrToken(addrTok);
-    auto n = breakpoints.erase(a);
-    std::cout << (n ? "Removed" : "No") << " breakpoint at PC=" << a << "\n";
+    bool removed = breakpoints.erase(a);
+    std::cout << (removed ? "Removed" : "No") << " breakpoint at PC=" << a << "\n";
     return;
   }
 
@@ -75,20 +116,34 @@ void Simulator::cmdBreak(const std::string& restIn) {
     auto addrTok = trim(rest.substr(7));
     if (addrTok.empty()) throw std::runtime_error("Usage: break toggle #addr");
     u64 a = parseAddrToken(addrTok);
-    if (breakpoints.count(a)) {
-      breakpoints.erase(a);
+    if (breakpoints.erase(a)) {
       std::cout << "Removed breakpoint at PC=" << a << "\n";
     } else {
-      breakpoints.insert(a);
+      breakpoints.set(a);
       std::cout << "Set breakpoint at PC=" << a << "\n";
     }
     return;
   }
 
-  // otherwise treat as address to add
+  // otherwise: #addr [if condition] [after N]
+  u64 ignore = 0;
+  auto afterPos = rest.rfind(" after ");
+  if (afterPos != std::string::npos) {
+    ignore = parseHashNum(trim(rest.substr(afterPos + 7)));
+    rest = trim(rest.substr(0, afterPos));
+  }
+  std::string cond;
+  auto ifPos = rest.find(" if ");
+  if (ifPos != std::string::npos) {
+    cond = trim(rest.substr(ifPos + 4));
+    rest = trim(rest.substr(0, ifPos));
+    if (cond.empty()) throw std::runtime_error("Usage: break #addr [if condition] [after N]");
+  }
   u64 a = parseAddrToken(rest);
-  breakpoints.insert(a);
-  std::cout << "Set breakpoint at PC=" << a << "\n";
+  breakpoints.set(a, cond, ignore);
+  std::cout << "Set breakpoint at PC=" << a << (cond.empty() ? "" : " if " + cond);
+  if (ignore) std::cout << " after " << ignore << " hits";
+  std::cout << "\n";
 }
 
 void Simulator::cmdStep(const std::string& restIn) {
@@ -97,36 +152,32 @@ void Simulator::cmdStep(const std::string& restIn) {
   if (!rest.empty()) n = std::stoi(rest);
   if (n <= 0) return;
 
+  auto& perf = cpu().counters();
   for (int i = 0; i < n; i++) {
-    ui.printState(cpu, mem);
-    bool cont = cpu.step(mem);
+    emitState();
+    u64 t0 = nowNs();
+    bool cont = cpu().step(mem);
+    perf.execNs += nowNs() - t0;
     if (!cont) {
-      std::cout << "\nHALT\n";
-      running = false;
+      syncOutput();
+      reportHalt();
       return;
     }
     // After executing one instruction, if the NEXT instruction is at a breakpoint,
     // stop before executing it (typical debugger behavior).
-    if (breakpoints.count(cpu.getPC())) {
-      ui.printState(cpu, mem);
-      std::cout << "\nBreakpoint hit at PC=" << cpu.getPC() << "\n";
+    if (breakpoints.check(cpu().getPC(), cpu(), mem)) {
+      emitState();
+      syncOutput();
+      std::cout << "\nBreakpoint hit at PC=" << cpu().getPC() << sourceLocation(cpu().getPC()) << "\n";
       return;
     }
   }
 }
 
 void Simulator::cmdContinue(const std::string& /*rest*/) {
-  // If we're currently *on* a breakpoint, step once to get off it, then run.
-  if (breakpoints.count(cpu.getPC())) {
-    bool cont = cpu.step(mem);
-    if (!cont) {
-      ui.printState(cpu, mem);
-      std::cout << "\nHALT\n";
-      running = false;
-      return;
-    }
-  }
-  cmdRun("fast");
+  // The instruction at the current PC always executes first, so continuing
+  // from a breakpoint steps off it before breakpoints are checked again.
+  runHeadless(kMaxQuietSteps);
 }
 
 void Simulator::cmdMemory(const std::string& arg) {
@@ -143,7 +194,7 @@ void Simulator::cmdPC(const std::string& expr) {
   if (pos == std::string::npos) throw std::runtime_error("Usage: PC=#00");
   auto rhs = trim(expr.substr(pos + 1));
   u64 v = parseHashNum(rhs);
-  cpu.setPC(v);
+  cpu().setPC(v);
 }
 
 void Simulator::cmdSetMem(const std::string& expr) {
@@ -158,7 +209,7 @@ void Simulator::cmdSetMem(const std::string& expr) {
   auto valTok  = trim(expr.substr(eq + 1));
   u64 addr = parseHashNum(addrTok);
   u64 val  = parseHashNum(valTok);
-  mem.storeWord(addr, (u32)(val & 0xFFFFFFFFull));
+  mem.storeWord(addr, (u32)(val & 0xFFFFFFFFull), &cpu());
   // Keep the memory window anchored; the reference view shows the full 0..248 window.
 }
 
@@ -170,7 +221,7 @@ void Simulator::cmdSetReg(const std::string& expr) {
     if (pos == std::string::npos) throw std::runtime_error("Usage: Xn=#value");
     int reg = std::stoi(s.substr(1, pos - 1));
     u64 val = parseHashNum(trim(s.substr(pos + 1)));
-    cpu.setX(reg, val);
+    cpu().setX(reg, val);
     return;
   }
   if (startsWith(s, "R[")) {
@@ -182,62 +233,301 @@ void Simulator::cmdSetReg(const std::string& expr) {
     }
     int reg = (int)parseHashNum(trim(s.substr(lbr + 1, rbr - lbr - 1)));
     u64 val = parseHashNum(trim(s.substr(eq + 1)));
-    cpu.setX(reg, val);
+    cpu().setX(reg, val);
     return;
   }
   throw std::runtime_error("Usage: Xn=#value or R[#]=#");
 }
 
-static std::vector<std::string> readAllLines(const std::string& fname) {
-  std::ifstream in(fname);
-  if (!in) throw std::runtime_error("Cannot open file: " + fname);
-  std::vector<std::string> lines;
-  std::string line;
-  while (std::getline(in, line)) lines.push_back(line);
-  return lines;
-}
-
-static void writeAllLines(const std::string& fname, const std::vector<std::string>& lines) {
-  std::ofstream out(fname);
-  if (!out) throw std::runtime_error("Cannot write file: " + fname);
-  for (auto& l : lines) out << l << "\n";
-}
-
 static std::string ensureArmExt(std::string f) {
   if (f.size() >= 4 && f.substr(f.size()-4) == ".arm") return f;
   return f + ".arm";
 }
 
-void Simulator::cmdSave(const std::string& fnameIn) {
-  auto f = ensureArmExt(trim(fnameIn));
-  // dump full memory as program words
-  auto lines = mem.dumpProgramHexLines();
-  lines.insert(lines.begin(), "; saved by simulator");
-  writeAllLines(f, lines);
-  std::cout << "Saved to " << f << "\n";
+void Simulator::cmdSave(const std::string& restIn) {
+  // save fname [#start #end] [sparse]   (byte range [start, end))
+  std::istringstream iss(restIn);
+  std::string f, tok;
+  iss >> f;
+  if (f.empty()) throw std::runtime_error("Usage: save fname[.arm] [#start #end] [sparse]");
+  f = ensureArmExt(f);
+  std::vector<u64> range;
+  bool sparse = false;
+  while (iss >> tok) {
+    if (tok == "sparse") sparse = true;
+    else range.push_back(parseHashNum(tok));
+  }
+  u64 start = 0, end = 4 * (u64)mem.sizeWords();
+  if (range.size() == 2) { start = range[0]; end = range[1]; }
+  else if (!range.empty()) throw std::runtime_error("Usage: save fname[.arm] [#start #end] [sparse]");
+  if (start > end) throw std::runtime_error("Save range: start must not be after end.");
+
+  std::ofstream out(f, std::ios::binary);
+  if (!out) throw std::runtime_error("Cannot write file: " + f);
+  out << "; saved by simulator\n";
+  const std::size_t n = mem.saveHex(out, Memory::addrToIndex(start), Memory::addrToIndex(end), sparse);
+  if (!out) throw std::runtime_error("Write failed: " + f);
+  std::cout << "Saved " << n << " words to " << f << "\n";
 }
 
 void Simulator::cmdLoad(const std::string& fnameIn) {
   auto f = ensureArmExt(trim(fnameIn));
-  auto lines = readAllLines(f);
-  mem.loadProgramHexLines(lines);
-  cpu.setPC(0);
+  std::ifstream in(f);
+  if (!in) throw std::runtime_error("Cannot open file: " + f);
+  mem.loadHex(in);
+  cpu().setPC(0);
   ui.setCursor(0);
   std::cout << "Loaded " << f << "\n";
 }
 
+void Simulator::cmdTranslate(const std::string& fnameIn) {
+  auto f = trim(fnameIn);
+  if (f.empty()) throw std::runtime_error("Usage: translate fname[.cpp]");
+  if (f.size() < 4 || f.substr(f.size() - 4) != ".cpp") f += ".cpp";
+  std::ofstream out(f);
+  if (!out) throw std::runtime_error("Cannot write file: " + f);
+  out << Translator::translate(cpu(), mem, f);
+  std::cout << "Translated from PC=" << cpu().getPC() << " to " << f
+            << " (build with: make xlat XLAT=" << f << ")\n";
+}
+
+static void printAsmResult(const AsmSession::Result& r, const std::string& f, double ms) {
+  std::cout << f << ": " << r.lines << " lines, " << r.words << " words; re-encoded " << r.reencoded
+            << ", patched " << r.patched << " in " << std::fixed << std::setprecision(3) << ms << " ms\n";
+  std::cout.unsetf(std::ios::floatfield);
+}
+
+void Simulator::cmdAsm(const std::string& restIn) {
+  // asm fname [#base]
+  std::istringstream iss(restIn);
+  std::string f, baseTok;
+  iss >> f >> baseTok;
+  if (f.empty()) throw std::runtime_error("Usage: asm fname [#base]");
+  u64 base = baseTok.empty() ? 0 : parseHashNum(baseTok);
+  const u64 t0 = nowNs();
+  auto r = source.load(f, base, mem);
+  printAsmResult(r, f, (double)(nowNs() - t0) / 1e6);
+  cpu().setPC(base);
+}
+
+void Simulator::cmdReload() {
+  const u64 t0 = nowNs();
+  auto r = source.reload(mem);
+  printAsmResult(r, source.file(), (double)(nowNs() - t0) / 1e6);
+}
+
+void Simulator::cmdOptimize(const std::string& restIn) {
+  // optimize [reportfile]
+  auto f = trim(restIn);
+  std::vector<u64> entries{0};
+  for (auto& h : harts) {
+    entries.push_back(h.getPC());
+    // Interrupt handlers are only reached through VECTOR; finding them lets
+    // the optimizer see their ERET and leave the code in place.
+    const auto& irq = h.getInterrupts();
+    entries.push_back(irq.vector);
+    if (irq.inHandler) entries.push_back(irq.elr);
+  }
+  const u64 t0 = nowNs();
+  auto r = Optimizer::optimize(mem, entries);
+  const double ms = (double)(nowNs() - t0) / 1e6;
+
+  // Everything that holds a code address follows the code.
+  const auto map = [&r](u64 a) { return r.map(a); };
+  for (auto& h : harts) {
+    h.setPC(r.map(h.getPC()));
+    if (r.relocation.count(h.getX(30))) h.setX(30, r.map(h.getX(30)));
+    CallStack calls = h.getCallStack();
+    calls.relocate(map);
+    h.setCallStack(calls);
+  }
+  if (!r.relocation.empty()) {
+    const auto covered = [&r](u64 a) { return r.wasRemoved(a) ? ~0ull : r.map(a); };
+    for (auto& c : hartCoverage) c->relocate(covered);
+    mergedCoverage.relocate(covered);
+    sampler.relocate(map);
+    // The call graph is keyed by function addresses, and removed code could
+    // merge two of them: start over.
+    if (profiling()) {
+      profiler.start(harts[profiledHart].getPC(), harts[profiledHart].counters().instret);
+      std::cout << "Profile restarted: code moved.\n";
+    } else if (profiler.started()) {
+      profiler = CallProfiler{};
+    }
+  }
+  std::vector<std::tuple<u64, std::string, u64>> moved;
+  for (auto& [a, bp] : breakpoints.list()) moved.emplace_back(a, bp->condText, bp->ignore);
+  breakpoints.clear();
+  for (auto& [a, cond, ignore] : moved) breakpoints.set(r.map(a), cond, ignore);
+  std::vector<std::string> lines; // source lines of the changed words, before they move
+  for (const auto& c : r.changes) lines.push_back(sourceLocation(c.addr));
+  if (source.active()) source.relocate(r);
+
+  std::ofstream file;
+  if (!f.empty()) {
+    file.open(f);
+    if (!file) throw std::runtime_error("Cannot write file: " + f);
+  }
+  std::ostream& out = f.empty() ? std::cout : file;
+  out << "Optimized " << r.codeWords << " instructions: removed " << r.removed << ", retargeted "
+      << r.retargeted << " branches in " << std::fixed << std::setprecision(3) << ms << " ms\n";
+  out.unsetf(std::ios::floatfield);
+  if (!r.notMoved.empty()) out << "Code left in place: " << r.notMoved << "\n";
+  for (std::size_t i = 0; i < r.changes.size(); i++) {
+    const auto& c = r.changes[i];
+    out << "  " << c.addr;
+    if (c.after.empty()) out << ": " << c.before << "  (removed)";
+    else {
+      if (r.map(c.addr) != c.addr) out << " -> " << r.map(c.addr);
+      out << ": " << c.before << "  =>  " << c.after;
+    }
+    out << "  [" << c.rule << "]" << lines[i] << "\n";
+  }
+  if (!f.empty()) std::cout << "Optimized: removed " << r.removed << " of " << r.codeWords
+                            << " instructions; report written to " << f << "\n";
+}
+
+void Simulator::writeCheckpoint(const std::string& fname, bool quiet) {
+  syncOutput(); // guest output up to the checkpoint is out before it exists
+  Checkpoint ck;
+  for (const auto& h : harts) ck.harts.push_back(Checkpoint::capture(h));
+  ck.curHart = curHart;
+  ck.title = ui.getTitle();
+  for (const auto& [addr, bp] : breakpoints.list()) ck.breakpoints.push_back({addr, bp->condText, bp->ignore, bp->hits});
+  const u64 t0 = nowNs();
+  const auto r = ck.save(fname, mem);
+  if (quiet) return;
+  std::cout << "Checkpoint written to " << fname << ": " << r.bytes << " bytes, " << r.pages << " of "
+            << (mem.sizeWords() + Checkpoint::kPageWords - 1) / Checkpoint::kPageWords << " pages, "
+            << (nowNs() - t0) / 1000000 << " ms\n";
+}
+
+void Simulator::cmdCheckpoint(const std::string& restIn) {
+  // checkpoint fname           -> save the whole machine now
+  // checkpoint every N fname   -> also save from headless runs every N instructions
+  // checkpoint off | checkpoint
+  std::istringstream iss(restIn);
+  std::string first, f;
+  iss >> first;
+  if (first.empty()) {
+    if (checkpointEvery) std::cout << "Auto-checkpoint every " << checkpointEvery << " instructions to " << checkpointFile << "\n";
+    else std::cout << "Auto-checkpoint off.\n";
+    return;
+  }
+  if (first == "off") {
+    checkpointEvery = 0;
+    std::cout << "Auto-checkpoint off.\n";
+    return;
+  }
+  if (first == "every") {
+    std::string n;
+    iss >> n >> f;
+    if (n.empty() || f.empty()) throw std::runtime_error("Usage: checkpoint every N fname");
+    const u64 every = parseHashNum(n);
+    if (every == 0) throw std::runtime_error("Checkpoint interval must be positive.");
+    checkpointEvery = every;
+    checkpointFile = f;
+    std::cout << "Auto-checkpoint every " << checkpointEvery << " instructions to " << checkpointFile << "\n";
+    return;
+  }
+  writeCheckpoint(first, false);
+}
+
+void Simulator::cmdResume(const std::string& restIn) {
+  auto f = trim(restIn);
+  if (f.empty()) throw std::runtime_error("Usage: resume fname");
+  const u64 t0 = nowNs();
+  const auto ck = Checkpoint::load(f, mem);
+  if (ck.harts.size() > (std::size_t)kMaxHarts) throw std::runtime_error("Checkpoint has too many harts: " + f);
+  // A resumed hart starts with fresh counters apart from instret.
+  resizeHarts(ck.harts.size());
+  for (std::size_t i = 0; i < harts.size(); i++) {
+    harts[i].counters() = {};
+    Checkpoint::apply(ck.harts[i], harts[i]);
+  }
+  curHart = (std::size_t)ck.curHart;
+  ui.setTitle(ck.title);
+  breakpoints.clear();
+  for (const auto& b : ck.breakpoints) breakpoints.set(b.addr, b.cond, b.ignore, b.hits);
+  host.clearExit();
+  showState();
+  std::cout << "\nResumed " << f << ": " << harts.size() << " hart(s), " << (u64)mem.sizeWords() * 4
+            << " bytes of memory, hart " << curHart << " at PC=" << cpu().getPC() << " after "
+            << cpu().counters().instret << " instructions (" << (nowNs() - t0) / 1000000 << " ms)\n";
+}
+
+void Simulator::cmdWhere(const std::string& restIn) {
+  // where #addr  -> source line that produced the word at addr
+  // where line N -> address of source line N
+  auto rest = trim(restIn);
+  if (!source.active()) throw std::runtime_error("No assembly source loaded (use asm fname).");
+  if (startsWith(rest, "line ")) {
+    std::size_t n = (std::size_t)std::stoul(trim(rest.substr(5)));
+    auto a = source.addrForLine(n);
+    if (!a) std::cout << "Line " << n << " produces no word.\n";
+    else std::cout << source.file() << ":" << n << " is at PC=" << *a << "\n";
+    return;
+  }
+  u64 addr = rest.empty() ? cpu().getPC() : parseHashNum(rest);
+  auto n = source.lineForAddr(addr);
+  if (!n) std::cout << "PC=" << addr << " is not from " << source.file() << "\n";
+  else std::cout << source.file() << ":" << *n << ": " << trim(source.lineText(*n)) << "\n";
+}
+
+std::string Simulator::sourceLocation(u64 addr) const {
+  auto n = source.lineForAddr(addr);
+  if (!n) return "";
+  return " (" + source.file() + ":" + std::to_string(*n) + ")";
+}
+
 void Simulator::cmdTitle(const std::string& rest) {
   ui.setTitle(trim(rest));
 }
 
 void Simulator::cmdClear(const std::string& whatIn) {
   auto w = trim(whatIn);
-  if (w == "registers") cpu.clearRegisters();
+  if (w == "registers") cpu().clearRegisters();
   else if (w == "memory") mem.clear();
-  else if (w.empty()) { cpu.reset(); mem.clear(); }
+  else if (w.empty()) {
+    for (auto& h : harts) h.reset();
+    mem.clear();
+  }
   else throw std::runtime_error("Usage: clear [registers|memory]");
 }
 
+u64 Simulator::parseMemSize(const std::string& textIn) {
+  auto t = trim(textIn);
+  if (!t.empty() && t[0] == '#') t = t.substr(1);
+  std::size_t used = 0;
+  u64 v = 0;
+  try {
+    v = (u64)std::stoull(t, &used, 0);
+  } catch (const std::exception&) {
+    throw std::runtime_error("Bad memory size: " + textIn);
+  }
+  std::string unit = t.substr(used);
+  u64 scale = 1;
+  if (unit == "K" || unit == "k") scale = 1ull << 10;
+  else if (unit == "M" || unit == "m") scale = 1ull << 20;
+  else if (unit == "G" || unit == "g") scale = 1ull << 30;
+  else if (!unit.empty()) throw std::runtime_error("Bad memory size: " + textIn);
+  if (v == 0 || v > kMaxMemBytes / scale) throw std::runtime_error("Memory size must be between 4 bytes and 16G.");
+  v *= scale;
+  if (v % 4 != 0) throw std::runtime_error("Memory size must be a multiple of 4 bytes.");
+  return v;
+}
+
+void Simulator::cmdMemSize(const std::string& restIn) {
+  // memsize         -> show the size
+  // memsize 64M     -> resize; words below the new size are kept
+  auto rest = trim(restIn);
+  if (!rest.empty()) {
+    mem.resize((std::size_t)(parseMemSize(rest) / 4));
+    attachCoverage();
+  }
+  std::cout << "Memory: " << (u64)mem.sizeWords() * 4 << " bytes (" << mem.sizeWords() << " words)\n";
+}
+
 void Simulator::cmdRun(const std::string& restIn) {
   std::istringstream iss(restIn);
   std::string mode;
@@ -247,15 +537,25 @@ void Simulator::cmdRun(const std::string& restIn) {
   //       * run         => fast, run-until-halt
   //       * run fast    => fast, run-until-halt
   //       * run slow    => slow, defaults to 20 interactive steps
+  //       * run quiet   => headless, run-until-halt or breakpoint
   int steps = -1;
   bool runUntilHalt = false;
   iss >> mode;
+  if (mode == "parallel" || mode == "rr") {
+    // run parallel [nsteps]      => every hart on its own host thread
+    // run rr [quantum [nsteps]]  => deterministic round-robin on this thread
+    u64 quantum = kDefaultQuantum, n = kMaxQuietSteps, v = 0;
+    if (mode == "rr" && iss >> v) quantum = v;
+    if (iss >> v) n = v;
+    runAllHarts(mode == "parallel", quantum, n);
+    return;
+  }
   if (mode.empty()) {
     mode = "fast";
     runUntilHalt = true;
   }
   else {
-    if (mode != "fast" && mode != "slow") {
+    if (mode != "fast" && mode != "slow" && mode != "quiet") {
       // maybe first token was steps
       steps = std::stoi(mode);
       mode = "slow";
@@ -264,28 +564,555 @@ void Simulator::cmdRun(const std::string& restIn) {
 
   if (steps < 0) {
     if (!(iss >> steps)) {
-      if (mode == "fast") runUntilHalt = true;
+      if (mode == "fast" || mode == "quiet") runUntilHalt = true;
       else steps = 20;
     }
   }
 
+  if (mode == "quiet") {
+    runHeadless(runUntilHalt ? kMaxQuietSteps : (u64)std::max(steps, 0));
+    return;
+  }
+
   const int kMaxUntilHaltSteps = 1'000'000; // safety against infinite loops
+  auto& perf = cpu().counters();
+  const u64 startInstr = perf.instret;
+  const u64 startNs = nowNs();
   int executed = 0;
   while (true) {
-    ui.printState(cpu, mem);
-    bool cont = cpu.step(mem);
+    emitState();
+    u64 t0 = nowNs();
+    bool cont = cpu().step(mem);
+    perf.execNs += nowNs() - t0;
     executed++;
-    if (!cont) { std::cout << "\nHALT\n"; running = false; break; }
+    if (!cont) { syncOutput(); reportHalt(); break; }
     if (mode == "slow") {
+      syncOutput();
       std::cout << "Press ENTER to step...";
       std::string dummy; std::getline(std::cin, dummy);
     }
     if (!runUntilHalt && executed >= steps) break;
     if (runUntilHalt && executed >= kMaxUntilHaltSteps) {
+      syncOutput();
       std::cout << "\nStopped after " << executed << " steps (safety cap).\n";
       break;
     }
   }
+  perf.lastRunInstr = perf.instret - startInstr;
+  perf.lastRunNs = nowNs() - startNs;
+}
+
+void Simulator::runHeadless(u64 maxSteps, const i64* stopDepth) {
+  auto& perf = cpu().counters();
+  const u64 startInstr = perf.instret;
+  const u64 t0 = nowNs();
+  // With auto-checkpoints on, run in pieces that end on the next multiple
+  // of checkpointEvery; the time spent writing counts as execution.
+  StopReason why = StopReason::StepLimit;
+  std::string checkpointError;
+  for (u64 left = maxSteps; left > 0;) {
+    const u64 chunk = checkpointEvery ? std::min(left, checkpointEvery - perf.instret % checkpointEvery) : left;
+    const u64 before = perf.instret;
+    why = sampling() && curHart == sampledHart
+      ? sampler.run(cpu(), mem, chunk, &breakpoints, stopDepth)
+      : stopDepth ? cpu().runToDepth(mem, chunk, *stopDepth, &breakpoints)
+                  : cpu().run(mem, chunk, &breakpoints);
+    const u64 retired = perf.instret - before;
+    left -= std::min(left, retired);
+    if (!checkpointEvery || retired == 0) break;
+    if (perf.instret % checkpointEvery == 0) {
+      try {
+        writeCheckpoint(checkpointFile, true);
+      } catch (const std::exception& e) {
+        checkpointError = e.what();
+        checkpointEvery = 0;
+      }
+    }
+    if (why != StopReason::StepLimit) break;
+  }
+  const u64 dt = nowNs() - t0;
+  perf.execNs += dt;
+  perf.lastRunInstr = perf.instret - startInstr;
+  perf.lastRunNs = dt;
+
+  showState();
+  if (!checkpointError.empty()) std::cout << "\nAuto-checkpoint turned off: " << checkpointError << "\n";
+  if (why == StopReason::Halt) {
+    reportHalt();
+  } else if (why == StopReason::Breakpoint) {
+    std::cout << "\nBreakpoint hit at PC=" << cpu().getPC() << sourceLocation(cpu().getPC()) << "\n";
+  } else if (why == StopReason::Return) {
+    std::cout << "\nStopped at PC=" << cpu().getPC() << sourceLocation(cpu().getPC()) << " after "
+              << perf.lastRunInstr << " instructions\n";
+  } else {
+    std::cout << "\nStopped after " << perf.lastRunInstr << " steps.\n";
+  }
+}
+
+void Simulator::cmdNext() {
+  // Over a BL: run until the call depth is back where it is now, i.e. the
+  // callee (and everything it calls) has returned. Otherwise one instruction.
+  const u32 instr = mem.loadWord(cpu().getPC());
+  const i64 depth = cpu().getCallDepth();
+  if (enc::get(instr, 31, 26) != enc::OP_BL) {
+    runHeadless(1, &depth);
+    return;
+  }
+  runHeadless(kMaxQuietSteps, &depth);
+}
+
+void Simulator::cmdFinish() {
+  // Run until the current function returns to its caller.
+  const i64 depth = cpu().getCallDepth() - 1;
+  runHeadless(kMaxQuietSteps, &depth);
+}
+
+void Simulator::runAllHarts(bool parallel, u64 quantum, u64 maxStepsPerHart) {
+  std::vector<u64> before;
+  for (auto& h : harts) before.push_back(h.counters().instret);
+
+  std::size_t stopped = harts.size();
+  const u64 t0 = nowNs();
+  auto reasons = parallel
+    ? Harts::runParallel(harts, mem, maxStepsPerHart)
+    : Harts::runRoundRobin(harts, mem, quantum, maxStepsPerHart, &breakpoints, stopped);
+  const u64 dt = nowNs() - t0;
+
+  u64 total = 0;
+  bool allHalted = true;
+  for (std::size_t i = 0; i < harts.size(); i++) {
+    auto& perf = harts[i].counters();
+    perf.lastRunInstr = perf.instret - before[i];
+    perf.lastRunNs = dt;
+    total += perf.lastRunInstr;
+    if (reasons[i] != StopReason::Halt) allHalted = false;
+  }
+  if (stopped < harts.size()) curHart = stopped;
+  // One wall-clock interval for the whole machine: charged once, to the
+  // selected hart, so execute time is not counted N times over.
+  cpu().counters().execNs += dt;
+
+  showState();
+  std::cout << "\n";
+  for (std::size_t i = 0; i < harts.size(); i++) {
+    const char* why = reasons[i] == StopReason::Halt ? "HALT"
+                    : reasons[i] == StopReason::Breakpoint ? "breakpoint" : "step limit";
+    std::cout << "hart " << i << ": " << why << ", " << harts[i].counters().lastRunInstr
+              << " instr, PC=" << harts[i].getPC() << "\n";
+  }
+  std::cout << total << " instructions on " << harts.size() << " harts ("
+            << (parallel ? "parallel" : "round-robin, quantum " + std::to_string(quantum)) << ") in "
+            << std::fixed << std::setprecision(3) << (double)dt / 1e6 << " ms\n";
+  std::cout.unsetf(std::ios::floatfield);
+  if (stopped < harts.size()) std::cout << "Breakpoint hit on hart " << stopped << " at PC=" << cpu().getPC() << "\n";
+  if (allHalted) reportHalt();
+}
+
+void Simulator::cmdHarts(const std::string& restIn) {
+  // harts     -> list harts
+  // harts N   -> resize; new harts start as copies of hart 0 (registers, PC)
+  auto rest = trim(restIn);
+  if (!rest.empty()) {
+    int n = std::stoi(rest);
+    if (n < 1 || n > kMaxHarts) throw std::runtime_error("Hart count must be 1.." + std::to_string(kMaxHarts) + ".");
+    resizeHarts((std::size_t)n);
+  }
+  for (std::size_t i = 0; i < harts.size(); i++) {
+    std::cout << (i == curHart ? "* " : "  ") << "hart " << i << ": PC=" << harts[i].getPC()
+              << ", retired " << harts[i].counters().instret << "\n";
+  }
+}
+
+void Simulator::cmdDevices(const std::string& restIn) {
+  // devices              -> list device pages and each hart's timer
+  // devices NAME #addr   -> map NAME's page at #addr (above memory)
+  // devices NAME off     -> unmap it
+  std::istringstream iss(restIn);
+  std::string name, where;
+  if (iss >> name) {
+    std::shared_ptr<Device> dev;
+    if (name == uart->name()) dev = uart;
+    else if (name == timer->name()) dev = timer;
+    else throw std::runtime_error("Unknown device: " + name + " (uart, timer).");
+    if (!(iss >> where)) throw std::runtime_error("Usage: devices NAME #addr | devices NAME off");
+    if (where == "off") mem.unmapDevice(*dev);
+    else mem.mapDevice(parseAddrToken(where), dev);
+  }
+  std::cout << "Devices:\n";
+  for (const Device* dev : {(const Device*)uart.get(), (const Device*)timer.get()}) {
+    u64 base = 0;
+    std::cout << "  " << std::left << std::setw(6) << dev->name() << std::right;
+    if (mem.deviceBase(*dev, base)) std::cout << "at 0x" << std::hex << base << std::dec;
+    else std::cout << "unmapped";
+    std::cout << ": " << dev->status() << "\n";
+  }
+  for (std::size_t i = 0; i < harts.size(); i++) {
+    const Interrupts& irq = harts[i].getInterrupts();
+    std::cout << "  hart " << i << ": timer ";
+    if (irq.at == Interrupts::kNever) std::cout << "off";
+    else std::cout << (irq.period ? "every " + std::to_string(irq.period) : std::string("once"))
+                   << ", due at instret " << irq.at << ", vector " << irq.vector;
+    std::cout << ", " << irq.taken << " interrupts taken" << (irq.inHandler ? " (in handler)" : "") << "\n";
+  }
+}
+
+void Simulator::resizeHarts(std::size_t n) {
+  if (profiledHart >= n) stopProfile();
+  if (sampledHart >= n) sampleOn = false;
+  while (harts.size() > n) harts.pop_back();
+  while (harts.size() < n) {
+    CPU h = harts[0];
+    h.setHartId((int)harts.size());
+    h.setCallProfiler(nullptr);
+    h.setCoverage(nullptr);
+    h.counters() = {};
+    h.setInterrupts({});
+    harts.push_back(h);
+  }
+  if (curHart >= harts.size()) curHart = 0;
+  attachCoverage();
+}
+
+void Simulator::cmdHart(const std::string& restIn) {
+  auto rest = trim(restIn);
+  if (rest.empty()) throw std::runtime_error("Usage: hart <index>");
+  int i = std::stoi(rest);
+  if (i < 0 || i >= (int)harts.size()) throw std::runtime_error("No such hart.");
+  curHart = (std::size_t)i;
+}
+
+static std::string fmtRate(u64 num, u64 den) {
+  std::ostringstream oss;
+  oss << std::fixed << std::setprecision(1) << (den ? 100.0 * (double)num / (double)den : 0.0) << "%";
+  return oss.str();
+}
+
+static double perSecond(u64 count, u64 ns) {
+  return ns ? (double)count * 1e9 / (double)ns : 0.0;
+}
+
+static std::string statsJson(const PerfCounters& p) {
+  std::ostringstream oss;
+  oss << "{\n"
+      << "  \"instret\": " << p.instret << ",\n"
+      << "  \"exec_ns\": " << p.execNs << ",\n"
+      << "  \"render_ns\": " << p.renderNs << ",\n"
+      << "  \"parse_ns\": " << p.parseNs << ",\n"
+      << "  \"last_run_instr\": " << p.lastRunInstr << ",\n"
+      << "  \"last_run_ns\": " << p.lastRunNs << ",\n"
+      << "  \"last_run_ips\": " << std::fixed << std::setprecision(1) << perSecond(p.lastRunInstr, p.lastRunNs) << ",\n"
+      << "  \"bp_checks\": " << p.bpChecks << ",\n"
+      << "  \"bp_hits\": " << p.bpHits << ",\n"
+      << "  \"fused_pairs\": " << p.fusedPairs << "\n"
+      << "}\n";
+  return oss.str();
+}
+
+void Simulator::cmdVRegs() {
+  // Non-zero vector registers as 4 x 32-bit lanes, lane 0 first.
+  bool any = false;
+  std::cout << std::hex << std::uppercase << std::setfill('0');
+  for (int i = 0; i < 32; i++) {
+    const Vec128& v = cpu().getV(i);
+    if (v.isZero()) continue;
+    any = true;
+    std::cout << "V" << std::dec << i << std::hex << (i < 10 ? " " : "") << " =";
+    for (int l = 0; l < 4; l++) std::cout << " 0x" << std::setw(8) << v.lane32(l);
+    std::cout << "\n";
+  }
+  std::cout << std::dec << std::nouppercase << std::setfill(' ');
+  if (!any) std::cout << "All vector registers are zero.\n";
+}
+
+void Simulator::cmdStats(const std::string& restIn) {
+  // stats              -> human-readable table
+  // stats json [file]  -> JSON to stdout or file
+  // stats reset        -> zero all counters
+  std::istringstream iss(restIn);
+  std::string sub, fname;
+  iss >> sub >> fname;
+  auto& p = cpu().counters();
+
+  if (sub == "reset") {
+    p = {};
+    std::cout << "Counters reset.\n";
+    return;
+  }
+  if (sub == "json") {
+    auto text = statsJson(p);
+    if (fname.empty()) { std::cout << text; return; }
+    std::ofstream out(fname);
+    if (!out) throw std::runtime_error("Cannot write file: " + fname);
+    out << text;
+    std::cout << "Wrote " << fname << "\n";
+    return;
+  }
+  if (!sub.empty()) throw std::runtime_error("Usage: stats [json [file]|reset]");
+
+  auto ms = [](u64 ns) { return (double)ns / 1e6; };
+  std::cout << std::fixed << std::setprecision(3);
+  std::cout << "instructions retired : " << p.instret << "\n";
+  std::cout << "execute time         : " << ms(p.execNs) << " ms\n";
+  std::cout << "render time          : " << ms(p.renderNs) << " ms\n";
+  std::cout << "REPL parse time      : " << ms(p.parseNs) << " ms\n";
+  std::cout << "last run             : " << p.lastRunInstr << " instr in " << ms(p.lastRunNs) << " ms ("
+            << std::setprecision(2) << perSecond(p.lastRunInstr, p.lastRunNs) / 1e6 << " MIPS)\n";
+  std::cout << "breakpoint checks    : " << p.bpChecks << " (hit " << fmtRate(p.bpHits, p.bpChecks) << ")\n";
+  std::cout << "fused pairs          : " << p.fusedPairs << " (" << fmtRate(2 * p.fusedPairs, p.instret)
+            << " of instructions)\n";
+  std::cout.unsetf(std::ios::floatfield);
+  std::cout << std::setprecision(6);
+}
+
+bool Simulator::profiling() const {
+  return profiledHart < harts.size() && harts[profiledHart].getCallProfiler() == &profiler;
+}
+
+void Simulator::stopProfile() {
+  if (!profiling()) return;
+  profileEnd = harts[profiledHart].counters().instret;
+  harts[profiledHart].setCallProfiler(nullptr);
+}
+
+std::string Simulator::symbolName(u64 addr) const {
+  const std::string* best = nullptr;
+  for (auto& [label, a] : source.symbolTable()) {
+    if (a == addr && (!best || label < *best)) best = &label;
+  }
+  if (best) return *best;
+  std::ostringstream oss;
+  oss << "0x" << std::hex << addr;
+  return oss.str();
+}
+
+void Simulator::cmdProfile(const std::string& restIn) {
+  // profile start         -> profile the selected hart from its current PC
+  // profile stop          -> stop feeding the profiler (data is kept)
+  // profile [N]           -> top N functions by inclusive instructions (default 20)
+  // profile folded file   -> folded stacks for flame-graph tools
+  std::istringstream iss(restIn);
+  std::string sub, arg;
+  iss >> sub >> arg;
+
+  if (sub == "start") {
+    stopProfile();
+    profiledHart = curHart;
+    profiler.start(cpu().getPC(), cpu().counters().instret);
+    cpu().setCallProfiler(&profiler);
+    std::cout << "Profiling hart " << curHart << " from PC=" << cpu().getPC() << "\n";
+    return;
+  }
+  if (!profiler.started()) throw std::runtime_error("No profile (use profile start).");
+  const u64 now = profiling() ? harts[profiledHart].counters().instret : profileEnd;
+  if (sub == "stop") {
+    stopProfile();
+    std::cout << "Profiling stopped.\n";
+    return;
+  }
+  if (sub == "folded") {
+    if (arg.empty()) throw std::runtime_error("Usage: profile folded fname");
+    std::ofstream out(arg);
+    if (!out) throw std::runtime_error("Cannot write file: " + arg);
+    profiler.writeFolded(out, now, [this](u64 a) { return symbolName(a); });
+    std::cout << "Wrote " << arg << "\n";
+    return;
+  }
+  std::size_t top = 20;
+  if (!sub.empty()) top = (std::size_t)std::stoul(sub);
+
+  auto funcs = profiler.functions(now);
+  u64 total = 0;
+  for (auto& f : funcs) total += f.exclusive;
+  std::cout << std::left << std::setw(24) << "function" << std::right << std::setw(10) << "calls"
+            << std::setw(14) << "exclusive" << std::setw(8) << "%" << std::setw(14) << "inclusive"
+            << std::setw(8) << "%" << "\n";
+  for (std::size_t i = 0; i < funcs.size() && i < top; i++) {
+    auto& f = funcs[i];
+    std::cout << std::left << std::setw(24) << symbolName(f.addr) << std::right << std::setw(10) << f.calls
+              << std::setw(14) << f.exclusive << std::setw(8) << fmtRate(f.exclusive, total)
+              << std::setw(14) << f.inclusive << std::setw(8) << fmtRate(f.inclusive, total) << "\n";
+  }
+  std::cout << total << " instructions profiled" << (profiling() ? "" : " (stopped)")
+            << ", shadow stack depth " << profiler.depth() << "\n";
+}
+
+void Simulator::attachCoverage() {
+  while (hartCoverage.size() > harts.size()) {
+    mergedCoverage.merge(*hartCoverage.back());
+    hartCoverage.pop_back();
+  }
+  while (coverageOn && hartCoverage.size() < harts.size()) hartCoverage.push_back(std::make_unique<Coverage>());
+  for (std::size_t i = 0; i < harts.size(); i++) {
+    Coverage* c = nullptr;
+    if (coverageOn) {
+      c = hartCoverage[i].get();
+      c->resize(mem.sizeWords());
+    }
+    harts[i].setCoverage(c);
+  }
+}
+
+Coverage Simulator::totalCoverage() const {
+  Coverage total = mergedCoverage;
+  for (auto& c : hartCoverage) total.merge(*c);
+  return total;
+}
+
+void Simulator::cmdCoverage(const std::string& restIn) {
+  // coverage on|off        -> start/stop collecting on every hart
+  // coverage reset         -> forget everything collected or merged
+  // coverage [report [f]]  -> annotated listing to stdout or a file
+  // coverage save f        -> coverage file (mergeable)
+  // coverage merge f       -> OR a coverage file into the current data
+  std::istringstream iss(restIn);
+  std::string sub, f;
+  iss >> sub >> f;
+
+  if (sub == "on" || sub == "off") {
+    coverageOn = sub == "on";
+    attachCoverage();
+    std::cout << "Coverage " << sub << ".\n";
+    return;
+  }
+  if (sub == "reset") {
+    mergedCoverage = Coverage();
+    for (auto& c : hartCoverage) c->reset();
+    std::cout << "Coverage reset.\n";
+    return;
+  }
+  if (sub == "save" || sub == "merge") {
+    if (f.empty()) throw std::runtime_error("Usage: coverage " + sub + " fname");
+    if (sub == "merge") {
+      std::ifstream in(f);
+      if (!in) throw std::runtime_error("Cannot open file: " + f);
+      mergedCoverage.mergeFile(in);
+      std::cout << "Merged " << f << "\n";
+      return;
+    }
+    std::ofstream out(f);
+    if (!out) throw std::runtime_error("Cannot write file: " + f);
+    totalCoverage().save(out);
+    std::cout << "Wrote " << f << "\n";
+    return;
+  }
+  if (!sub.empty() && sub != "report") throw std::runtime_error("Usage: coverage [on|off|reset|report [fname]|save fname|merge fname]");
+
+  // List up to the last word that holds something or was executed.
+  auto total = totalCoverage();
+  std::size_t end = mem.sizeWords();
+  while (end > 0 && mem.getWordIndex(end - 1) == 0 && !total.at(end - 1)) end--;
+  // Code is what the loaded source produced; without one, any non-zero word.
+  auto isCode = [this](u64 a) {
+    return source.active() ? source.lineForAddr(a).has_value() : mem.loadWord(a) != 0;
+  };
+  auto where = [this](u64 a) { return sourceLocation(a); };
+  if (f.empty()) {
+    total.report(std::cout, mem, end, isCode, where);
+    return;
+  }
+  std::ofstream out(f);
+  if (!out) throw std::runtime_error("Cannot write file: " + f);
+  total.report(out, mem, end, isCode, where);
+  std::cout << "Wrote " << f << "\n";
+}
+
+bool Simulator::sampling() const {
+  return sampleOn && sampledHart < harts.size();
+}
+
+void Simulator::cmdSample(const std::string& restIn) {
+  // sample start [period] -> sample the selected hart's headless runs
+  // sample stop           -> stop sampling (samples are kept)
+  // sample [N]            -> top N PCs and functions (default 20)
+  std::istringstream iss(restIn);
+  std::string sub, arg;
+  iss >> sub >> arg;
+
+  if (sub == "start") {
+    u64 period = arg.empty() ? Sampler::kDefaultPeriod : parseHashNum(arg);
+    if (period == 0) throw std::runtime_error("Sample period must be at least 1.");
+    sampledHart = curHart;
+    sampler.start(period);
+    sampleOn = true;
+    std::cout << "Sampling hart " << curHart << " every ~" << period
+              << " instructions (continue / run quiet / next / finish)\n";
+    return;
+  }
+  if (sub == "stop") {
+    sampleOn = false;
+    std::cout << "Sampling stopped.\n";
+    return;
+  }
+  if (!sampler.started()) throw std::runtime_error("No samples (use sample start).");
+  std::size_t top = 20;
+  if (sub == "report") sub = arg;
+  if (!sub.empty()) top = (std::size_t)std::stoul(sub);
+  sampler.report(std::cout, mem, top, [this](u64 a) { return symbolName(a); },
+                 [this](u64 a) { return sourceLocation(a); });
+}
+
+void Simulator::emitState() {
+  if (scriptDepth) return;
+  const u64 t0 = nowNs();
+  if (asyncOutput) out.push(UI::snapshot(cpu(), mem));
+  else ui.printState(cpu(), mem);
+  cpu().counters().renderNs += nowNs() - t0;
+}
+
+void Simulator::showState() {
+  if (scriptDepth) { redrawPending = true; return; }
+  redraw();
+}
+
+void Simulator::redraw() {
+  redrawPending = false;
+  syncOutput();
+  const u64 t0 = nowNs();
+  ui.printState(cpu(), mem);
+  cpu().counters().renderNs += nowNs() - t0;
+}
+
+void Simulator::reportHalt() {
+  std::cout << "\nHALT";
+  if (host.exited()) {
+    exitStatus = (int)host.exitCode();
+    std::cout << " (exit code " << host.exitCode() << ")";
+    host.clearExit();
+  }
+  std::cout << "\n";
+  running = false;
+}
+
+void Simulator::syncOutput() {
+  out.flush();
+  uart->flush();
+  host.flush();
+  if (out.dropped() != droppedReported) {
+    std::cout << "\n(" << (out.dropped() - droppedReported) << " frames dropped by output pipeline)\n";
+    droppedReported = out.dropped();
+  }
+}
+
+void Simulator::cmdOutput(const std::string& restIn) {
+  // output                 -> show current mode
+  // output sync            -> render frames on the execution thread
+  // output async [drop]    -> render on the writer thread; 'drop' skips frames
+  //                           instead of waiting when the writer lags
+  std::istringstream iss(restIn);
+  std::string mode, policy;
+  iss >> mode >> policy;
+  if (mode == "sync") asyncOutput = false;
+  else if (mode == "async") {
+    asyncOutput = true;
+    if (policy.empty() || policy == "block") out.setPolicy(OutputPipeline::Policy::Block);
+    else if (policy == "drop") out.setPolicy(OutputPipeline::Policy::Drop);
+    else throw std::runtime_error("Usage: output [sync|async [block|drop]]");
+  }
+  else if (!mode.empty()) throw std::runtime_error("Usage: output [sync|async [block|drop]]");
+
+  std::cout << "Output: " << (asyncOutput ? "async" : "sync");
+  if (asyncOutput) std::cout << (out.getPolicy() == OutputPipeline::Policy::Drop ? " (drop)" : " (block)");
+  std::cout << ", frames written " << out.written() << ", dropped " << out.dropped() << "\n";
 }
 
 void Simulator::cmdAssembleToMemory(const std::string& line) {
@@ -293,48 +1120,137 @@ void Simulator::cmdAssembleToMemory(const std::string& line) {
   // not execute it immediately. This matches the reference simulator behavior.
   auto w = Assembler::assembleLine(line);
   if (!w) return;
-  u64 pc = cpu.getPC();
+  u64 pc = cpu().getPC();
   mem.storeWord(pc, *w);
   // Auto-advance PC so the user can type the next instruction naturally.
-  cpu.setPC(pc + 4);
+  cpu().setPC(pc + 4);
+}
+
+void Simulator::cmdSet(const std::string& rest) {
+  // set NAME EXPR
+  const std::string r = trim(rest);
+  const auto sp = r.find_first_of(" \t");
+  if (sp == std::string::npos) throw std::runtime_error("Usage: set NAME EXPR");
+  const std::string name = r.substr(0, sp);
+  if (!ScriptVars::validName(name)) throw std::runtime_error("Bad variable name: " + name);
+  vars.set(name, vars.eval(r.substr(sp + 1)));
+}
+
+void Simulator::cmdSource(const std::string& fname) {
+  if (scriptDepth == kMaxScriptDepth) throw std::runtime_error("Scripts nested too deeply.");
+  const u64 t0 = nowNs();
+  const Script script = Script::load(fname);
+  u64 commands = 0;
+  scriptDepth++;
+  try {
+    commands = script.run(vars, [this](const std::string& l) { execLine(l); return running; });
+  } catch (...) {
+    if (--scriptDepth == 0 && redrawPending) redraw();
+    throw;
+  }
+  const u64 dt = nowNs() - t0;
+  if (--scriptDepth == 0 && redrawPending) redraw();
+  syncOutput();
+  std::cout << "\n" << fname << ": " << commands << " commands in "
+            << std::fixed << std::setprecision(1) << dt / 1e6 << " ms\n" << std::defaultfloat;
+}
+
+void Simulator::execLine(const std::string& line) {
+  if (line.find('$') == std::string::npos) dispatch(line);
+  else dispatch(vars.expand(line));
+}
+
+void Simulator::dispatch(const std::string& line) {
+  if (line == "help") { ui.printHelp(); return; }
+  if (line == "quit" || line == "exit") { running = false; return; }
+
+  if (startsWith(line, "memory ")) { cmdMemory(line.substr(7)); showState(); return; }
+  if (startsWith(line, "PC")) { cmdPC(line); showState(); return; }
+  if (startsWith(line, "M[")) { cmdSetMem(line); showState(); return; }
+  if (startsWith(line, "R[") || startsWith(line, "X")) { cmdSetReg(line); showState(); return; }
+  if (startsWith(line, "save ")) { cmdSave(line.substr(5)); return; }
+  if (startsWith(line, "load ")) { cmdLoad(line.substr(5)); showState(); return; }
+  if (startsWith(line, "title ")) { cmdTitle(line.substr(6)); showState(); return; }
+  if (startsWith(line, "clear")) {
+    std::string arg = "";
+    if (line.size() > 5) arg = line.substr(5);
+    cmdClear(arg);
+    showState();
+    return;
+  }
+  if (startsWith(line, "run")) {
+    std::string arg = "";
+    if (line.size() > 3) arg = line.substr(3);
+    cmdRun(arg);
+    return;
+  }
+  if (line == "step" || startsWith(line, "step ")) { cmdStep(line.substr(4)); return; }
+  if (line == "next" || line == "n") { cmdNext(); return; }
+  if (line == "finish" || line == "fin") { cmdFinish(); return; }
+  if (line == "continue" || line == "cont" || line == "c") { cmdContinue(""); return; }
+  if (line == "memsize" || startsWith(line, "memsize ")) { cmdMemSize(line.substr(7)); return; }
+  if (line == "break" || startsWith(line, "break ")) { cmdBreak(line.substr(5)); return; }
+  if (line == "output" || startsWith(line, "output ")) { cmdOutput(line.substr(6)); return; }
+  if (line == "coverage" || startsWith(line, "coverage ")) { cmdCoverage(line.substr(8)); return; }
+  if (line == "sample" || startsWith(line, "sample ")) { cmdSample(line.substr(6)); return; }
+  if (line == "profile" || startsWith(line, "profile ")) { cmdProfile(line.substr(7)); return; }
+  if (line == "stats" || startsWith(line, "stats ")) { cmdStats(line.substr(5)); return; }
+  if (line == "vregs") { cmdVRegs(); return; }
+  if (line == "devices" || startsWith(line, "devices ")) { cmdDevices(line.substr(7)); return; }
+  if (startsWith(line, "translate ")) { cmdTranslate(line.substr(10)); return; }
+  if (startsWith(line, "asm ")) { cmdAsm(line.substr(4)); showState(); return; }
+  if (line == "reload") { cmdReload(); showState(); return; }
+  if (line == "optimize" || startsWith(line, "optimize ")) { cmdOptimize(line.substr(8)); return; }
+  if (line == "checkpoint" || startsWith(line, "checkpoint ")) { cmdCheckpoint(line.substr(10)); return; }
+  if (startsWith(line, "resume ")) { cmdResume(line.substr(7)); return; }
+  if (line == "where" || startsWith(line, "where ")) { cmdWhere(line.substr(5)); return; }
+  if (line == "harts" || startsWith(line, "harts ")) { cmdHarts(line.substr(5)); return; }
+  if (line == "show") { redraw(); return; }
+  if (startsWith(line, "set ")) { cmdSet(line.substr(4)); return; }
+  if (startsWith(line, "source ")) { cmdSource(trim(line.substr(7))); return; }
+  if (line == "end" || startsWith(line, "for ")) throw std::runtime_error("'for' and 'end' only work in scripts (source FILE).");
+  if (startsWith(line, "hart ")) { cmdHart(line.substr(5)); showState(); std::cout << "\nSelected hart " << curHart << "\n"; return; }
+
+  // Otherwise treat as instruction line
+  cmdAssembleToMemory(line);
+  showState();
 }
 
-void Simulator::repl() {
-  ui.printState(cpu, mem);
+int Simulator::repl(const std::vector<std::string>& scripts) {
+  // One redraw for all the -s scripts together, not one per script.
+  scriptDepth++;
+  for (const auto& fname : scripts) {
+    if (!running) break;
+    try {
+      cmdSource(fname);
+    } catch (const std::exception& e) {
+      syncOutput();
+      std::cout << "Error: " << e.what() << "\n";
+    }
+  }
+  scriptDepth--;
+  if (!running) return exitStatus; // HALT or quit in a script
+  if (scripts.empty() || redrawPending) showState();
   std::string line;
-  while (running && std::cout << "\n> " && std::getline(std::cin, line)) {
+  while (running && (syncOutput(), std::cout << "\n> ") && std::getline(std::cin, line)) {
     line = trim(line);
     if (line.empty()) continue;
-    try {
-      if (line == "help") { ui.printHelp(); continue; }
-      if (line == "quit" || line == "exit") break;
-
-      if (startsWith(line, "memory ")) { cmdMemory(line.substr(7)); ui.printState(cpu, mem); continue; }
-      if (startsWith(line, "PC")) { cmdPC(line); ui.printState(cpu, mem); continue; }
-      if (startsWith(line, "M[")) { cmdSetMem(line); ui.printState(cpu, mem); continue; }
-      if (startsWith(line, "R[") || startsWith(line, "X")) { cmdSetReg(line); ui.printState(cpu, mem); continue; }
-      if (startsWith(line, "save ")) { cmdSave(line.substr(5)); continue; }
-      if (startsWith(line, "load ")) { cmdLoad(line.substr(5)); ui.printState(cpu, mem); continue; }
-      if (startsWith(line, "title ")) { cmdTitle(line.substr(6)); ui.printState(cpu, mem); continue; }
-      if (startsWith(line, "clear")) {
-        std::string arg = "";
-        if (line.size() > 5) arg = line.substr(5);
-        cmdClear(arg);
-        ui.printState(cpu, mem);
-        continue;
-      }
-      if (startsWith(line, "run")) {
-        std::string arg = "";
-        if (line.size() > 3) arg = line.substr(3);
-        cmdRun(arg);
-        continue;
-      }
 
-      // Otherwise treat as instruction line
-      cmdAssembleToMemory(line);
-      ui.printState(cpu, mem);
+    // Whatever a command spends outside execution and rendering is parse/dispatch overhead.
+    // The counters are re-fetched afterwards: 'harts N' and 'resume' reallocate the harts.
+    const u64 t0 = nowNs();
+    const u64 busy0 = cpu().counters().execNs + cpu().counters().renderNs;
+    try {
+      execLine(line);
     } catch (const std::exception& e) {
+      syncOutput(); // guest output from before a fault comes first
       std::cout << "Error: " << e.what() << "\n";
     }
+    auto& perf = cpu().counters();
+    const u64 busy1 = perf.execNs + perf.renderNs;
+    const u64 total = nowNs() - t0;
+    // Counters reset or another hart selected: nothing to compare against.
+    if (busy1 >= busy0 && total > busy1 - busy0) perf.parseNs += total - (busy1 - busy0);
   }
+  return exitStatus;
 }
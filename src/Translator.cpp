@@ -0,0 +1,353 @@
+#include "Translator.h"
+#include "Assembler.h"
+#include "Encoding.h"
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <set>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+// What the translator needs to know about one instruction word.
+enum class Kind { Simple, Mem, Branch, BranchLink, CondBranch, Ret, Halt, Unknown };
+
+struct Insn {
+  u32 word = 0;
+  Kind kind = Kind::Unknown;
+  u64 target = 0; // branch target (B/BL/CBZ/CBNZ/B.cond)
+};
+
+Insn classify(u32 w, u64 pc) {
+  using namespace enc;
+  Insn in;
+  in.word = w;
+  if (w == OP_HALT) { in.kind = Kind::Halt; return in; }
+  if (w == OP_NOP) { in.kind = Kind::Simple; return in; }
+
+  u32 op6  = get(w,31,26);
+  u32 op8  = get(w,31,24);
+  u32 op10 = get(w,31,22);
+  u32 op11 = get(w,31,21);
+
+  if (op6 == OP_B || op6 == OP_BL) {
+    in.kind = op6 == OP_B ? Kind::Branch : Kind::BranchLink;
+    in.target = pc + 4ull * (u64)sext(get(w,25,0), 26);
+    return in;
+  }
+  if (op8 == OP_CBZ || op8 == OP_CBNZ || op8 == OP_BCOND) {
+    in.kind = Kind::CondBranch;
+    in.target = pc + 4ull * (u64)sext(get(w,23,5), 19);
+    return in;
+  }
+  if (op10 == OP_ADDI || op10 == OP_SUBI || op10 == OP_ADDIS || op10 == OP_SUBIS) { in.kind = Kind::Simple; return in; }
+  if (op11 == OP_LDUR || op11 == OP_STUR || isSizedLoad(op11) || isSizedStore(op11)) { in.kind = Kind::Mem; return in; }
+  if (op11 == OP_ADD || op11 == OP_SUB || op11 == OP_ADDS || op11 == OP_SUBS) { in.kind = Kind::Simple; return in; }
+  if (op11 == OP_XEXT) {
+    auto f = (XFunct)get(w,15,10);
+    switch (f) {
+      case XFunct::CMP: case XFunct::AND: case XFunct::ORR: case XFunct::EOR:
+      case XFunct::LSL: case XFunct::LSR: case XFunct::MUL: case XFunct::HARTID:
+        in.kind = Kind::Simple; return in;
+      case XFunct::CAS: case XFunct::LDADD:
+        in.kind = Kind::Mem; return in;
+      case XFunct::RET:
+        in.kind = Kind::Ret; return in;
+      case XFunct::HCALL: case XFunct::ERET:
+        break; // host I/O and interrupt returns: left to the interpreter
+    }
+  }
+  return in; // Unknown
+}
+
+std::string x(u32 r) { return "x" + std::to_string(r); }
+
+// C++ for a non-control-flow instruction (Simple/Mem kinds).
+std::string body(u32 w) {
+  using namespace enc;
+  std::ostringstream o;
+  if (w == OP_NOP) return "";
+
+  u32 op10 = get(w,31,22);
+  u32 op11 = get(w,31,21);
+  u32 rm = get(w,20,16), rn = get(w,9,5), rd = get(w,4,0);
+
+  if (op10 == OP_ADDI || op10 == OP_SUBI || op10 == OP_ADDIS || op10 == OP_SUBIS) {
+    u32 imm = get(w,21,10);
+    const bool add = (op10 == OP_ADDI || op10 == OP_ADDIS);
+    if (op10 == OP_ADDIS) o << "fl.setAdd(" << x(rn) << ", " << imm << "u); ";
+    if (op10 == OP_SUBIS) o << "fl.setSub(" << x(rn) << ", " << imm << "u); ";
+    o << x(rd) << " = " << x(rn) << (add ? " + " : " - ") << imm << "u;";
+    return o.str();
+  }
+  if (op11 == OP_ADD || op11 == OP_SUB || op11 == OP_ADDS || op11 == OP_SUBS) {
+    const bool add = (op11 == OP_ADD || op11 == OP_ADDS);
+    if (op11 == OP_ADDS) o << "fl.setAdd(" << x(rn) << ", " << x(rm) << "); ";
+    if (op11 == OP_SUBS) o << "fl.setSub(" << x(rn) << ", " << x(rm) << "); ";
+    o << x(rd) << " = " << x(rn) << (add ? " + " : " - ") << x(rm) << ";";
+    return o.str();
+  }
+  if (op11 == OP_LDUR || op11 == OP_STUR) {
+    i64 off = sext(get(w,20,12), 9);
+    std::string ea = x(rn) + " + (u64)" + std::to_string(off) + "ll";
+    if (op11 == OP_LDUR) o << x(rd) << " = (u64)mem.loadWord(" << ea << ", &cpu);";
+    else o << "{ u64 ea = " << ea << "; mem.storeWord(ea, (u32)" << x(rd) << ", &cpu); CODE_STORE(ea); }";
+    return o.str();
+  }
+  if (isSizedLoad(op11)) {
+    const std::string ea = x(rn) + " + (u64)" + std::to_string(sext(get(w,20,12), 9)) + "ll";
+    o << x(rd) << " = ";
+    if (op11 == OP_LDURB) o << "(u64)mem.loadByte(" << ea << ");";
+    else if (op11 == OP_LDURH) o << "(u64)mem.loadHalf(" << ea << ");";
+    else if (op11 == OP_LDURSW) o << "(u64)(i64)(std::int32_t)mem.loadWord(" << ea << ", &cpu);";
+    else o << "mem.loadDouble(" << ea << ");";
+    return o.str();
+  }
+  if (isSizedStore(op11)) {
+    // CODE_STORE tests one byte address; test enough bytes of the store
+    // that it cannot straddle a code word unnoticed.
+    const std::string ea = x(rn) + " + (u64)" + std::to_string(sext(get(w,20,12), 9)) + "ll";
+    o << "{ u64 ea = " << ea << "; ";
+    if (op11 == OP_STURB) o << "mem.storeByte(ea, (u8)" << x(rd) << "); CODE_STORE(ea); }";
+    else if (op11 == OP_STURH) o << "mem.storeHalf(ea, (u16)" << x(rd) << "); CODE_STORE(ea); CODE_STORE(ea + 1); }";
+    else o << "mem.storeDouble(ea, " << x(rd) << "); CODE_STORE(ea); CODE_STORE(ea + 4); CODE_STORE(ea + 7); }";
+    return o.str();
+  }
+  switch ((XFunct)get(w,15,10)) {
+    case XFunct::CMP: o << "fl.setSub(" << x(rn) << ", " << x(rm) << ");"; break;
+    case XFunct::AND: o << x(rd) << " = " << x(rn) << " & " << x(rm) << ";"; break;
+    case XFunct::ORR: o << x(rd) << " = " << x(rn) << " | " << x(rm) << ";"; break;
+    case XFunct::EOR: o << x(rd) << " = " << x(rn) << " ^ " << x(rm) << ";"; break;
+    case XFunct::MUL: o << x(rd) << " = " << x(rn) << " * " << x(rm) << ";"; break;
+    case XFunct::LSL: o << x(rd) << " = " << x(rn) << " << " << (rm & 63) << ";"; break;
+    case XFunct::LSR: o << x(rd) << " = " << x(rn) << " >> " << (rm & 63) << ";"; break;
+    case XFunct::HARTID: o << x(rd) << " = (u64)cpu.getHartId();"; break;
+    case XFunct::CAS:
+      o << "{ u64 ea = " << x(rn) << "; " << x(rm) << " = (u64)mem.compareExchangeWord(ea, (u32)" << x(rm)
+        << ", (u32)" << x(rd) << "); CODE_STORE(ea); }";
+      break;
+    case XFunct::LDADD:
+      o << "{ u64 ea = " << x(rn) << "; " << x(rd) << " = (u64)mem.fetchAddWord(ea, (u32)" << x(rm)
+        << "); CODE_STORE(ea); }";
+      break;
+    case XFunct::RET: case XFunct::HCALL: case XFunct::ERET: break;
+  }
+  return o.str();
+}
+
+std::string label(u64 pc) { return "B_" + std::to_string(pc); }
+
+} // namespace
+
+std::string Translator::translate(const CPU& cpu, const Memory& mem, const std::string& title) {
+  const u64 entry = cpu.getPC();
+  const u64 memBytes = (u64)mem.sizeWords() * 4;
+
+  // 1) Discover reachable instructions and block leaders.
+  std::map<u64, Insn> code;
+  std::set<u64> leaders{entry};
+  std::vector<u64> work{entry};
+  auto push = [&](u64 a) {
+    if (a % 4 == 0 && a < memBytes && !code.count(a)) work.push_back(a);
+  };
+  while (!work.empty()) {
+    u64 pc = work.back();
+    work.pop_back();
+    if (code.count(pc) || pc % 4 != 0 || pc >= memBytes) continue;
+    Insn in = classify(mem.loadWord(pc), pc);
+    code[pc] = in;
+    switch (in.kind) {
+      case Kind::Simple: case Kind::Mem:
+        push(pc + 4);
+        break;
+      case Kind::Branch:
+        leaders.insert(in.target); push(in.target);
+        break;
+      case Kind::BranchLink: case Kind::CondBranch:
+        leaders.insert(in.target); push(in.target);
+        leaders.insert(pc + 4); push(pc + 4);
+        break;
+      case Kind::Ret: case Kind::Halt: case Kind::Unknown:
+        break;
+    }
+  }
+  // Keep only leaders that are translated instructions.
+  for (auto it = leaders.begin(); it != leaders.end();) {
+    if (code.count(*it)) ++it;
+    else it = leaders.erase(it);
+  }
+  // Instructions from each leader up to the branch, HALT or next leader
+  // that ends its block.
+  std::map<u64, u64> blockLen;
+  for (u64 a : leaders) {
+    u64 len = 0;
+    for (u64 p = a; code.count(p); p += 4) {
+      len++;
+      const Kind k = code[p].kind;
+      if ((k != Kind::Simple && k != Kind::Mem) || leaders.count(p + 4)) break;
+    }
+    blockLen[a] = len;
+  }
+  const u64 codeLo = code.empty() ? 0 : code.begin()->first;
+  const u64 codeHi = code.empty() ? 0 : code.rbegin()->first + 4;
+
+  std::ostringstream o;
+  o << "// Generated by the arm_sim translator from '" << title << "'. Do not edit.\n";
+  o << "// Build: make xlat XLAT=<this file>\n";
+  o << "#include \"Translator.h\"\n\n";
+
+  // 2) Baked machine state.
+  std::size_t imageWords = mem.sizeWords();
+  while (imageWords > 0 && mem.getWordIndex(imageWords - 1) == 0) imageWords--;
+  o << "const std::size_t xlatMemWords = " << mem.sizeWords() << ";\n";
+  o << "const std::size_t xlatImageWords = " << imageWords << ";\n";
+  o << "const u32 xlatImage[] = {";
+  for (std::size_t i = 0; i < imageWords; i++) {
+    o << (i % 8 == 0 ? "\n  " : " ") << "0x" << std::hex << std::uppercase << std::setw(8)
+      << std::setfill('0') << mem.getWordIndex(i) << std::dec << "u,";
+  }
+  o << "\n  0u\n};\n";
+  o << "const u64 xlatInitRegs[32] = {";
+  for (int i = 0; i < 32; i++) o << (i % 4 == 0 ? "\n  " : " ") << cpu.getX(i) << "ull,";
+  o << "\n};\n";
+  o << "const u64 xlatInitPc = " << entry << "ull;\n";
+  auto f = cpu.getFlags();
+  o << "const Flags xlatInitFlags = {" << f.N << ", " << f.Z << ", " << f.C << ", " << f.V << "};\n\n";
+
+  o << "static const u64 kEntries[] = {";
+  for (u64 a : leaders) o << " " << a << "ull,";
+  o << " 0ull };\n";
+  o << "static const std::size_t kNumEntries = " << leaders.size() << ";\n\n";
+
+  // 3) The translated function.
+  o << "StopReason xlatRun(CPU& cpu, Memory& mem, u64 maxSteps) {\n";
+  for (int i = 0; i < 32; i++) o << "  u64 x" << i << " = cpu.getX(" << i << ");\n";
+  o << "  LazyFlags fl = cpu.getLazyFlags();\n";
+  o << "  u64 pc = cpu.getPC();\n";
+  o << "  u64 n = cpu.counters().instret;\n";
+  o << "  const u64 limit = maxSteps > ~0ull - n ? ~0ull : n + maxSteps;\n";
+  o << "  bool selfModified = false;\n";
+  o << "  bool nearLimit = false; // the interpreter runs the last few steps\n";
+  o << "  bool interpreting = false; // CPU, not the locals, holds the state\n\n";
+
+  o << "#define SPILL() do { \\\n";
+  for (int i = 0; i < 32; i++) o << "    cpu.setX(" << i << ", x" << i << "); \\\n";
+  o << "    cpu.setLazyFlags(fl); cpu.setPC(pc); cpu.counters().instret = n; \\\n  } while (0)\n";
+  o << "#define RELOAD() do { \\\n";
+  for (int i = 0; i < 32; i++) o << "    x" << i << " = cpu.getX(" << i << "); \\\n";
+  o << "    fl = cpu.getLazyFlags(); pc = cpu.getPC(); n = cpu.counters().instret; \\\n  } while (0)\n";
+  o << "  // Stores into translated code leave the translation for good.\n";
+  std::string inCode = "(ea) < " + std::to_string(codeHi) + "ull";
+  if (codeLo > 0) inCode = "(ea) >= " + std::to_string(codeLo) + "ull && " + inCode;
+  o << "#define CODE_STORE(ea) do { if (" << inCode
+    << ") { pc += 4; n++; selfModified = true; goto to_interp; } } while (0)\n\n";
+
+  o << "  try {\n";
+  o << "  dispatch:\n";
+  o << "    switch (pc) {\n";
+  for (u64 a : leaders) o << "      case " << a << "ull: goto " << label(a) << ";\n";
+  o << "      default: goto to_interp;\n";
+  o << "    }\n\n";
+
+  for (auto it = code.begin(); it != code.end(); ++it) {
+    const u64 pc = it->first;
+    const Insn& in = it->second;
+    if (leaders.count(pc)) {
+      o << "  " << label(pc) << ":\n";
+      // A block runs whole, so one longer than the steps left goes to the
+      // interpreter and the run stops at exactly maxSteps.
+      o << "    if (limit - n < " << blockLen[pc] << "ull) { pc = " << pc
+        << "ull; nearLimit = true; goto to_interp; }\n";
+    }
+    o << "    // " << pc << ": " << Assembler::disasm(in.word, pc) << "\n";
+
+    // Instructions retire one at a time so 'n' and 'pc' are exact if a
+    // memory access faults or execution leaves the translation.
+    const std::string next = std::to_string(pc + 4) + "ull";
+    switch (in.kind) {
+      case Kind::Simple: {
+        std::string b = body(in.word);
+        if (!b.empty()) o << "    " << b << "\n";
+        o << "    n++;\n";
+        break;
+      }
+      case Kind::Mem:
+        o << "    pc = " << pc << "ull;\n";
+        o << "    " << body(in.word) << "\n";
+        o << "    n++;\n";
+        break;
+      case Kind::Branch:
+        o << "    n++; goto " << label(in.target) << ";\n";
+        break;
+      case Kind::BranchLink:
+        o << "    x30 = " << next << "; n++; goto " << label(in.target) << ";\n";
+        break;
+      case Kind::CondBranch: {
+        using namespace enc;
+        const u32 w = in.word;
+        const u32 op8 = get(w,31,24);
+        std::string cond;
+        if (op8 == OP_CBZ) cond = x(get(w,4,0)) + " == 0";
+        else if (op8 == OP_CBNZ) cond = x(get(w,4,0)) + " != 0";
+        else cond = "fl.cond(" + std::to_string(get(w,3,0)) + "u)";
+        o << "    n++;\n";
+        o << "    if (" << cond << ") goto " << label(in.target) << ";\n";
+        o << "    goto " << label(pc + 4) << ";\n";
+        break;
+      }
+      case Kind::Ret:
+        o << "    pc = " << x(enc::get(in.word,9,5)) << "; n++; goto dispatch;\n";
+        break;
+      case Kind::Halt:
+        o << "    pc = " << pc << "ull; goto exit_halt;\n";
+        break;
+      case Kind::Unknown:
+        o << "    pc = " << pc << "ull; goto to_interp; // interpreter reports the fault\n";
+        break;
+    }
+    // Falling into the next block without a branch.
+    auto nx = std::next(it);
+    const bool fallsThrough = in.kind == Kind::Simple || in.kind == Kind::Mem;
+    if (fallsThrough && (nx == code.end() || nx->first != pc + 4)) {
+      o << "    pc = " << next << "; goto dispatch;\n";
+    }
+  }
+
+  o << "\n  to_interp:\n";
+  o << "    SPILL();\n";
+  o << "    interpreting = true;\n";
+  o << "    switch (Translator::interpret(cpu, mem, limit, kEntries, kNumEntries,\n"
+    << "                                     selfModified || nearLimit)) {\n";
+  o << "      case Translator::Resume::Halt: return StopReason::Halt;\n";
+  o << "      case Translator::Resume::StepLimit: return StopReason::StepLimit;\n";
+  o << "      case Translator::Resume::Translated: break;\n";
+  o << "    }\n";
+  o << "    interpreting = false;\n";
+  o << "    RELOAD();\n";
+  o << "    goto dispatch;\n\n";
+  // Only emit exit labels something jumps to (unused labels warn).
+  bool anyHalt = false;
+  for (auto& [a, in] : code) anyHalt = anyHalt || in.kind == Kind::Halt;
+  if (anyHalt) {
+    o << "  exit_halt:\n";
+    o << "    SPILL();\n";
+    o << "    return StopReason::Halt;\n\n";
+  }
+  o << "  } catch (...) {\n";
+  o << "    if (!interpreting) SPILL();\n";
+  o << "    throw;\n";
+  o << "  }\n";
+  o << "#undef SPILL\n#undef RELOAD\n#undef CODE_STORE\n";
+  o << "}\n";
+  return o.str();
+}
+
+Translator::Resume Translator::interpret(CPU& cpu, Memory& mem, u64 limit,
+                                         const u64* entries, std::size_t nEntries, bool untilHalt) {
+  while (cpu.counters().instret < limit) {
+    if (!untilHalt && std::binary_search(entries, entries + nEntries, cpu.getPC())) return Resume::Translated;
+    if (!cpu.step(mem)) return Resume::Halt;
+  }
+  return Resume::StepLimit;
+}
@@ -1,5 +1,6 @@
 #include "UI.h"
 #include "Assembler.h"
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
@@ -10,17 +11,26 @@ static std::string hex32(u32 v) {
   return oss.str();
 }
 
-void UI::printState(const CPU& cpu, const Memory& mem) const {
-  using std::cout;
-  using std::setw;
-
-  u64 pc = cpu.getPC();
-  u32 instr = 0;
+StateRecord UI::snapshot(const CPU& cpu, const Memory& mem) {
+  StateRecord rec;
+  rec.pc = cpu.getPC();
   try {
-    instr = mem.loadWord(pc);
+    rec.instr = mem.loadWord(rec.pc);
   } catch (...) {
-    instr = 0;
+    rec.instr = 0;
   }
+  rec.flags = cpu.getFlags();
+  for (int i = 0; i < 32; i++) rec.X[(std::size_t)i] = cpu.getX(i);
+  rec.windowValid = std::min(StateRecord::kWindowWords, mem.sizeWords());
+  for (std::size_t i = 0; i < rec.windowValid; i++) rec.window[i] = mem.getWordIndex(i);
+  return rec;
+}
+
+void UI::render(const StateRecord& rec, std::ostream& cout) const {
+  using std::setw;
+
+  const u64 pc = rec.pc;
+  const u32 instr = rec.instr;
 
   cout << "\n" << title << "\n";
   cout << "PC = " << pc << ", instruction = " << hex32(instr) << " =\n";
@@ -33,27 +43,24 @@ void UI::printState(const CPU& cpu, const Memory& mem) const {
   // Each row shows two words: M[addr] and M[addr+4].
   // The '>' marker highlights the current PC word (either column).
   for (int i = 0; i < 32; i++) {
-    cout << "X" << std::setfill('0') << std::setw(2) << i << std::setfill(' ') << setw(20) << cpu.getX(i);
+    cout << "X" << std::setfill('0') << std::setw(2) << i << std::setfill(' ') << setw(20) << rec.X[(std::size_t)i];
 
     // memory row index (reference simulator shows the whole fixed 0..248 window)
     u64 addr = (u64)(i * 8);
     auto printWordAt = [&](u64 a) -> std::string {
-      try {
-        u32 w = mem.loadWord(a);
-        if (memMode == MemMode::HEX) return hex32(w);
-        if (memMode == MemMode::CODE) return Assembler::disasm(w, a);
-        return std::to_string((u64)w);
-      } catch (...) {
-        return "?";
-      }
+      std::size_t idx = (std::size_t)(a / 4);
+      if (idx >= rec.windowValid) return "?";
+      u32 w = rec.window[idx];
+      if (memMode == MemMode::HEX) return hex32(w);
+      if (memMode == MemMode::CODE) return Assembler::disasm(w, a);
+      return std::to_string((u64)w);
     };
 
     std::string left = printWordAt(addr);
     std::string right = printWordAt(addr + 4);
 
-    const u64 pcNow = cpu.getPC();
-    const char leftMark  = (pcNow == addr) ? '>' : ' ';
-    const char rightMark = (pcNow == addr + 4) ? '>' : ' ';
+    const char leftMark  = (pc == addr) ? '>' : ' ';
+    const char rightMark = (pc == addr + 4) ? '>' : ' ';
 
     cout << "  " << leftMark << " M[" << std::setw(3) << std::setfill('0') << addr << std::setfill(' ') << "] = " << left;
     cout << setw(10) << " ";
@@ -61,8 +68,13 @@ void UI::printState(const CPU& cpu, const Memory& mem) const {
     cout << "\n";
   }
 
-  auto fl = cpu.getFlags();
-  cout << "\nFlags: Z=" << (fl.Z ? 1 : 0) << " N=" << (fl.N ? 1 : 0) << "\n";
+  auto fl = rec.flags;
+  cout << "\nFlags: N=" << (fl.N ? 1 : 0) << " Z=" << (fl.Z ? 1 : 0)
+       << " C=" << (fl.C ? 1 : 0) << " V=" << (fl.V ? 1 : 0) << "\n";
+}
+
+void UI::printState(const CPU& cpu, const Memory& mem) const {
+  render(snapshot(cpu, mem), std::cout);
 }
 
 void UI::printHelp() const {
@@ -72,12 +84,31 @@ void UI::printHelp() const {
   cout << "M[#00]=#\n";
   cout << "R[#]=#, X#=#\n";
   cout << "break [#addr] | break list | break del #addr | break toggle #addr | break clear\n";
+  cout << "break #addr if X3 == #10 && M[#64] > #0 [after N] (conditional; stops after N qualifying hits)\n";
   cout << "step [n] (execute n instructions, stops before next breakpoint)\n";
+  cout << "next | n (step over a BL at full speed) | finish | fin (run until the current function returns)\n";
   cout << "continue | cont | c (continue execution; steps once if currently on a breakpoint)\n";
-  cout << "save fname[.arm]\n";
+  cout << "save fname[.arm] [#start #end] [sparse] (byte range; sparse skips zero runs)\n";
+  cout << "translate fname[.cpp] (emit a native C++ translation of the program at PC)\n";
   cout << "load fname[.arm]\n";
+  cout << "memsize [SIZE] (show or resize memory, e.g. memsize 64M; contents that fit are kept)\n";
+  cout << "asm fname [#base] | reload | where [#addr] | where line N (assembly source with labels)\n";
+  cout << "optimize [reportfile] (peephole pass over the program in memory; lists every change)\n";
+  cout << "checkpoint fname | checkpoint every N fname | checkpoint off | resume fname (whole machine to/from disk)\n";
   cout << "title title\n";
   cout << "clear registers, clear memory, clear\n";
   cout << "ARM instruction (LDUR,STUR,B,CBZ,CBNZ,ADD,SUB,AND,ORR,ADDI,SUBI + extras)\n";
-  cout << "run [fast|slow] [nsteps] (default: 20 steps for slow; fast runs until HALT)\n";
+  cout << "LDURB/LDURH/LDURSW/LDURD, STURB/STURH/STURD Xt, [Xn, #imm] (byte, halfword, signed word, 64-bit)\n";
+  cout << "devices | devices uart|timer #addr | devices uart|timer off (memory-mapped UART, timer + cycle counter; ERET)\n";
+  cout << "source fname (run a command script, redrawing once at the end) | show (redraw now)\n";
+  cout << "set NAME EXPR (script variable; $NAME, ${NAME}, $(EXPR) in any command) | for NAME FIRST LAST [STEP] ... end (scripts only)\n";
+  cout << "run [fast|slow|quiet] [nsteps] (default: 20 steps for slow; fast runs until HALT; quiet runs headless)\n";
+  cout << "output [sync|async [block|drop]] (render run/step frames on a writer thread)\n";
+  cout << "stats | stats json [file] | stats reset (simulator performance counters)\n";
+  cout << "vregs (non-zero vector registers V0..V31, as 4 x 32-bit lanes)\n";
+  cout << "profile start | profile stop | profile [N] | profile folded fname (BL/RET call-graph profile)\n";
+  cout << "sample start [period] | sample stop | sample [N] (sampling profiler for headless runs)\n";
+  cout << "coverage on|off|reset | coverage [report [fname]] | coverage save|merge fname (instruction/branch coverage)\n";
+  cout << "harts [N] | hart i (list/resize harts sharing memory; select the hart shown and edited)\n";
+  cout << "run parallel [nsteps] | run rr [quantum [nsteps]] (run all harts: host threads / deterministic round-robin)\n";
 }
@@ -0,0 +1,209 @@
+#include "armsim.h"
+#include "Breakpoints.h"
+#include "CPU.h"
+#include "HostCalls.h"
+#include "Memory.h"
+#include <exception>
+#include <istream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+
+struct armsim_machine {
+  Memory mem;
+  CPU cpu;
+  Breakpoints breakpoints;
+  armsim_stop stop = ARMSIM_STOP_NONE;
+  mutable std::string error; // last failure, also set by const queries
+  std::string output[2];     // guest fd 1 and 2
+  std::string input;
+  std::size_t inputPos = 0;
+  HostCalls host;
+
+  explicit armsim_machine(std::size_t words)
+      : mem(words),
+        host([this](int fd, const char* p, std::size_t n) { output[fd == 2].append(p, n); },
+             [this](char* p, std::size_t n) {
+               std::size_t got = input.copy(p, n, inputPos);
+               inputPos += got;
+               return got;
+             }) {
+    cpu.setHostCalls(&host);
+  }
+};
+
+namespace {
+
+// Read-only stream over the caller's buffer, so loadHex needs no copy.
+struct BufferView : std::streambuf {
+  BufferView(const char* p, std::size_t n) {
+    char* b = const_cast<char*>(p); // never written through: no put area, no putback
+    setg(b, b, b + n);
+  }
+};
+
+// Runs 'f', turning an exception into ARMSIM_ERROR and the machine's error text.
+template <class F>
+int guarded(const armsim_machine* m, F&& f) {
+  try {
+    f();
+    m->error.clear();
+    return ARMSIM_OK;
+  } catch (const std::exception& e) {
+    m->error = e.what();
+    return ARMSIM_ERROR;
+  }
+}
+
+bool validReg(const armsim_machine* m, int r) {
+  if (r >= 0 && r <= 31) return true;
+  m->error = "Register index out of range.";
+  return false;
+}
+
+} // namespace
+
+extern "C" {
+
+armsim_machine* armsim_create(size_t memBytes) {
+  if (memBytes == 0) memBytes = 256;
+  if (memBytes % 4 != 0) return nullptr;
+  try {
+    return new armsim_machine(memBytes / 4);
+  } catch (const std::exception&) {
+    return nullptr;
+  }
+}
+
+void armsim_destroy(armsim_machine* m) { delete m; }
+
+void armsim_reset(armsim_machine* m) {
+  m->cpu.reset();
+  m->cpu.counters() = {};
+  m->stop = ARMSIM_STOP_NONE;
+  m->error.clear();
+  m->host.flush();
+  m->host.clearExit();
+  m->output[0].clear();
+  m->output[1].clear();
+  m->input.clear();
+  m->inputPos = 0;
+}
+
+void armsim_clear_memory(armsim_machine* m) { m->mem.clear(); }
+
+size_t armsim_memory_bytes(const armsim_machine* m) { return m->mem.sizeWords() * 4; }
+
+int armsim_load_words(armsim_machine* m, uint64_t addr, const uint32_t* words, size_t n) {
+  return guarded(m, [&] {
+    std::size_t first = Memory::addrToIndex(addr);
+    if (first > m->mem.sizeWords() || n > m->mem.sizeWords() - first) {
+      throw std::runtime_error("Program too large for memory.");
+    }
+    for (std::size_t i = 0; i < n; i++) m->mem.setWordIndex(first + i, words[i]);
+  });
+}
+
+int armsim_load_hex(armsim_machine* m, const char* text, size_t len) {
+  return guarded(m, [&] {
+    BufferView buf(text, len);
+    std::istream in(&buf);
+    m->mem.loadHex(in);
+  });
+}
+
+int armsim_read_word(const armsim_machine* m, uint64_t addr, uint32_t* out) {
+  return guarded(m, [&] { *out = m->mem.loadWord(addr); });
+}
+
+int armsim_write_word(armsim_machine* m, uint64_t addr, uint32_t value) {
+  return guarded(m, [&] { m->mem.storeWord(addr, value); });
+}
+
+int armsim_get_x(const armsim_machine* m, int r, uint64_t* out) {
+  if (!validReg(m, r)) return ARMSIM_ERROR;
+  *out = m->cpu.getX(r);
+  return ARMSIM_OK;
+}
+
+int armsim_set_x(armsim_machine* m, int r, uint64_t value) {
+  if (!validReg(m, r)) return ARMSIM_ERROR;
+  m->cpu.setX(r, value);
+  return ARMSIM_OK;
+}
+
+int armsim_get_v(const armsim_machine* m, int r, uint32_t lanes[4]) {
+  if (!validReg(m, r)) return ARMSIM_ERROR;
+  const Vec128& v = m->cpu.getV(r);
+  for (int i = 0; i < 4; i++) lanes[i] = v.lane32(i);
+  return ARMSIM_OK;
+}
+
+int armsim_set_v(armsim_machine* m, int r, const uint32_t lanes[4]) {
+  if (!validReg(m, r)) return ARMSIM_ERROR;
+  Vec128 v;
+  for (int i = 0; i < 4; i++) v.setLane32(i, lanes[i]);
+  m->cpu.setV(r, v);
+  return ARMSIM_OK;
+}
+
+uint64_t armsim_get_pc(const armsim_machine* m) { return m->cpu.getPC(); }
+
+void armsim_set_pc(armsim_machine* m, uint64_t pc) { m->cpu.setPC(pc); }
+
+unsigned armsim_get_nzcv(const armsim_machine* m) {
+  Flags f = m->cpu.getFlags();
+  return (f.N ? ARMSIM_N : 0) | (f.Z ? ARMSIM_Z : 0) | (f.C ? ARMSIM_C : 0) | (f.V ? ARMSIM_V : 0);
+}
+
+int armsim_break(armsim_machine* m, uint64_t addr, const char* cond) {
+  return guarded(m, [&] { m->breakpoints.set(addr, cond ? cond : ""); });
+}
+
+int armsim_unbreak(armsim_machine* m, uint64_t addr) {
+  if (m->breakpoints.erase(addr)) return ARMSIM_OK;
+  m->error = "No breakpoint at that address.";
+  return ARMSIM_ERROR;
+}
+
+void armsim_clear_breaks(armsim_machine* m) { m->breakpoints.clear(); }
+
+armsim_stop armsim_run(armsim_machine* m, uint64_t maxSteps) {
+  auto& perf = m->cpu.counters();
+  const u64 before = perf.instret;
+  try {
+    switch (m->cpu.run(m->mem, maxSteps, &m->breakpoints)) {
+      case StopReason::Halt: m->stop = m->host.exited() ? ARMSIM_STOP_EXIT : ARMSIM_STOP_HALT; break;
+      case StopReason::Breakpoint: m->stop = ARMSIM_STOP_BREAKPOINT; break;
+      default: m->stop = ARMSIM_STOP_STEP_LIMIT; break;
+    }
+    m->error.clear();
+  } catch (const std::exception& e) {
+    m->stop = ARMSIM_STOP_ERROR;
+    m->error = e.what();
+  }
+  perf.lastRunInstr = perf.instret - before;
+  m->host.flush();
+  return m->stop;
+}
+
+armsim_stop armsim_stop_reason(const armsim_machine* m) { return m->stop; }
+
+uint64_t armsim_instret(const armsim_machine* m) { return m->cpu.counters().instret; }
+
+const char* armsim_output(const armsim_machine* m, int fd, size_t* len) {
+  const std::string& s = m->output[fd == 2];
+  if (len) *len = s.size();
+  return s.c_str();
+}
+
+void armsim_set_input(armsim_machine* m, const char* data, size_t len) {
+  m->input.assign(data, len);
+  m->inputPos = 0;
+}
+
+int64_t armsim_exit_code(const armsim_machine* m) { return m->host.exitCode(); }
+
+const char* armsim_error(const armsim_machine* m) { return m->error.c_str(); }
+
+} // extern "C"
@@ -1,10 +1,62 @@
 #include "Simulator.h"
+#include "Assembler.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <string>
+#include <vector>
 
-int main() {
+static void usage() {
+  std::cerr << "usage: arm [-m SIZE] [-s FILE]...           interactive simulator (SIZE e.g. 64M, default 256),\n"
+               "                                            running the command scripts FILE first\n"
+               "       arm [-j N] --assemble in.s out.arm   assemble a source file (N threads, default all cores)\n";
+}
+
+// Batch assembly: no REPL, the output is a .arm file loadable with 'load'.
+static int assembleFile(const std::string& in, const std::string& outName, unsigned threads) {
+  std::ifstream src(in);
+  if (!src) throw std::runtime_error("Cannot open file: " + in);
+  std::vector<std::string> lines;
+  std::string line;
+  while (std::getline(src, line)) lines.push_back(std::move(line));
+
+  auto t0 = std::chrono::steady_clock::now();
+  auto prog = Assembler::assembleSourceParallel(lines, 0, threads);
+  auto dt = std::chrono::steady_clock::now() - t0;
+
+  std::ofstream out(outName, std::ios::binary);
+  if (!out) throw std::runtime_error("Cannot write file: " + outName);
+  Memory::writeHexWords(out, prog.words.data(), prog.words.size(), 0, false);
+  if (!out) throw std::runtime_error("Write failed: " + outName);
+
+  std::cerr << in << ": " << lines.size() << " lines, " << prog.words.size() << " words in "
+            << std::chrono::duration<double, std::milli>(dt).count() << " ms\n";
+  return 0;
+}
+
+int main(int argc, char** argv) {
   try {
-    Simulator sim;
-    sim.repl();
+    unsigned threads = 0;
+    std::size_t memWords = 256/4;
+    std::vector<std::string> scripts;
+    for (int i = 1; i < argc; i++) {
+      if (std::strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+        threads = (unsigned)std::strtoul(argv[++i], nullptr, 10);
+      } else if (std::strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+        memWords = (std::size_t)(Simulator::parseMemSize(argv[++i]) / 4);
+      } else if (std::strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+        scripts.push_back(argv[++i]);
+      } else if (std::strcmp(argv[i], "--assemble") == 0 && i + 2 < argc) {
+        return assembleFile(argv[i + 1], argv[i + 2], threads);
+      } else {
+        usage();
+        return 2;
+      }
+    }
+    Simulator sim(memWords);
+    return sim.repl(scripts);
   } catch (const std::exception& e) {
     std::cerr << "Fatal: " << e.what() << "\n";
     return 1;
@@ -0,0 +1,504 @@
+// Differential fuzzer for the execution engines (make fuzz).
+//
+// Generates random instruction streams from the formats in Encoding.h,
+// with random registers, flags, data memory, breakpoints and timer
+// interrupt state (Interrupts in CPU.h), and runs each
+// one twice from the same initial state:
+//
+//   reference  CPU::step, one instruction at a time, breakpoints checked
+//              after every instruction (what 'step' does)
+//   engine     CPU::run in blocks of --block steps (the headless engine,
+//              with macro-op fusion)
+//
+// After every block the architectural state must match: X, V, PC, NZCV,
+// call depth, retired instructions, interrupt state, all of memory, how the
+// block ended and
+// the error message, if any. A mismatch is minimised (instructions turned
+// into NOPs, registers and data words zeroed, breakpoints dropped while it
+// still fails) and printed as an assembly listing.
+//
+//   fuzz [--seconds N] [--threads N] [--seed N] [--len N] [--block N]
+//   fuzz --case SEED [--len N] [--block N]
+//
+// --seconds 0 runs until a mismatch is found. --case regenerates the one
+// case a mismatch report names, runs it and minimises it again. Exit
+// status 1 on mismatch.
+#include "Assembler.h"
+#include "Breakpoints.h"
+#include "CPU.h"
+#include "Encoding.h"
+#include "HostCalls.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace enc;
+
+static constexpr std::size_t kMemWords = 256; // 1 KB: code from 0, data above
+static constexpr u64 kDataBase = 512;         // byte address of the data area
+static constexpr int kBlocks = 8;             // blocks compared per case
+
+struct Options {
+  double seconds = 10;
+  unsigned threads = 0; // 0 = one per core
+  u64 seed = 0;         // 0 = from the clock
+  std::size_t len = 32; // instructions per case
+  u64 block = 16;       // steps per compared block
+  u64 caseSeed = 0;     // --case: replay this case only
+  bool replay = false;
+};
+
+// Everything a run starts from.
+struct Case {
+  std::vector<u32> image; // all of memory; the program is the first words
+  std::size_t len = 0;    // program words
+  std::array<u64, 32> x{};
+  std::array<Vec128, 32> v{};
+  Flags flags;
+  std::vector<u64> breakpoints;
+  Interrupts irq;
+};
+
+class Gen {
+public:
+  explicit Gen(u64 seed): rng(seed) {}
+
+  u64 next() { return rng(); }
+  u64 below(u64 n) { return n ? rng() % n : 0; }
+  bool chance(int percent) { return below(100) < (u64)percent; }
+
+  // Mostly a handful of registers, so instructions feed each other.
+  u32 reg() {
+    static const u32 common[] = {0, 1, 2, 3, 4, 5, 6, 7, 28, 30, 31};
+    return chance(85) ? common[below(std::size(common))] : (u32)below(32);
+  }
+  // Base register for memory operands: usually X28, which points at data.
+  u32 base() { return chance(85) ? 28 : reg(); }
+
+  u64 value() {
+    switch (below(6)) {
+      case 0: return 0;
+      case 1: return below(8);
+      case 2: return kDataBase + 4 * below(32);
+      case 3: return ~0ull - below(4);
+      case 4: return 1ull << below(64);
+      default: return next();
+    }
+  }
+
+  // Word offset from 'at' to a random instruction of the program (or just past it).
+  i64 branchOffset(std::size_t at, std::size_t len) {
+    return (i64)below(len + 1) - (i64)at;
+  }
+
+  u32 instruction(std::size_t at, std::size_t len) {
+    const u32 rd = reg(), rn = reg(), rm = reg();
+    switch (below(15)) {
+      case 0: {
+        static const u32 ops[] = {OP_ADD, OP_SUB, OP_ADDS, OP_SUBS};
+        return ops[below(4)] << 21 | rm << 16 | rn << 5 | rd;
+      }
+      case 1: case 2: {
+        static const u32 ops[] = {OP_ADDI, OP_SUBI, OP_ADDIS, OP_SUBIS};
+        const u32 imm = chance(70) ? (u32)below(4) : (u32)below(4096);
+        return ops[below(4)] << 22 | imm << 10 | rn << 5 | rd;
+      }
+      case 3: {
+        const u32 op = chance(50) ? OP_LDUR : OP_STUR;
+        const u32 imm = chance(90) ? (u32)(4 * ((i64)below(17) - 8)) & 0x1FF : (u32)below(512);
+        return op << 21 | imm << 12 | base() << 5 | rd;
+      }
+      case 13: {
+        // Sized loads/stores, mostly naturally aligned, sometimes not.
+        static const u32 ops[] = {OP_LDURB, OP_STURB, OP_LDURH, OP_STURH, OP_LDURSW, OP_LDURD, OP_STURD};
+        const u32 imm = chance(80) ? (u32)(8 * ((i64)below(17) - 8)) & 0x1FF : (u32)((i64)below(64) - 32) & 0x1FF;
+        return ops[below(7)] << 21 | imm << 12 | base() << 5 | rd;
+      }
+      case 4: {
+        const u32 op = chance(80) ? OP_B : OP_BL;
+        return op << 26 | ((u32)branchOffset(at, len) & mask(26));
+      }
+      case 5: {
+        const u32 op = chance(50) ? OP_CBZ : OP_CBNZ;
+        return op << 24 | ((u32)branchOffset(at, len) & mask(19)) << 5 | rd;
+      }
+      case 6: case 7:
+        return OP_BCOND << 24 | ((u32)branchOffset(at, len) & mask(19)) << 5 | (u32)below(16);
+      case 8: case 9: {
+        // CMP..HARTID; the atomics use a data address, RET mostly X30.
+        const auto f = (XFunct)below((u32)XFunct::HARTID + 1);
+        u32 n = rn, m = rm;
+        if (f == XFunct::CAS || f == XFunct::LDADD) n = base();
+        if (f == XFunct::RET && chance(80)) n = 30;
+        if (f == XFunct::LSL || f == XFunct::LSR) m = (u32)below(64) & 31;
+        return OP_XEXT << 21 | m << 16 | (u32)f << 10 | n << 5 | rd;
+      }
+      case 10: // ERET, or HCALL INSTRET, the one deterministic service that needs no I/O
+        if (chance(30)) return OP_XEXT << 21 | (u32)XFunct::ERET << 10;
+        return OP_XEXT << 21 | (u32)HostCalls::InstrCount << 16 | (u32)XFunct::HCALL << 10;
+      case 11: case 12: {
+        const auto f = (VFunct)below((u32)VFunct::DUP + 1);
+        const u32 lanes = chance(50) ? VLANES64 : 0;
+        u32 n = rn, m = rm;
+        if (f == VFunct::LDR || f == VFunct::STR) { n = base(); m = (u32)below(2); }
+        if (f == VFunct::UMOV) m = (u32)below(4);
+        return OP_VEXT << 21 | m << 16 | ((u32)f | lanes) << 10 | n << 5 | rd;
+      }
+      default:
+        return chance(80) ? OP_NOP : OP_HALT;
+    }
+  }
+
+  Case makeCase(std::size_t len) {
+    Case c;
+    c.len = len;
+    c.image.assign(kMemWords, 0);
+    for (std::size_t i = kDataBase / 4; i < kMemWords; i++) c.image[i] = (u32)value();
+    for (std::size_t i = 0; i < len; i++) {
+      // The fused pairs are generated together so that they actually meet.
+      if (i + 1 < len && chance(15)) fusedPair(c.image, i++, len);
+      else c.image[i] = instruction(i, len);
+    }
+    for (auto& r : c.x) r = value();
+    c.x[28] = kDataBase + 4 * below(64);
+    for (auto& r : c.v) { r.d[0] = value(); r.d[1] = value(); }
+    c.flags = {chance(50), chance(50), chance(50), chance(50)};
+    for (u64 n = below(3); n > 0; n--) c.breakpoints.push_back(4 * below(len));
+    if (chance(50)) {
+      // A timer due early in the case, often periodic, sometimes mid-handler.
+      c.irq.at = below(64);
+      c.irq.period = chance(50) ? 1 + below(16) : 0;
+      c.irq.vector = 4 * below(len);
+      c.irq.elr = 4 * below(len);
+      c.irq.inHandler = chance(20);
+      c.irq.saved = {chance(50), chance(50), chance(50), chance(50)};
+    }
+    return c;
+  }
+
+private:
+  std::mt19937_64 rng;
+
+  void fusedPair(std::vector<u32>& img, std::size_t i, std::size_t len) {
+    const u32 a = reg(), b = reg();
+    const u32 off = (u32)branchOffset(i + 1, len) & mask(19);
+    switch (below(3)) {
+      case 0:
+        img[i] = OP_XEXT << 21 | b << 16 | (u32)XFunct::CMP << 10 | a << 5;
+        img[i + 1] = OP_BCOND << 24 | off << 5 | (u32)below(16);
+        break;
+      case 1:
+        img[i] = (chance(50) ? OP_SUBI : OP_ADDI) << 22 | (u32)below(3) << 10 | a << 5 | a;
+        img[i + 1] = (chance(50) ? OP_CBNZ : OP_CBZ) << 24 | off << 5 | (chance(80) ? a : b);
+        break;
+      default: {
+        const u32 imm = (u32)(4 * ((i64)below(17) - 8)) & 0x1FF;
+        img[i] = OP_LDUR << 21 | imm << 12 | base() << 5 | a;
+        img[i + 1] = OP_ADD << 21 | (chance(50) ? a : b) << 16 | (chance(50) ? b : a) << 5 | reg();
+        break;
+      }
+    }
+  }
+};
+
+// One side of the comparison. Reused from case to case: setting up a
+// Memory and a HostCalls buffer costs more than running a case.
+struct Machine {
+  Memory mem{kMemWords};
+  CPU cpu;
+  Breakpoints bps;
+  HostCalls host{[](int, const char*, std::size_t) {}, nullptr};
+  bool done = false;  // halted, stopped at a breakpoint or faulted
+  std::string status; // how the last block ended
+
+  // Self-modifying code can turn HCALL INSTRET into TIME; keep it repeatable.
+  Machine() { host.setClock([] { return u64(0); }); }
+
+  void load(const Case& c) {
+    for (std::size_t i = 0; i < kMemWords; i++) mem.setWordIndex(i, c.image[i]);
+    cpu = CPU();
+    for (int i = 0; i < 32; i++) { cpu.setX(i, c.x[i]); cpu.setV(i, c.v[i]); }
+    cpu.setFlags(c.flags);
+    cpu.setInterrupts(c.irq);
+    cpu.setHostCalls(&host);
+    bps.clear();
+    for (u64 a : c.breakpoints) bps.set(a);
+    done = false;
+    status.clear();
+  }
+};
+
+static const char* reasonName(StopReason r) {
+  switch (r) {
+    case StopReason::Halt: return "halt";
+    case StopReason::Breakpoint: return "breakpoint";
+    case StopReason::StepLimit: return "step limit";
+    default: return "return";
+  }
+}
+
+// The reference: what CPU::run promises, one step() at a time.
+static void referenceBlock(Machine& m, u64 steps) {
+  try {
+    for (u64 n = 0; n < steps; n++) {
+      if (!m.cpu.step(m.mem)) { m.status = "halt"; m.done = true; return; }
+      if (!m.bps.empty() && m.bps.check(m.cpu.getPC(), m.cpu, m.mem)) {
+        m.status = "breakpoint";
+        m.done = true;
+        return;
+      }
+    }
+    m.status = "step limit";
+  } catch (const std::exception& e) {
+    m.status = std::string("error: ") + e.what();
+    m.done = true;
+  }
+}
+
+static void engineBlock(Machine& m, u64 steps) {
+  try {
+    StopReason r = m.cpu.run(m.mem, steps, &m.bps);
+    m.status = reasonName(r);
+    m.done = r != StopReason::StepLimit;
+  } catch (const std::exception& e) {
+    m.status = std::string("error: ") + e.what();
+    m.done = true;
+  }
+}
+
+static std::string hex(u64 v) {
+  char buf[32];
+  std::snprintf(buf, sizeof buf, "0x%llx", (unsigned long long)v);
+  return buf;
+}
+
+// The first difference between the two machines, "" if none.
+static std::string difference(const Machine& ref, const Machine& eng) {
+  auto diff = [](const std::string& what, u64 a, u64 b) {
+    return what + ": reference " + hex(a) + ", engine " + hex(b);
+  };
+  if (ref.status != eng.status) return "stop: reference '" + ref.status + "', engine '" + eng.status + "'";
+  const CPU& a = ref.cpu;
+  const CPU& b = eng.cpu;
+  if (a.getPC() != b.getPC()) return diff("PC", a.getPC(), b.getPC());
+  for (int i = 0; i < 32; i++) {
+    if (a.getX(i) != b.getX(i)) return diff("X" + std::to_string(i), a.getX(i), b.getX(i));
+    for (int k = 0; k < 2; k++) {
+      if (a.getV(i).d[k] != b.getV(i).d[k])
+        return diff("V" + std::to_string(i) + ".D[" + std::to_string(k) + "]", a.getV(i).d[k], b.getV(i).d[k]);
+    }
+  }
+  const Flags fa = a.getFlags(), fb = b.getFlags();
+  const u64 na = fa.N << 3 | fa.Z << 2 | fa.C << 1 | fa.V, nb = fb.N << 3 | fb.Z << 2 | fb.C << 1 | fb.V;
+  if (na != nb) return diff("NZCV", na, nb);
+  if (a.getCallDepth() != b.getCallDepth()) return diff("call depth", (u64)a.getCallDepth(), (u64)b.getCallDepth());
+  if (a.counters().instret != b.counters().instret) return diff("instret", a.counters().instret, b.counters().instret);
+  const Interrupts& ia = a.getInterrupts();
+  const Interrupts& ib = b.getInterrupts();
+  if (ia.taken != ib.taken) return diff("interrupts taken", ia.taken, ib.taken);
+  if (ia.at != ib.at) return diff("interrupt due at", ia.at, ib.at);
+  if (ia.inHandler != ib.inHandler) return diff("in handler", ia.inHandler, ib.inHandler);
+  if (ia.elr != ib.elr) return diff("ELR", ia.elr, ib.elr);
+  for (std::size_t i = 0; i < kMemWords; i++) {
+    if (ref.mem.getWordIndex(i) != eng.mem.getWordIndex(i))
+      return diff("M[" + std::to_string(4 * i) + "]", ref.mem.getWordIndex(i), eng.mem.getWordIndex(i));
+  }
+  return "";
+}
+
+struct Outcome {
+  std::string what; // "" = the engines agree
+  int block = 0;
+  u64 instret = 0;  // reference instructions retired
+};
+
+struct Pair {
+  Machine ref, eng;
+};
+
+static Outcome runCase(Pair& m, const Case& c, u64 block) {
+  Machine& ref = m.ref;
+  Machine& eng = m.eng;
+  ref.load(c);
+  eng.load(c);
+  Outcome o;
+  for (o.block = 0; o.block < kBlocks; o.block++) {
+    referenceBlock(ref, block);
+    engineBlock(eng, block);
+    o.what = difference(ref, eng);
+    if (!o.what.empty() || ref.done) break;
+  }
+  o.instret = ref.cpu.counters().instret;
+  return o;
+}
+
+// Smallest variant of a failing case that still fails.
+static Case minimise(Pair& m, Case c, u64 block) {
+  auto fails = [&](const Case& t) { return !runCase(m, t, block).what.empty(); };
+  for (bool progress = true; progress;) {
+    progress = false;
+    for (std::size_t i = 0; i < c.len; i++) {
+      if (c.image[i] == OP_NOP) continue;
+      Case t = c;
+      t.image[i] = OP_NOP;
+      if (fails(t)) { c = std::move(t); progress = true; }
+    }
+    for (int r = 0; r < 32; r++) {
+      if (c.x[r] == 0) continue;
+      Case t = c;
+      t.x[r] = 0;
+      if (fails(t)) { c = std::move(t); progress = true; }
+    }
+    for (std::size_t i = kDataBase / 4; i < kMemWords; i++) {
+      if (c.image[i] == 0) continue;
+      Case t = c;
+      t.image[i] = 0;
+      if (fails(t)) { c = std::move(t); progress = true; }
+    }
+    for (std::size_t i = 0; i < c.breakpoints.size(); i++) {
+      Case t = c;
+      t.breakpoints.erase(t.breakpoints.begin() + (long)i);
+      if (fails(t)) { c = std::move(t); progress = true; break; }
+    }
+  }
+  return c;
+}
+
+static std::string report(const Case& c, const Outcome& o, u64 seed, const Options& opt) {
+  std::ostringstream out;
+  out << "; fuzz mismatch (case seed " << seed << ") in block " << o.block << ": " << o.what << "\n";
+  out << "; replay: fuzz --case " << seed << " --len " << opt.len << " --block " << opt.block << "\n";
+  out << "; registers:";
+  for (int r = 0; r < 32; r++) if (c.x[r]) out << " X" << r << "=" << hex(c.x[r]);
+  out << "\n; NZCV: " << c.flags.N << c.flags.Z << c.flags.C << c.flags.V << "\n";
+  if (c.irq.at != Interrupts::kNever) {
+    out << "; timer: due at " << c.irq.at << ", period " << c.irq.period << ", vector " << c.irq.vector
+        << (c.irq.inHandler ? ", in handler, ELR " + std::to_string(c.irq.elr) : std::string()) << "\n";
+  }
+  if (!c.breakpoints.empty()) {
+    out << "; breakpoints:";
+    for (u64 a : c.breakpoints) out << " " << a;
+    out << "\n";
+  }
+  for (std::size_t i = kDataBase / 4; i < kMemWords; i++) {
+    if (c.image[i]) out << "; M[" << 4 * i << "]=" << hex(c.image[i]) << "\n";
+  }
+  std::size_t end = c.len;
+  while (end > 0 && c.image[end - 1] == OP_NOP) end--;
+  for (std::size_t i = 0; i < end; i++) out << "  " << Assembler::disasm(c.image[i], 4 * i) << "\n";
+  if (end < c.len) out << "  ; NOP up to " << 4 * c.len << "\n";
+  return out.str();
+}
+
+static void usage() {
+  std::cerr << "usage: fuzz [--seconds N] [--threads N] [--seed N] [--len N] [--block N]\n"
+               "       fuzz --case SEED [--len N] [--block N]\n";
+}
+
+int main(int argc, char** argv) {
+  Options opt;
+  for (int i = 1; i < argc; i++) {
+    auto num = [&] {
+      if (i + 1 >= argc) { usage(); std::exit(2); }
+      return std::strtoull(argv[++i], nullptr, 0);
+    };
+    if (std::strcmp(argv[i], "--seconds") == 0) opt.seconds = (double)num();
+    else if (std::strcmp(argv[i], "--threads") == 0) opt.threads = (unsigned)num();
+    else if (std::strcmp(argv[i], "--seed") == 0) opt.seed = num();
+    else if (std::strcmp(argv[i], "--len") == 0) opt.len = std::clamp<std::size_t>(num(), 2, kDataBase / 4);
+    else if (std::strcmp(argv[i], "--block") == 0) opt.block = std::max<u64>(1, num());
+    else if (std::strcmp(argv[i], "--case") == 0) { opt.caseSeed = num(); opt.replay = true; }
+    else { usage(); return 2; }
+  }
+  if (opt.replay) {
+    auto machines = std::make_unique<Pair>();
+    Case c = Gen(opt.caseSeed).makeCase(opt.len);
+    if (runCase(*machines, c, opt.block).what.empty()) {
+      std::printf("case %llu: no mismatch\n", (unsigned long long)opt.caseSeed);
+      return 0;
+    }
+    Case small = minimise(*machines, c, opt.block);
+    std::printf("MISMATCH\n%s", report(small, runCase(*machines, small, opt.block), opt.caseSeed, opt).c_str());
+    return 1;
+  }
+  if (!opt.threads) opt.threads = std::max(1u, std::thread::hardware_concurrency());
+  if (!opt.seed) opt.seed = (u64)std::chrono::steady_clock::now().time_since_epoch().count();
+
+  std::printf("fuzz: %u threads, seed %llu, %zu instructions per case, blocks of %llu steps\n", opt.threads,
+              (unsigned long long)opt.seed, opt.len, (unsigned long long)opt.block);
+  std::fflush(stdout);
+
+  std::atomic<bool> stop{false};
+  std::atomic<u64> cases{0}, instructions{0};
+  std::mutex failLock;
+  std::string failure;
+
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < opt.threads; t++) {
+    workers.emplace_back([&, t] {
+      // Every case has its own seed, so a failure can be regenerated alone
+      // with --case.
+      std::mt19937_64 seeds(opt.seed + t);
+      u64 localCases = 0, localInstr = 0;
+      auto machines = std::make_unique<Pair>();
+      while (!stop.load(std::memory_order_relaxed)) {
+        const u64 caseSeed = seeds();
+        Gen gen(caseSeed);
+        Case c = gen.makeCase(opt.len);
+        Outcome o = runCase(*machines, c, opt.block);
+        localCases++;
+        localInstr += 2 * o.instret;
+        if (!o.what.empty()) {
+          Case small = minimise(*machines, c, opt.block);
+          std::lock_guard<std::mutex> g(failLock);
+          if (failure.empty()) failure = report(small, runCase(*machines, small, opt.block), caseSeed, opt);
+          stop = true;
+        }
+        if (localCases == 256) {
+          cases += localCases;
+          instructions += localInstr;
+          localCases = localInstr = 0;
+        }
+      }
+      cases += localCases;
+      instructions += localInstr;
+    });
+  }
+
+  const auto t0 = std::chrono::steady_clock::now();
+  auto elapsed = [&] { return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count(); };
+  double nextReport = 10;
+  while (!stop) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    const double s = elapsed();
+    if (opt.seconds > 0 && s >= opt.seconds) stop = true;
+    if (s >= nextReport && !stop) {
+      std::printf("  %.0f s: %llu cases (%.0f/s)\n", s, (unsigned long long)cases.load(), (double)cases.load() / s);
+      std::fflush(stdout);
+      nextReport += 10;
+    }
+  }
+  for (auto& w : workers) w.join();
+
+  const double s = elapsed();
+  std::printf("%llu cases in %.1f s: %.0f cases/s, %.1f M guest instructions/s (both engines)\n",
+              (unsigned long long)cases.load(), s, (double)cases.load() / s, (double)instructions.load() / s / 1e6);
+  if (!failure.empty()) {
+    std::printf("MISMATCH\n%s", failure.c_str());
+    return 1;
+  }
+  std::printf("no mismatches\n");
+  return 0;
+}
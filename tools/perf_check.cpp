@@ -0,0 +1,209 @@
+// Performance regression harness (make perf-check).
+//
+// Runs every perf/*.s reference program on the headless engine (CPU::run)
+// and checks it against the expectations in its header comments:
+//
+//   ; @mem 2048              memory size in words (default 1024)
+//   ; @expect X1=42 PC=20    final registers / PC
+//   ; @instret 1234          retired-instruction count
+//   ; @budget-ms 500         absolute wall-time budget
+//
+// Timing is the fastest of --repeat runs. A program also fails when it is
+// more than --threshold slower than its entry in the baseline file.
+//
+//   perf_check [--update] [--threshold 0.25] [--repeat 5] dir baseline
+//
+// --update rewrites the baseline with the times just measured.
+#include "Assembler.h"
+#include "CPU.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+struct PerfProgram {
+  std::string name;
+  std::vector<std::string> lines;
+  std::size_t memWords = 1024;
+  std::vector<std::pair<std::string, u64>> expect; // "X3"/"PC" -> value
+  u64 instret = 0;
+  bool hasInstret = false;
+  double budgetMs = 0;
+};
+
+static constexpr u64 kMaxSteps = 10'000'000'000ull;
+
+static std::vector<std::string> readAllLines(const std::string& fname) {
+  std::ifstream in(fname);
+  if (!in) throw std::runtime_error("Cannot open file: " + fname);
+  std::vector<std::string> lines;
+  std::string line;
+  while (std::getline(in, line)) lines.push_back(line);
+  return lines;
+}
+
+static PerfProgram parseProgram(const fs::path& p) {
+  PerfProgram prog;
+  prog.name = p.stem().string();
+  prog.lines = readAllLines(p.string());
+  for (auto& line : prog.lines) {
+    auto at = line.find("; @");
+    if (at == std::string::npos) continue;
+    std::istringstream iss(line.substr(at + 3));
+    std::string key, tok;
+    iss >> key;
+    if (key == "mem") iss >> prog.memWords;
+    else if (key == "instret") { iss >> prog.instret; prog.hasInstret = true; }
+    else if (key == "budget-ms") iss >> prog.budgetMs;
+    else if (key == "expect") {
+      while (iss >> tok) {
+        auto eq = tok.find('=');
+        if (eq == std::string::npos) throw std::runtime_error(prog.name + ": bad @expect " + tok);
+        prog.expect.emplace_back(tok.substr(0, eq), std::stoull(tok.substr(eq + 1), nullptr, 0));
+      }
+    } else {
+      throw std::runtime_error(prog.name + ": unknown directive @" + key);
+    }
+  }
+  return prog;
+}
+
+static std::map<std::string, double> readBaseline(const std::string& fname) {
+  std::map<std::string, double> base;
+  std::ifstream in(fname);
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.empty() || line[0] == '#') continue;
+    std::istringstream iss(line);
+    std::string name;
+    double ms = 0;
+    if (iss >> name >> ms) base[name] = ms;
+  }
+  return base;
+}
+
+static std::string fmt(const char* f, double v) {
+  char buf[64];
+  std::snprintf(buf, sizeof buf, f, v);
+  return buf;
+}
+
+static void writeBaseline(const std::string& fname, const std::map<std::string, double>& base) {
+  std::ofstream out(fname);
+  if (!out) throw std::runtime_error("Cannot write file: " + fname);
+  out << "# perf-check baseline: program, fastest headless run in ms (make perf-baseline)\n";
+  for (auto& [name, ms] : base) out << name << " " << fmt("%.2f", ms) << "\n";
+}
+
+// Runs the program once from a fresh machine. Returns the host time in ms.
+static double runOnce(const PerfProgram& prog, const Assembler::Program& image, CPU& cpu) {
+  Memory mem(prog.memWords);
+  if (image.words.size() > mem.sizeWords()) throw std::runtime_error(prog.name + ": program does not fit in @mem");
+  for (std::size_t i = 0; i < image.words.size(); i++) mem.setWordIndex(i, image.words[i]);
+  cpu = CPU();
+  auto t0 = std::chrono::steady_clock::now();
+  StopReason why = cpu.run(mem, kMaxSteps);
+  auto dt = std::chrono::steady_clock::now() - t0;
+  if (why != StopReason::Halt) throw std::runtime_error(prog.name + ": did not HALT");
+  return std::chrono::duration<double, std::milli>(dt).count();
+}
+
+// Architectural mismatches, one per line ("" when everything matches).
+static std::string checkState(const PerfProgram& prog, const CPU& cpu) {
+  std::ostringstream err;
+  for (auto& [what, want] : prog.expect) {
+    u64 got = 0;
+    if (what == "PC") got = cpu.getPC();
+    else if (what.size() > 1 && what[0] == 'X') got = cpu.getX(std::stoi(what.substr(1)));
+    else throw std::runtime_error(prog.name + ": cannot check " + what);
+    if (got != want) err << "  " << what << " = " << got << ", expected " << want << "\n";
+  }
+  if (prog.hasInstret && cpu.counters().instret != prog.instret)
+    err << "  instret = " << cpu.counters().instret << ", expected " << prog.instret << "\n";
+  return err.str();
+}
+
+static void usage() {
+  std::cerr << "usage: perf_check [--update] [--threshold F] [--repeat N] dir baseline\n";
+}
+
+int main(int argc, char** argv) {
+  try {
+    bool update = false;
+    double threshold = 0.25;
+    int repeat = 5;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; i++) {
+      if (std::strcmp(argv[i], "--update") == 0) update = true;
+      else if (std::strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) threshold = std::atof(argv[++i]);
+      else if (std::strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) repeat = std::max(1, std::atoi(argv[++i]));
+      else args.push_back(argv[i]);
+    }
+    if (args.size() != 2) { usage(); return 2; }
+
+    std::vector<fs::path> files;
+    for (auto& e : fs::directory_iterator(args[0]))
+      if (e.path().extension() == ".s") files.push_back(e.path());
+    std::sort(files.begin(), files.end());
+    if (files.empty()) throw std::runtime_error("No .s programs in " + args[0]);
+
+    auto baseline = readBaseline(args[1]);
+    std::map<std::string, double> measured;
+    int failures = 0;
+
+    std::printf("%-12s %12s %10s %10s %10s %7s %8s  %s\n",
+                "program", "instret", "budget", "baseline", "time", "ratio", "MIPS", "result");
+    for (auto& f : files) {
+      auto prog = parseProgram(f);
+      auto image = Assembler::assembleSource(prog.lines, 0);
+
+      CPU cpu;
+      double best = runOnce(prog, image, cpu);
+      std::string mismatch = checkState(prog, cpu);
+      for (int r = 1; r < repeat; r++) best = std::min(best, runOnce(prog, image, cpu));
+      measured[prog.name] = best;
+
+      auto b = baseline.find(prog.name);
+      double ratio = b != baseline.end() && b->second > 0 ? best / b->second : 0;
+      std::string result = "ok";
+      if (!mismatch.empty()) result = "MISMATCH";
+      else if (prog.budgetMs > 0 && best > prog.budgetMs) result = "OVER BUDGET";
+      else if (!update && ratio > 1 + threshold) result = "SLOWER";
+      else if (b == baseline.end()) result = "ok (no baseline)";
+      if (result.compare(0, 2, "ok") != 0) failures++;
+
+      std::string budget = prog.budgetMs > 0 ? fmt("%.0f ms", prog.budgetMs) : "-";
+      std::string base = b != baseline.end() ? fmt("%.2f ms", b->second) : "-";
+      std::string ratioStr = ratio > 0 ? fmt("%.2f", ratio) : "-";
+      double mips = best > 0 ? (double)cpu.counters().instret / (best * 1e3) : 0;
+      std::printf("%-12s %12llu %10s %10s %7.2f ms %7s %8.1f  %s\n", prog.name.c_str(),
+                  (unsigned long long)cpu.counters().instret, budget.c_str(), base.c_str(), best,
+                  ratioStr.c_str(), mips, result.c_str());
+      if (!mismatch.empty()) std::printf("%s", mismatch.c_str());
+    }
+
+    if (update) {
+      writeBaseline(args[1], measured);
+      std::printf("Baseline written to %s\n", args[1].c_str());
+    }
+    if (failures) {
+      std::printf("%d of %zu programs failed (threshold +%.0f%% over baseline)\n", failures, files.size(), threshold * 100);
+      return 1;
+    }
+    std::printf("All %zu programs passed\n", files.size());
+    return 0;
+  } catch (const std::exception& e) {
+    std::cerr << "Fatal: " << e.what() << "\n";
+    return 1;
+  }
+}
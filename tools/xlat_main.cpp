@@ -0,0 +1,96 @@
+// Driver for a translated program (see Translator.h). Runs the generated
+// xlatRun from the baked-in machine state and prints the final state.
+//
+//   ./prog [maxSteps]          run the translation (exit status: the guest's HCALL EXIT code)
+//   ./prog --check [maxSteps]  also run the interpreter from the same state
+//                              and compare registers, PC, flags, count, memory
+#include "HostCalls.h"
+#include "Translator.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+static void loadInitialState(CPU& cpu, Memory& mem) {
+  for (std::size_t i = 0; i < xlatImageWords; i++) mem.setWordIndex(i, xlatImage[i]);
+  for (int i = 0; i < 32; i++) cpu.setX(i, xlatInitRegs[i]);
+  cpu.setPC(xlatInitPc);
+  cpu.setFlags(xlatInitFlags);
+}
+
+static void printState(const char* what, StopReason why, const CPU& cpu, double ms) {
+  auto f = cpu.getFlags();
+  std::cout << what << ": " << (why == StopReason::Halt ? "HALT" : "STEP LIMIT")
+            << " after " << cpu.counters().instret << " instructions, " << ms << " ms\n";
+  std::cout << "PC=" << cpu.getPC() << " N=" << f.N << " Z=" << f.Z << " C=" << f.C << " V=" << f.V << "\n";
+  for (int i = 0; i < 32; i++) {
+    if (cpu.getX(i)) std::cout << "X" << i << "=" << cpu.getX(i) << "\n";
+  }
+}
+
+// HCALL output of the translated run goes to stdout; the --check reference
+// run's output is dropped, so it is not printed twice.
+static void toStdout(int fd, const char* data, std::size_t n) {
+  (fd == 2 ? std::cerr : std::cout).write(data, (std::streamsize)n);
+}
+
+// Up to n bytes, stopping after a newline, as in the simulator.
+static std::size_t fromStdin(char* data, std::size_t n) {
+  std::size_t got = 0;
+  char ch;
+  while (got < n && std::cin.get(ch)) {
+    data[got++] = ch;
+    if (ch == '\n') break;
+  }
+  return got;
+}
+
+template <typename F>
+static double timeMs(F&& f) {
+  auto t0 = std::chrono::steady_clock::now();
+  f();
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+int main(int argc, char** argv) {
+  try {
+    bool check = false;
+    u64 maxSteps = ~0ull;
+    for (int i = 1; i < argc; i++) {
+      if (std::strcmp(argv[i], "--check") == 0) check = true;
+      else maxSteps = std::strtoull(argv[i], nullptr, 10);
+    }
+
+    Memory mem(xlatMemWords);
+    CPU cpu;
+    HostCalls host(toStdout, fromStdin);
+    cpu.setHostCalls(&host);
+    loadInitialState(cpu, mem);
+    StopReason why{};
+    double ms = timeMs([&] { why = xlatRun(cpu, mem, maxSteps); });
+    host.flush();
+    printState("translated", why, cpu, ms);
+    if (!check) return host.exited() ? (int)host.exitCode() : 0;
+
+    Memory refMem(xlatMemWords);
+    CPU ref;
+    HostCalls refHost([](int, const char*, std::size_t) {}, fromStdin);
+    ref.setHostCalls(&refHost);
+    loadInitialState(ref, refMem);
+    StopReason refWhy{};
+    double refMs = timeMs([&] { refWhy = ref.run(refMem, maxSteps); });
+    printState("interpreter", refWhy, ref, refMs);
+
+    bool same = why == refWhy && cpu.getPC() == ref.getPC() &&
+                cpu.counters().instret == ref.counters().instret;
+    auto f = cpu.getFlags(), g = ref.getFlags();
+    same = same && f.N == g.N && f.Z == g.Z && f.C == g.C && f.V == g.V;
+    for (int i = 0; i < 32; i++) same = same && cpu.getX(i) == ref.getX(i);
+    for (std::size_t i = 0; i < xlatMemWords; i++) same = same && mem.getWordIndex(i) == refMem.getWordIndex(i);
+    std::cout << (same ? "MATCH" : "MISMATCH") << "\n";
+    return same ? 0 : 2;
+  } catch (const std::exception& e) {
+    std::cerr << "Fatal: " << e.what() << "\n";
+    return 1;
+  }
+}